@@ -431,6 +431,11 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
         /* We add the TB in the virtual pc hash table for the fast lookup */
         qatomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
     }
+    /* The TB just got hot and asked to be retranslated as a trace. */
+    if (unlikely(qatomic_read(&tb->trace_state) == TB_TRACE_HOT)) {
+        tb = tb_gen_trace(cpu, tb);
+        qatomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
+    }
 #ifndef CONFIG_USER_ONLY
     /* We don't take care of direct jumps when address mapping changes in
      * system emulation. So it's not safe to make a direct jump to a TB
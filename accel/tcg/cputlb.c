@@ -233,6 +233,7 @@ static void tlb_mmu_resize_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
 static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
 {
     desc->n_used_entries = 0;
+    desc->n_large_pages = 0;
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
     desc->vindex = 0;
@@ -339,6 +340,21 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+void tlb_flush_large_counts(size_t *plarge, size_t *pfull)
+{
+    CPUState *cpu;
+    size_t large = 0, full = 0;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+
+        large += qatomic_read(&env_tlb(env)->c.large_flush_count);
+        full += qatomic_read(&env_tlb(env)->c.large_full_flush_count);
+    }
+    *plarge = large;
+    *pfull = full;
+}
+
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -493,24 +509,93 @@ static inline void tlb_flush_vtlb_page_locked(CPUArchState *env, int mmu_idx,
     tlb_flush_vtlb_page_mask_locked(env, mmu_idx, page, -1);
 }
 
-static void tlb_flush_page_locked(CPUArchState *env, int midx,
-                                  target_ulong page)
+/*
+ * Flush all the entries of large page @i of @midx, and stop tracking it.
+ * Walk the pages of the large page if it has fewer pages than the tlb
+ * has entries, and scan the whole tlb otherwise.
+ * Called with tlb_c.lock held.
+ */
+static void tlb_flush_large_page_locked(CPUArchState *env, int midx, int i)
 {
-    target_ulong lp_addr = env_tlb(env)->d[midx].large_page_addr;
-    target_ulong lp_mask = env_tlb(env)->d[midx].large_page_mask;
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    CPUTLBDescFast *f = &env_tlb(env)->f[midx];
+    target_ulong lp_addr = d->large_page[i].addr;
+    target_ulong lp_mask = d->large_page[i].mask;
+    size_t n_entries = tlb_n_entries(f);
+    size_t j;
 
-    /* Check if we need to flush due to large pages.  */
-    if ((page & lp_mask) == lp_addr) {
+    tlb_debug("flush large page midx %d (" TARGET_FMT_lx "/" TARGET_FMT_lx
+              ")\n", midx, lp_addr, lp_mask);
+
+    if ((~lp_mask >> TARGET_PAGE_BITS) < n_entries) {
+        for (target_ulong p = 0; p <= ~lp_mask; p += TARGET_PAGE_SIZE) {
+            CPUTLBEntry *entry = tlb_entry(env, midx, lp_addr + p);
+
+            if (tlb_flush_entry_mask_locked(entry, lp_addr, lp_mask)) {
+                tlb_n_used_entries_dec(env, midx);
+            }
+        }
+    } else {
+        for (j = 0; j < n_entries; j++) {
+            if (tlb_flush_entry_mask_locked(&f->table[j], lp_addr, lp_mask)) {
+                tlb_n_used_entries_dec(env, midx);
+            }
+        }
+    }
+    tlb_flush_vtlb_page_mask_locked(env, midx, lp_addr, lp_mask);
+
+    d->large_page[i] = d->large_page[--d->n_large_pages];
+    qatomic_set(&env_tlb(env)->c.large_flush_count,
+                env_tlb(env)->c.large_flush_count + 1);
+}
+
+/*
+ * Flush the large pages of @midx that overlap [@addr, @last].  Return
+ * false if a full flush was needed instead, because the range overlaps
+ * the large pages that are not tracked individually.
+ * Called with tlb_c.lock held.
+ */
+static bool tlb_flush_large_pages_locked(CPUArchState *env, int midx,
+                                         target_ulong addr, target_ulong last)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    int i;
+
+    /*
+     * Because large_page_mask contains all 1's from the msb,
+     * we only need to test the end of the range.
+     */
+    if ((last & d->large_page_mask) == d->large_page_addr) {
         tlb_debug("forcing full flush midx %d ("
                   TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
-                  midx, lp_addr, lp_mask);
+                  midx, d->large_page_addr, d->large_page_mask);
         tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
-    } else {
-        if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
-            tlb_n_used_entries_dec(env, midx);
+        qatomic_set(&env_tlb(env)->c.large_full_flush_count,
+                    env_tlb(env)->c.large_full_flush_count + 1);
+        return false;
+    }
+
+    for (i = d->n_large_pages - 1; i >= 0; i--) {
+        target_ulong lp_addr = d->large_page[i].addr;
+
+        if (lp_addr <= last && addr <= (lp_addr | ~d->large_page[i].mask)) {
+            tlb_flush_large_page_locked(env, midx, i);
         }
-        tlb_flush_vtlb_page_locked(env, midx, page);
     }
+    return true;
+}
+
+static void tlb_flush_page_locked(CPUArchState *env, int midx,
+                                  target_ulong page)
+{
+    /* Check if we need to flush due to large pages.  */
+    if (!tlb_flush_large_pages_locked(env, midx, page, page)) {
+        return;
+    }
+    if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
+        tlb_n_used_entries_dec(env, midx);
+    }
+    tlb_flush_vtlb_page_locked(env, midx, page);
 }
 
 /**
@@ -711,7 +796,6 @@ static void tlb_flush_range_locked(CPUArchState *env, int midx,
                                    target_ulong addr, target_ulong len,
                                    unsigned bits)
 {
-    CPUTLBDesc *d = &env_tlb(env)->d[midx];
     CPUTLBDescFast *f = &env_tlb(env)->f[midx];
     target_ulong mask = MAKE_64BIT_MASK(0, bits);
 
@@ -733,16 +817,8 @@ static void tlb_flush_range_locked(CPUArchState *env, int midx,
         return;
     }
 
-    /*
-     * Check if we need to flush due to large pages.
-     * Because large_page_mask contains all 1's from the msb,
-     * we only need to test the end of the range.
-     */
-    if (((addr + len - 1) & d->large_page_mask) == d->large_page_addr) {
-        tlb_debug("forcing full flush midx %d ("
-                  TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
-                  midx, d->large_page_addr, d->large_page_mask);
-        tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
+    /* Check if we need to flush due to large pages.  */
+    if (!tlb_flush_large_pages_locked(env, midx, addr, addr + len - 1)) {
         return;
     }
 
@@ -1062,13 +1138,33 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 }
 
-/* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
+/*
+ * Our TLB does not support large pages, so remember the large pages that
+ * are mapped, so that flushing a page within one of them flushes all of
+ * its entries.  Only CPU_TLB_LARGE_PAGES are tracked individually; the
+ * others are merged into a single region, within which any flush forces
+ * a full TLB flush.
+ */
 static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
                                target_ulong vaddr, target_ulong size)
 {
-    target_ulong lp_addr = env_tlb(env)->d[mmu_idx].large_page_addr;
+    CPUTLBDesc *d = &env_tlb(env)->d[mmu_idx];
+    target_ulong lp_addr = d->large_page_addr;
     target_ulong lp_mask = ~(size - 1);
+    int i;
+
+    for (i = 0; i < d->n_large_pages; i++) {
+        if (d->large_page[i].mask == lp_mask &&
+            d->large_page[i].addr == (vaddr & lp_mask)) {
+            return;
+        }
+    }
+    if (d->n_large_pages < CPU_TLB_LARGE_PAGES) {
+        d->large_page[d->n_large_pages].addr = vaddr & lp_mask;
+        d->large_page[d->n_large_pages].mask = lp_mask;
+        d->n_large_pages++;
+        return;
+    }
 
     if (lp_addr == (target_ulong)-1) {
         /* No previous large page.  */
@@ -1077,13 +1173,13 @@ static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
         /* Extend the existing region to include the new page.
            This is a compromise between unnecessary flushes and
            the cost of maintaining a full variable size TLB.  */
-        lp_mask &= env_tlb(env)->d[mmu_idx].large_page_mask;
+        lp_mask &= d->large_page_mask;
         while (((lp_addr ^ vaddr) & lp_mask) != 0) {
             lp_mask <<= 1;
         }
     }
-    env_tlb(env)->d[mmu_idx].large_page_addr = lp_addr & lp_mask;
-    env_tlb(env)->d[mmu_idx].large_page_mask = lp_mask;
+    d->large_page_addr = lp_addr & lp_mask;
+    d->large_page_mask = lp_mask;
 }
 
 /* Add a new TLB entry. At most one entry for a given virtual address
@@ -2765,7 +2861,12 @@ static uint64_t full_ldub_code(CPUArchState *env, target_ulong addr,
 
 uint32_t cpu_ldub_code(CPUArchState *env, abi_ptr addr)
 {
-    TCGMemOpIdx oi = make_memop_idx(MO_UB, cpu_mmu_index(env, true));
+    TCGMemOpIdx oi;
+
+    if (unlikely(tb_bg_code)) {
+        return ldub_p(tb_bg_code_ptr(addr, 1));
+    }
+    oi = make_memop_idx(MO_UB, cpu_mmu_index(env, true));
     return full_ldub_code(env, addr, oi, 0);
 }
 
@@ -2777,7 +2878,12 @@ static uint64_t full_lduw_code(CPUArchState *env, target_ulong addr,
 
 uint32_t cpu_lduw_code(CPUArchState *env, abi_ptr addr)
 {
-    TCGMemOpIdx oi = make_memop_idx(MO_TEUW, cpu_mmu_index(env, true));
+    TCGMemOpIdx oi;
+
+    if (unlikely(tb_bg_code)) {
+        return lduw_p(tb_bg_code_ptr(addr, 2));
+    }
+    oi = make_memop_idx(MO_TEUW, cpu_mmu_index(env, true));
     return full_lduw_code(env, addr, oi, 0);
 }
 
@@ -2789,7 +2895,12 @@ static uint64_t full_ldl_code(CPUArchState *env, target_ulong addr,
 
 uint32_t cpu_ldl_code(CPUArchState *env, abi_ptr addr)
 {
-    TCGMemOpIdx oi = make_memop_idx(MO_TEUL, cpu_mmu_index(env, true));
+    TCGMemOpIdx oi;
+
+    if (unlikely(tb_bg_code)) {
+        return ldl_p(tb_bg_code_ptr(addr, 4));
+    }
+    oi = make_memop_idx(MO_TEUL, cpu_mmu_index(env, true));
     return full_ldl_code(env, addr, oi, 0);
 }
 
@@ -2801,6 +2912,11 @@ static uint64_t full_ldq_code(CPUArchState *env, target_ulong addr,
 
 uint64_t cpu_ldq_code(CPUArchState *env, abi_ptr addr)
 {
-    TCGMemOpIdx oi = make_memop_idx(MO_TEQ, cpu_mmu_index(env, true));
+    TCGMemOpIdx oi;
+
+    if (unlikely(tb_bg_code)) {
+        return ldq_p(tb_bg_code_ptr(addr, 8));
+    }
+    oi = make_memop_idx(MO_TEQ, cpu_mmu_index(env, true));
     return full_ldq_code(env, addr, oi, 0);
 }
@@ -15,8 +15,35 @@ TranslationBlock *tb_gen_code(CPUState *cpu, target_ulong pc,
                               target_ulong cs_base, uint32_t flags,
                               int cflags);
 
+TranslationBlock *tb_gen_trace(CPUState *cpu, TranslationBlock *tb);
+
+/* Executions after which a TB is retranslated as a trace, or 0 */
+extern uint32_t tb_trace_threshold;
+
 void QEMU_NORETURN cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 void page_init(void);
 void tb_htable_init(void);
 
+#ifdef CONFIG_USER_ONLY
+bool tb_link_restored(TranslationBlock *tb);
+/* End of the host code and search data of @tb in the code buffer */
+const void *tb_code_end(const TranslationBlock *tb);
+#else
+/*
+ * Background translation runs the translator on a snapshot of the vCPU.
+ * The aarch64 translator also reads the softmmu TLB of the vCPU (see
+ * is_guarded_page()), which such a snapshot does not capture.
+ */
+#ifndef TARGET_AARCH64
+#define TCG_TB_BG_SUPPORTED
+#endif
+
+void tb_bg_init(unsigned int nr_threads);
+void tb_bg_cancel(CPUState *cpu);
+
+/* Set while a background thread translates from a copy of a guest page */
+extern __thread const struct TBBgRequest *tb_bg_code;
+const void *tb_bg_code_ptr(target_ulong addr, int size);
+#endif
+
 #endif /* ACCEL_TCG_INTERNAL_H */
@@ -74,6 +74,8 @@ enum plugin_gen_from {
 enum plugin_gen_cb {
     PLUGIN_GEN_CB_UDATA,
     PLUGIN_GEN_CB_INLINE,
+    PLUGIN_GEN_CB_INLINE_STORE,
+    PLUGIN_GEN_CB_INLINE_VADDR,
     PLUGIN_GEN_CB_MEM,
     PLUGIN_GEN_ENABLE_MEM_HELPER,
     PLUGIN_GEN_DISABLE_MEM_HELPER,
@@ -141,6 +143,38 @@ static void gen_empty_inline_cb(void)
     tcg_temp_free_i64(val);
 }
 
+/*
+ * Template for the inline ops that store a value known at translation
+ * time: the immediate of QEMU_PLUGIN_INLINE_STORE_U64, which overwrites
+ * @v, or the meminfo of the access for QEMU_PLUGIN_INLINE_STORE_MEMINFO.
+ */
+static void gen_inline_store_cb(uint64_t v)
+{
+    TCGv_ptr ptr = tcg_const_ptr(NULL); /* overwritten later */
+    TCGv_i64 val = tcg_const_i64(v);
+
+    tcg_gen_st_i64(val, ptr, 0);
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+}
+
+static void gen_empty_inline_store_cb(void)
+{
+    gen_inline_store_cb(0xdeadface);
+}
+
+/* Template for QEMU_PLUGIN_INLINE_STORE_VADDR */
+static void gen_empty_inline_vaddr_cb(TCGv addr)
+{
+    TCGv_ptr ptr = tcg_const_ptr(NULL); /* overwritten later */
+    TCGv_i64 val = tcg_temp_new_i64();
+
+    tcg_gen_extu_tl_i64(val, addr);
+    tcg_gen_st_i64(val, ptr, 0);
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+}
+
 static void gen_empty_mem_cb(TCGv addr, uint32_t info)
 {
     do_gen_mem_cb(addr, info);
@@ -196,6 +230,8 @@ static void plugin_gen_empty_callback(enum plugin_gen_from from)
     case PLUGIN_GEN_FROM_TB:
         gen_wrapped(from, PLUGIN_GEN_CB_UDATA, gen_empty_udata_cb);
         gen_wrapped(from, PLUGIN_GEN_CB_INLINE, gen_empty_inline_cb);
+        gen_wrapped(from, PLUGIN_GEN_CB_INLINE_STORE,
+                    gen_empty_inline_store_cb);
         break;
     default:
         g_assert_not_reached();
@@ -231,6 +267,16 @@ void plugin_gen_empty_mem_callback(TCGv addr, uint32_t info)
 
     fn.inline_fn = gen_empty_inline_cb;
     gen_mem_wrapped(PLUGIN_GEN_CB_INLINE, &fn, 0, info, false);
+
+    gen_plugin_cb_start(PLUGIN_GEN_FROM_MEM, PLUGIN_GEN_CB_INLINE_STORE,
+                        !!(info & TRACE_MEM_ST));
+    gen_inline_store_cb(info);
+    tcg_gen_plugin_cb_end();
+
+    gen_plugin_cb_start(PLUGIN_GEN_FROM_MEM, PLUGIN_GEN_CB_INLINE_VADDR,
+                        !!(info & TRACE_MEM_ST));
+    gen_empty_inline_vaddr_cb(addr);
+    tcg_gen_plugin_cb_end();
 }
 
 static TCGOp *find_op(TCGOp *op, TCGOpcode opc)
@@ -318,6 +364,95 @@ static TCGOp *copy_const_ptr(TCGOp **begin_op, TCGOp *op, void *ptr)
     return op;
 }
 
+static TCGOp *insert_op(TCGOp *op, TCGOpcode opc,
+                        TCGArg a0, TCGArg a1, TCGArg a2)
+{
+    op = tcg_op_insert_after(tcg_ctx, op, opc);
+    op->args[0] = a0;
+    op->args[1] = a1;
+    op->args[2] = a2;
+    return op;
+}
+
+/*
+ * Copy the const_ptr of an inline template. For per-vCPU ops the pointer
+ * is computed at run time instead, as
+ * score->data + cpu_index * score->stride + offset.
+ */
+static TCGOp *copy_inline_ptr(TCGOp **begin_op, TCGOp *op,
+                              const struct qemu_plugin_dyn_cb *cb)
+{
+    struct qemu_plugin_scoreboard *score = cb->inline_insn.entry.score;
+    size_t offset = cb->inline_insn.entry.offset;
+    TCGv_i32 cpu_index;
+    TCGv_ptr base, ptr;
+
+    if (!score) {
+        return copy_const_ptr(begin_op, op, cb->userp);
+    }
+
+    cpu_index = tcg_temp_new_i32();
+    base = tcg_temp_new_ptr();
+    ptr = tcg_temp_new_ptr();
+
+    op = insert_op(op, INDEX_op_ld_i32, tcgv_i32_arg(cpu_index),
+                   tcgv_ptr_arg(cpu_env),
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    if (UINTPTR_MAX == UINT32_MAX) {
+        op = insert_op(op, INDEX_op_mul_i32, tcgv_ptr_arg(ptr),
+                       tcgv_i32_arg(cpu_index),
+                       tcgv_i32_arg(tcg_constant_i32(score->stride)));
+        op = insert_op(op, INDEX_op_ld_i32, tcgv_ptr_arg(base),
+                       tcgv_i32_arg(tcg_constant_i32((uintptr_t)&score->data)),
+                       0);
+        op = insert_op(op, INDEX_op_add_i32, tcgv_ptr_arg(ptr),
+                       tcgv_ptr_arg(ptr), tcgv_ptr_arg(base));
+        op = insert_op(op, INDEX_op_add_i32, tcgv_ptr_arg(ptr),
+                       tcgv_ptr_arg(ptr),
+                       tcgv_i32_arg(tcg_constant_i32(offset)));
+        /* mov_i32 */
+        op = copy_op(begin_op, op, INDEX_op_mov_i32);
+    } else {
+        op = insert_op(op, INDEX_op_extu_i32_i64, tcgv_ptr_arg(ptr),
+                       tcgv_i32_arg(cpu_index), 0);
+        op = insert_op(op, INDEX_op_mul_i64, tcgv_ptr_arg(ptr),
+                       tcgv_ptr_arg(ptr),
+                       tcgv_i64_arg(tcg_constant_i64(score->stride)));
+        op = insert_op(op, INDEX_op_ld_i64, tcgv_ptr_arg(base),
+                       tcgv_i64_arg(tcg_constant_i64((uintptr_t)&score->data)),
+                       0);
+        op = insert_op(op, INDEX_op_add_i64, tcgv_ptr_arg(ptr),
+                       tcgv_ptr_arg(ptr), tcgv_ptr_arg(base));
+        op = insert_op(op, INDEX_op_add_i64, tcgv_ptr_arg(ptr),
+                       tcgv_ptr_arg(ptr),
+                       tcgv_i64_arg(tcg_constant_i64(offset)));
+        /* mov_i64 */
+        op = copy_op(begin_op, op, INDEX_op_mov_i64);
+    }
+    op->args[1] = tcgv_ptr_arg(ptr);
+
+    tcg_temp_free_ptr(ptr);
+    tcg_temp_free_ptr(base);
+    tcg_temp_free_i32(cpu_index);
+    return op;
+}
+
+static TCGOp *copy_movi_i64(TCGOp **begin_op, TCGOp *op, uint64_t v)
+{
+    if (TCG_TARGET_REG_BITS == 32) {
+        /* 2x mov_i32 */
+        op = copy_op(begin_op, op, INDEX_op_mov_i32);
+        op->args[1] = tcgv_i32_arg(tcg_constant_i32(v));
+        op = copy_op(begin_op, op, INDEX_op_mov_i32);
+        op->args[1] = tcgv_i32_arg(tcg_constant_i32(v >> 32));
+    } else {
+        /* mov_i64 */
+        op = copy_op(begin_op, op, INDEX_op_mov_i64);
+        op->args[1] = tcgv_i64_arg(tcg_constant_i64(v));
+    }
+    return op;
+}
+
 static TCGOp *copy_extu_tl_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TARGET_LONG_BITS == 32) {
@@ -448,7 +583,7 @@ static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
                                int *unused)
 {
     /* const_ptr */
-    op = copy_const_ptr(&begin_op, op, cb->userp);
+    op = copy_inline_ptr(&begin_op, op, cb);
 
     /* ld_i64 */
     op = copy_ld_i64(&begin_op, op);
@@ -462,6 +597,42 @@ static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
     return op;
 }
 
+static TCGOp *append_inline_store_cb(const struct qemu_plugin_dyn_cb *cb,
+                                     TCGOp *begin_op, TCGOp *op,
+                                     int *unused)
+{
+    /* const_ptr */
+    op = copy_inline_ptr(&begin_op, op, cb);
+
+    if (cb->inline_insn.op == QEMU_PLUGIN_INLINE_STORE_MEMINFO) {
+        /* the template already holds the meminfo of the access */
+        op = copy_mov_i64(&begin_op, op);
+    } else {
+        op = copy_movi_i64(&begin_op, op, cb->inline_insn.imm);
+    }
+
+    /* st_i64 */
+    op = copy_st_i64(&begin_op, op);
+
+    return op;
+}
+
+static TCGOp *append_inline_vaddr_cb(const struct qemu_plugin_dyn_cb *cb,
+                                     TCGOp *begin_op, TCGOp *op,
+                                     int *unused)
+{
+    /* const_ptr */
+    op = copy_inline_ptr(&begin_op, op, cb);
+
+    /* extu_tl_i64 */
+    op = copy_extu_tl_i64(&begin_op, op);
+
+    /* st_i64 */
+    op = copy_st_i64(&begin_op, op);
+
+    return op;
+}
+
 static TCGOp *append_mem_cb(const struct qemu_plugin_dyn_cb *cb,
                             TCGOp *begin_op, TCGOp *op, int *cb_idx)
 {
@@ -512,6 +683,28 @@ static bool op_rw(const TCGOp *op, const struct qemu_plugin_dyn_cb *cb)
     return !!(cb->rw & (w + 1));
 }
 
+/* Each kind of inline op has its own template */
+static bool op_inline(const TCGOp *op, const struct qemu_plugin_dyn_cb *cb)
+{
+    switch (op->args[1]) {
+    case PLUGIN_GEN_CB_INLINE:
+        return cb->inline_insn.op == QEMU_PLUGIN_INLINE_ADD_U64;
+    case PLUGIN_GEN_CB_INLINE_STORE:
+        return cb->inline_insn.op == QEMU_PLUGIN_INLINE_STORE_U64 ||
+               cb->inline_insn.op == QEMU_PLUGIN_INLINE_STORE_MEMINFO;
+    case PLUGIN_GEN_CB_INLINE_VADDR:
+        return cb->inline_insn.op == QEMU_PLUGIN_INLINE_STORE_VADDR;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static bool op_inline_rw(const TCGOp *op,
+                         const struct qemu_plugin_dyn_cb *cb)
+{
+    return op_inline(op, cb) && op_rw(op, cb);
+}
+
 static void inject_cb_type(const GArray *cbs, TCGOp *begin_op,
                            inject_fn inject, op_ok_fn ok)
 {
@@ -550,7 +743,19 @@ inject_udata_cb(const GArray *cbs, TCGOp *begin_op)
 static void
 inject_inline_cb(const GArray *cbs, TCGOp *begin_op, op_ok_fn ok)
 {
-    inject_cb_type(cbs, begin_op, append_inline_cb, ok);
+    switch (begin_op->args[1]) {
+    case PLUGIN_GEN_CB_INLINE:
+        inject_cb_type(cbs, begin_op, append_inline_cb, ok);
+        break;
+    case PLUGIN_GEN_CB_INLINE_STORE:
+        inject_cb_type(cbs, begin_op, append_inline_store_cb, ok);
+        break;
+    case PLUGIN_GEN_CB_INLINE_VADDR:
+        inject_cb_type(cbs, begin_op, append_inline_vaddr_cb, ok);
+        break;
+    default:
+        g_assert_not_reached();
+    }
 }
 
 static void
@@ -657,7 +862,7 @@ static void plugin_gen_tb_udata(const struct qemu_plugin_tb *ptb,
 static void plugin_gen_tb_inline(const struct qemu_plugin_tb *ptb,
                                  TCGOp *begin_op)
 {
-    inject_inline_cb(ptb->cbs[PLUGIN_CB_INLINE], begin_op, op_ok);
+    inject_inline_cb(ptb->cbs[PLUGIN_CB_INLINE], begin_op, op_inline);
 }
 
 static void plugin_gen_insn_udata(const struct qemu_plugin_tb *ptb,
@@ -673,7 +878,7 @@ static void plugin_gen_insn_inline(const struct qemu_plugin_tb *ptb,
 {
     struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
     inject_inline_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_INLINE],
-                     begin_op, op_ok);
+                     begin_op, op_inline);
 }
 
 static void plugin_gen_mem_regular(const struct qemu_plugin_tb *ptb,
@@ -690,7 +895,7 @@ static void plugin_gen_mem_inline(const struct qemu_plugin_tb *ptb,
     struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
 
     cbs = insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE];
-    inject_inline_cb(cbs, begin_op, op_rw);
+    inject_inline_cb(cbs, begin_op, op_inline_rw);
 }
 
 static void plugin_gen_enable_mem_helper(const struct qemu_plugin_tb *ptb,
@@ -720,6 +925,7 @@ static void plugin_inject_cb(const struct qemu_plugin_tb *ptb, TCGOp *begin_op,
             plugin_gen_tb_udata(ptb, begin_op);
             return;
         case PLUGIN_GEN_CB_INLINE:
+        case PLUGIN_GEN_CB_INLINE_STORE:
             plugin_gen_tb_inline(ptb, begin_op);
             return;
         default:
@@ -731,6 +937,7 @@ static void plugin_inject_cb(const struct qemu_plugin_tb *ptb, TCGOp *begin_op,
             plugin_gen_insn_udata(ptb, begin_op, insn_idx);
             return;
         case PLUGIN_GEN_CB_INLINE:
+        case PLUGIN_GEN_CB_INLINE_STORE:
             plugin_gen_insn_inline(ptb, begin_op, insn_idx);
             return;
         case PLUGIN_GEN_ENABLE_MEM_HELPER:
@@ -745,6 +952,8 @@ static void plugin_inject_cb(const struct qemu_plugin_tb *ptb, TCGOp *begin_op,
             plugin_gen_mem_regular(ptb, begin_op, insn_idx);
             return;
         case PLUGIN_GEN_CB_INLINE:
+        case PLUGIN_GEN_CB_INLINE_STORE:
+        case PLUGIN_GEN_CB_INLINE_VADDR:
             plugin_gen_mem_inline(ptb, begin_op, insn_idx);
             return;
         default:
@@ -798,6 +1007,12 @@ static void pr_ops(void)
             case PLUGIN_GEN_CB_INLINE:
                 type = "inline";
                 break;
+            case PLUGIN_GEN_CB_INLINE_STORE:
+                type = "inline store";
+                break;
+            case PLUGIN_GEN_CB_INLINE_VADDR:
+                type = "inline vaddr";
+                break;
             case PLUGIN_GEN_CB_MEM:
                 type = "mem";
                 break;
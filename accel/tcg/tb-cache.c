@@ -0,0 +1,702 @@
+/*
+ * Persistent translation cache for user-mode emulation
+ *
+ * The code generated by a run is written to a file when the program exits,
+ * and the next run of the same binary loads it back instead of translating
+ * the same guest code again.  The TBs of a guest page are only made visible
+ * when the page is first executed, and only if its contents are still the
+ * same as when the cache was written.
+ *
+ * Host code is not relocatable: it refers to QEMU's own functions and data,
+ * to guest_base and to the rest of the code buffer by absolute address.
+ * A cache file is therefore only used if all of these are at the same place
+ * as in the run that wrote it, and if the host CPU has the same features.
+ * TBs that embed other host pointers are never written to the cache.
+ *
+ * The TBs cannot be moved either, so the code of dead TBs leaves holes in
+ * the blob.  Only the live TBs are written to the file, and the cache is
+ * dropped when they are scattered over too much of the code buffer.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cacheflush.h"
+#include "qemu/error-report.h"
+#include "qemu-version.h"
+#include "exec/exec-all.h"
+#include "exec/cpu_ldst.h"
+#include "exec/tb-cache.h"
+#include "tcg/tcg.h"
+#include "internal.h"
+#include "trace.h"
+#ifdef CONFIG_CPUID_H
+#include "qemu/cpuid.h"
+#endif
+
+#define TB_CACHE_MAGIC      "QEMUTBC"
+#define TB_CACHE_VERSION    1
+#define TB_CACHE_HOST_FEATURES 4
+
+/* Constants outside of this range are never taken for host pointers */
+#define TB_CACHE_MIN_HOST_PTR   0x10000
+#define TB_CACHE_HOST_PTR_BITS  MIN(HOST_LONG_BITS, 48)
+
+/*
+ * The header is followed by the address of each guest page, the offset of
+ * each TB from blob_start, the prologue and the contents of each guest page.
+ * The blob, a copy of the code buffer from blob_start to the end of the
+ * last TB, comes last at blob_offset, which is aligned to the host page
+ * size.  Only the bytes of the TBs in the file are written to the blob;
+ * the space left by dead TBs is a hole that reads as zeroes.
+ */
+typedef struct TBCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t target_page_size;
+    uint64_t host_features[TB_CACHE_HOST_FEATURES];
+    uint64_t text_anchor;
+    uint64_t data_anchor;
+    uint64_t guest_base;
+    uint64_t buffer_start;
+    uint64_t buffer_end;
+    uint64_t blob_start;
+    uint64_t blob_size;
+    uint64_t blob_offset;
+    uint32_t prologue_size;
+    uint32_t n_pages;
+    uint32_t n_tbs;
+    uint32_t padding;
+} TBCacheHeader;
+
+typedef struct TBCachePage {
+    uint64_t addr;
+    const uint8_t *data;    /* contents when the cache was written */
+    GPtrArray *tbs;         /* cached TBs that start on this page */
+    bool loaded;            /* TBs were made visible, if the page matched */
+    bool checked;           /* live contents are used by some live TB */
+} TBCachePage;
+
+static struct {
+    bool enabled;
+    bool dirty;             /* TBs were added since the file was loaded */
+    char *path;
+    GMappedFile *file;
+    const TBCacheHeader *hdr;
+    GHashTable *pages;      /* pages of the loaded file, by address */
+    GPtrArray *tbs;         /* live TBs to be written back */
+    const uint8_t *prologue;
+    size_t prologue_size;
+    uintptr_t buffer_end;
+    uintptr_t blob_start;
+} tb_cache;
+
+static void tb_cache_host_features(uint64_t *features)
+{
+    memset(features, 0, TB_CACHE_HOST_FEATURES * sizeof(uint64_t));
+#ifdef AT_HWCAP
+    features[0] = qemu_getauxval(AT_HWCAP);
+#endif
+#ifdef AT_HWCAP2
+    features[1] = qemu_getauxval(AT_HWCAP2);
+#endif
+#ifdef CONFIG_CPUID_H
+    {
+        unsigned a, b, c, d;
+
+        if (__get_cpuid(1, &a, &b, &c, &d)) {
+            features[2] = ((uint64_t)c << 32) | d;
+        }
+        if (__get_cpuid_max(0, NULL) >= 7) {
+            __cpuid_count(7, 0, a, b, c, d);
+            features[3] = ((uint64_t)c << 32) | b;
+        }
+    }
+#endif
+}
+
+static void tb_cache_free_page(gpointer data)
+{
+    TBCachePage *p = data;
+
+    g_ptr_array_free(p->tbs, true);
+    g_free(p);
+}
+
+static void tb_cache_close(void)
+{
+    tb_cache.enabled = false;
+    g_clear_pointer(&tb_cache.pages, g_hash_table_destroy);
+    if (tb_cache.tbs) {
+        g_ptr_array_free(tb_cache.tbs, true);
+        tb_cache.tbs = NULL;
+    }
+    g_clear_pointer(&tb_cache.file, g_mapped_file_unref);
+    tb_cache.hdr = NULL;
+    g_clear_pointer(&tb_cache.path, g_free);
+}
+
+static const uint64_t *tb_cache_page_addrs(void)
+{
+    return (const uint64_t *)(tb_cache.hdr + 1);
+}
+
+static const uint64_t *tb_cache_tb_offsets(void)
+{
+    return tb_cache_page_addrs() + tb_cache.hdr->n_pages;
+}
+
+static const uint8_t *tb_cache_prologue(void)
+{
+    return (const uint8_t *)(tb_cache_tb_offsets() + tb_cache.hdr->n_tbs);
+}
+
+/* Check that the file is consistent; whether it is usable comes later. */
+static bool tb_cache_parse(void)
+{
+    const void *data = g_mapped_file_get_contents(tb_cache.file);
+    const TBCacheHeader *hdr = data;
+    size_t len = g_mapped_file_get_length(tb_cache.file);
+    uint64_t meta;
+
+    if (len < sizeof(*hdr) ||
+        memcmp(hdr->magic, TB_CACHE_MAGIC, sizeof(hdr->magic)) ||
+        hdr->version != TB_CACHE_VERSION ||
+        hdr->target_page_size != TARGET_PAGE_SIZE) {
+        return false;
+    }
+    meta = sizeof(*hdr) + hdr->prologue_size +
+           (uint64_t)hdr->n_pages * (sizeof(uint64_t) + TARGET_PAGE_SIZE) +
+           (uint64_t)hdr->n_tbs * sizeof(uint64_t);
+    if (meta > hdr->blob_offset || hdr->blob_offset > len ||
+        hdr->blob_size > len - hdr->blob_offset) {
+        return false;
+    }
+    tb_cache.hdr = hdr;
+    return true;
+}
+
+void tb_cache_open(const char *dir, const char *exec_path,
+                   const char *cpu_type)
+{
+    g_autoptr(GChecksum) sum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_autoptr(GError) err = NULL;
+    g_autofree char *name = NULL;
+    char *real = realpath(exec_path, NULL);
+    struct stat st;
+    uint64_t id[5];
+
+    if (!real || stat(real, &st) < 0) {
+        warn_report("tb-cache: cannot access %s: %s",
+                    exec_path, strerror(errno));
+        free(real);
+        return;
+    }
+
+    /*
+     * Hashing the whole binary would cost more than the translation that
+     * the cache saves, so identify the file instead.  A stale key is not
+     * a problem: each guest page is compared before its TBs are used.
+     */
+    id[0] = st.st_dev;
+    id[1] = st.st_ino;
+    id[2] = st.st_size;
+    id[3] = st.st_mtime;
+    id[4] = st.st_ctime;
+    g_checksum_update(sum, (const guchar *)TARGET_NAME, sizeof(TARGET_NAME));
+    g_checksum_update(sum, (const guchar *)cpu_type, strlen(cpu_type) + 1);
+    g_checksum_update(sum, (const guchar *)QEMU_FULL_VERSION,
+                      sizeof(QEMU_FULL_VERSION));
+    g_checksum_update(sum, (const guchar *)real, strlen(real) + 1);
+    g_checksum_update(sum, (const guchar *)id, sizeof(id));
+    free(real);
+
+    name = g_strdup_printf("%s.tbc", g_checksum_get_string(sum));
+    tb_cache.path = g_build_filename(dir, name, NULL);
+    tb_cache.file = g_mapped_file_new(tb_cache.path, false, &err);
+    if (!tb_cache.file) {
+        if (!g_error_matches(err, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            warn_report("tb-cache: %s", err->message);
+        }
+    } else if (!tb_cache_parse()) {
+        warn_report("tb-cache: ignoring invalid file %s", tb_cache.path);
+        g_clear_pointer(&tb_cache.file, g_mapped_file_unref);
+    } else {
+        tcg_region_set_buffer_hint((void *)(uintptr_t)
+                                   tb_cache.hdr->buffer_start);
+    }
+    trace_tb_cache_open(tb_cache.path, tb_cache.file != NULL);
+}
+
+/* Check that the code in the file can run in this process. */
+static const char *tb_cache_mismatch(void)
+{
+    const TBCacheHeader *hdr = tb_cache.hdr;
+    TCGContext *s = tcg_ctx;
+    uint64_t features[TB_CACHE_HOST_FEATURES];
+
+    tb_cache_host_features(features);
+    if (memcmp(hdr->host_features, features, sizeof(features))) {
+        return "host CPU";
+    }
+    if (hdr->text_anchor != (uintptr_t)tb_cache_lookup ||
+        hdr->data_anchor != (uintptr_t)&tb_cache) {
+        return "QEMU load address";
+    }
+    if (hdr->guest_base != guest_base) {
+        return "guest_base";
+    }
+    if (hdr->buffer_start != (uintptr_t)tb_cache.prologue ||
+        hdr->buffer_end != tb_cache.buffer_end ||
+        hdr->blob_start != tb_cache.blob_start ||
+        hdr->blob_size > (uintptr_t)s->code_gen_highwater -
+                         tb_cache.blob_start) {
+        return "code buffer";
+    }
+    if (hdr->prologue_size != tb_cache.prologue_size ||
+        memcmp(tb_cache_prologue(), tb_cache.prologue, hdr->prologue_size)) {
+        return "prologue";
+    }
+    return NULL;
+}
+
+static bool tb_cache_load(void)
+{
+    const TBCacheHeader *hdr = tb_cache.hdr;
+    const char *data = g_mapped_file_get_contents(tb_cache.file);
+    const uint64_t *page_addrs = tb_cache_page_addrs();
+    const uint64_t *tb_offsets = tb_cache_tb_offsets();
+    const uint8_t *page_data = tb_cache_prologue() + hdr->prologue_size;
+    const char *why = tb_cache_mismatch();
+    uint32_t i;
+
+    if (why) {
+        trace_tb_cache_reject(tb_cache.path, why);
+        return false;
+    }
+
+    memcpy((void *)tb_cache.blob_start, data + hdr->blob_offset,
+           hdr->blob_size);
+    flush_idcache_range(tb_cache.blob_start, tb_cache.blob_start,
+                        hdr->blob_size);
+
+    tb_cache.pages = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                           NULL, tb_cache_free_page);
+    for (i = 0; i < hdr->n_pages; i++) {
+        TBCachePage *p = g_new0(TBCachePage, 1);
+
+        p->addr = page_addrs[i];
+        p->data = page_data + (size_t)i * TARGET_PAGE_SIZE;
+        p->tbs = g_ptr_array_new();
+        g_hash_table_insert(tb_cache.pages, &p->addr, p);
+    }
+
+    for (i = 0; i < hdr->n_tbs; i++) {
+        TranslationBlock *tb;
+        TBCachePage *p;
+        uint64_t addr;
+
+        if (tb_offsets[i] >= hdr->blob_size ||
+            hdr->blob_size - tb_offsets[i] < sizeof(*tb) ||
+            !QEMU_IS_ALIGNED(tb_offsets[i], sizeof(uintptr_t))) {
+            continue;
+        }
+        tb = (TranslationBlock *)(tb_cache.blob_start + tb_offsets[i]);
+        if ((uintptr_t)tb->tc.ptr - tb_cache.blob_start >= hdr->blob_size ||
+            (tb->cflags & CF_INVALID)) {
+            continue;
+        }
+        addr = tb->page_addr[0];
+        p = g_hash_table_lookup(tb_cache.pages, &addr);
+        if (p) {
+            g_ptr_array_add(p->tbs, tb);
+        }
+    }
+
+    tcg_ctx->code_gen_ptr = (void *)(tb_cache.blob_start + hdr->blob_size);
+    trace_tb_cache_load(hdr->n_pages, hdr->n_tbs, hdr->blob_size);
+    return true;
+}
+
+void tb_cache_start(void)
+{
+    TCGContext *s = tcg_ctx;
+
+    if (!tb_cache.path) {
+        return;
+    }
+#ifdef CONFIG_TCG_INTERPRETER
+    warn_report("tb-cache: not supported by the TCG interpreter");
+    tb_cache_close();
+#else
+    if (tcg_splitwx_diff || tcg_region_evict_enabled()) {
+        warn_report("tb-cache: not supported with split-wx or tb-evict");
+        tb_cache_close();
+        return;
+    }
+
+    /* The blob starts on a page of its own after the prologue. */
+    tb_cache.prologue = (const uint8_t *)tcg_qemu_tb_exec;
+    tb_cache.prologue_size = (const uint8_t *)s->code_gen_buffer -
+                             tb_cache.prologue;
+    tb_cache.buffer_end = (uintptr_t)s->code_gen_buffer +
+                          s->code_gen_buffer_size;
+    tb_cache.blob_start = ROUND_UP((uintptr_t)s->code_gen_ptr,
+                                   qemu_real_host_page_size);
+    if (tb_cache.blob_start >= (uintptr_t)s->code_gen_highwater) {
+        tb_cache_close();
+        return;
+    }
+
+    if (tb_cache.file && !tb_cache_load()) {
+        g_clear_pointer(&tb_cache.file, g_mapped_file_unref);
+        tb_cache.hdr = NULL;
+    }
+    if (!tb_cache.file) {
+        s->code_gen_ptr = (void *)tb_cache.blob_start;
+    }
+    tb_cache.tbs = g_ptr_array_new();
+    tb_cache.enabled = true;
+#endif
+}
+
+static TBCachePage *tb_cache_page(tb_page_addr_t addr)
+{
+    uint64_t key = addr;
+
+    if (addr == -1 || !tb_cache.pages) {
+        return NULL;
+    }
+    return g_hash_table_lookup(tb_cache.pages, &key);
+}
+
+/*
+ * Compare a guest page with its copy in the file.  From now on the live
+ * contents of the page are what counts when writing the cache back.
+ */
+static bool tb_cache_page_matches(TBCachePage *p)
+{
+    p->checked = true;
+    return guest_addr_valid_untagged(p->addr) &&
+           (page_get_flags(p->addr) & (PAGE_READ | PAGE_EXEC)) ==
+           (PAGE_READ | PAGE_EXEC) &&
+           !memcmp(g2h_untagged(p->addr), p->data, TARGET_PAGE_SIZE);
+}
+
+TranslationBlock *tb_cache_lookup(CPUState *cpu, target_ulong pc,
+                                  target_ulong cs_base, uint32_t flags,
+                                  uint32_t cflags)
+{
+    TBCachePage *p = tb_cache_page(pc & TARGET_PAGE_MASK);
+    TBCachePage *last_p2 = NULL;
+    bool last_p2_ok = false;
+    unsigned n = 0;
+    guint i;
+
+    if (!tb_cache.enabled || !p || p->loaded) {
+        return NULL;
+    }
+    p->loaded = true;
+    if (!tb_cache_page_matches(p)) {
+        trace_tb_cache_page(p->addr, false, 0);
+        return NULL;
+    }
+
+    for (i = 0; i < p->tbs->len; i++) {
+        TranslationBlock *tb = g_ptr_array_index(p->tbs, i);
+
+        if (tb->page_addr[1] != -1) {
+            TBCachePage *p2 = tb_cache_page(tb->page_addr[1]);
+
+            /*
+             * The second page is not write protected until a TB that
+             * covers it is linked, so do not trust an earlier check.
+             */
+            if (p2 != last_p2) {
+                last_p2 = p2;
+                last_p2_ok = p2 && tb_cache_page_matches(p2);
+            }
+            if (!last_p2_ok) {
+                continue;
+            }
+        }
+        if (tb_link_restored(tb)) {
+            g_ptr_array_add(tb_cache.tbs, tb);
+            n++;
+        }
+    }
+    trace_tb_cache_page(p->addr, true, n);
+
+    return tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
+}
+
+/* Is @addr, as a guest address, part of a mapped guest page? */
+static bool tb_cache_guest_page(uint64_t addr)
+{
+    return addr <= GUEST_ADDR_MAX &&
+           !(addr >> TARGET_VIRT_ADDR_SPACE_BITS) &&
+           page_get_flags(addr) != 0;
+}
+
+/*
+ * tcg_const_ptr() marks the TB, but a host pointer can also reach the
+ * generated code through tcg_const_i64() or any other constant.  Treat
+ * every constant that could be a host address as one, unless it falls
+ * within a guest page, either as a guest address or as a host address
+ * that g2h() would return: both stay valid as long as guest_base does.
+ * This is conservative, a guest immediate may also look like a pointer.
+ */
+static bool tb_cache_maybe_host_ptr(uint64_t val)
+{
+    if (val < TB_CACHE_MIN_HOST_PTR || val >> TB_CACHE_HOST_PTR_BITS) {
+        return false;
+    }
+    if (tb_cache_guest_page(val)) {
+        return false;
+    }
+    return !(val >= guest_base && tb_cache_guest_page(val - guest_base));
+}
+
+static bool tb_cache_has_host_ptr(TCGContext *s)
+{
+    int i;
+
+    if (s->tb_has_host_ptr) {
+        return true;
+    }
+    for (i = s->nb_globals; i < s->nb_temps; i++) {
+        TCGTemp *ts = &s->temps[i];
+
+        if (ts->kind == TEMP_CONST && tb_cache_maybe_host_ptr(ts->val)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void tb_cache_record(TranslationBlock *tb)
+{
+    TBCachePage *p;
+
+    if (!tb_cache.enabled || tb_cache_has_host_ptr(tcg_ctx)) {
+        return;
+    }
+    p = tb_cache_page(tb->page_addr[0]);
+    if (p) {
+        p->checked = true;
+    }
+    p = tb_cache_page(tb->page_addr[1]);
+    if (p) {
+        p->checked = true;
+    }
+    g_ptr_array_add(tb_cache.tbs, tb);
+    tb_cache.dirty = true;
+}
+
+void tb_cache_flush(void)
+{
+    if (tb_cache.enabled) {
+        trace_tb_cache_flush();
+        tb_cache_close();
+    }
+}
+
+typedef struct TBCacheWriter {
+    GHashTable *seen;       /* page addresses already in @addrs */
+    GArray *addrs;          /* uint64_t */
+    GPtrArray *data;        /* contents of each page of @addrs */
+    GArray *offsets;        /* uint64_t */
+    uint64_t blob_size;     /* up to the end of the last TB */
+    uint64_t live_size;     /* bytes used by the TBs */
+} TBCacheWriter;
+
+static void tb_cache_add_page(TBCacheWriter *w, uint64_t addr,
+                              const void *data)
+{
+    if (!g_hash_table_contains(w->seen, &addr)) {
+        g_array_append_val(w->addrs, addr);
+        g_ptr_array_add(w->data, (void *)data);
+        g_hash_table_add(w->seen, g_memdup(&addr, sizeof(addr)));
+    }
+}
+
+static uint64_t tb_cache_tb_end(TranslationBlock *tb)
+{
+    return (uintptr_t)tb_code_end(tb) - tb_cache.blob_start;
+}
+
+static void tb_cache_add_tb(TBCacheWriter *w, TranslationBlock *tb)
+{
+    uint64_t offset = (uintptr_t)tb - tb_cache.blob_start;
+    uint64_t end = tb_cache_tb_end(tb);
+
+    g_array_append_val(w->offsets, offset);
+    w->blob_size = MAX(w->blob_size, end);
+    w->live_size += end - offset;
+}
+
+static bool tb_cache_live_page(tb_page_addr_t addr)
+{
+    return addr == -1 ||
+           (page_get_flags(addr) & (PAGE_READ | PAGE_EXEC)) ==
+           (PAGE_READ | PAGE_EXEC);
+}
+
+/* Collect the live TBs, and the cached ones whose pages never ran. */
+static void tb_cache_collect(TBCacheWriter *w)
+{
+    GHashTableIter iter;
+    TBCachePage *p;
+    guint i, j;
+
+    for (i = 0; i < tb_cache.tbs->len; i++) {
+        TranslationBlock *tb = g_ptr_array_index(tb_cache.tbs, i);
+
+        if ((qatomic_read(&tb->cflags) & CF_INVALID) ||
+            !tb_cache_live_page(tb->page_addr[0]) ||
+            !tb_cache_live_page(tb->page_addr[1])) {
+            continue;
+        }
+        for (j = 0; j < 2 && tb->page_addr[j] != -1; j++) {
+            tb_cache_add_page(w, tb->page_addr[j],
+                              g2h_untagged(tb->page_addr[j]));
+        }
+        tb_cache_add_tb(w, tb);
+    }
+
+    if (!tb_cache.pages) {
+        return;
+    }
+    g_hash_table_iter_init(&iter, tb_cache.pages);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&p)) {
+        if (p->checked) {
+            continue;
+        }
+        for (i = 0; i < p->tbs->len; i++) {
+            TranslationBlock *tb = g_ptr_array_index(p->tbs, i);
+            TBCachePage *p2 = tb_cache_page(tb->page_addr[1]);
+
+            if (tb->page_addr[1] != -1) {
+                if (!p2 || p2->checked) {
+                    continue;
+                }
+                tb_cache_add_page(w, p2->addr, p2->data);
+            }
+            tb_cache_add_page(w, p->addr, p->data);
+            tb_cache_add_tb(w, tb);
+        }
+    }
+}
+
+static bool tb_cache_write(FILE *f, TBCacheWriter *w)
+{
+    TBCacheHeader hdr = {
+        .magic = TB_CACHE_MAGIC,
+        .version = TB_CACHE_VERSION,
+        .target_page_size = TARGET_PAGE_SIZE,
+        .text_anchor = (uintptr_t)tb_cache_lookup,
+        .data_anchor = (uintptr_t)&tb_cache,
+        .guest_base = guest_base,
+        .buffer_start = (uintptr_t)tb_cache.prologue,
+        .buffer_end = tb_cache.buffer_end,
+        .blob_start = tb_cache.blob_start,
+        .blob_size = w->blob_size,
+        .prologue_size = tb_cache.prologue_size,
+        .n_pages = w->addrs->len,
+        .n_tbs = w->offsets->len,
+    };
+    guint i;
+
+    tb_cache_host_features(hdr.host_features);
+    hdr.blob_offset = ROUND_UP(sizeof(hdr) + hdr.prologue_size +
+                               hdr.n_pages * (sizeof(uint64_t) +
+                                              TARGET_PAGE_SIZE) +
+                               hdr.n_tbs * sizeof(uint64_t),
+                               qemu_real_host_page_size);
+
+    fwrite(&hdr, sizeof(hdr), 1, f);
+    fwrite(w->addrs->data, sizeof(uint64_t), w->addrs->len, f);
+    fwrite(w->offsets->data, sizeof(uint64_t), w->offsets->len, f);
+    fwrite(tb_cache.prologue, 1, tb_cache.prologue_size, f);
+    for (i = 0; i < w->data->len; i++) {
+        fwrite(g_ptr_array_index(w->data, i), TARGET_PAGE_SIZE, 1, f);
+    }
+    for (i = 0; i < w->offsets->len; i++) {
+        uint64_t offset = g_array_index(w->offsets, uint64_t, i);
+        TranslationBlock *tb = (void *)(tb_cache.blob_start + offset);
+
+        if (fseek(f, hdr.blob_offset + offset, SEEK_SET) < 0) {
+            return false;
+        }
+        fwrite(tb, 1, tb_cache_tb_end(tb) - offset, f);
+    }
+    /* Pad to a whole page, so that the blob can be mapped. */
+    if (fflush(f) != 0 || ferror(f) ||
+        ftruncate(fileno(f), ROUND_UP(hdr.blob_offset + hdr.blob_size,
+                                      qemu_real_host_page_size)) < 0) {
+        return false;
+    }
+
+    trace_tb_cache_save(tb_cache.path, hdr.n_pages, hdr.n_tbs, hdr.blob_size);
+    return true;
+}
+
+void tb_cache_save(void)
+{
+    g_autofree char *tmp = NULL;
+    TBCacheWriter w;
+    FILE *f;
+    bool ok;
+    int fd;
+
+    if (!tb_cache.enabled || !tb_cache.dirty) {
+        return;
+    }
+
+    mmap_lock();
+    w.seen = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+    w.addrs = g_array_new(false, false, sizeof(uint64_t));
+    w.data = g_ptr_array_new();
+    w.offsets = g_array_new(false, false, sizeof(uint64_t));
+    w.blob_size = w.live_size = 0;
+    tb_cache_collect(&w);
+
+    /*
+     * The next run translates after the end of the blob.  If the live TBs
+     * take up little of it and it fills half the buffer, start over.
+     */
+    if (w.blob_size > (tb_cache.buffer_end - tb_cache.blob_start) / 2 &&
+        w.live_size < w.blob_size / 2) {
+        trace_tb_cache_drop(tb_cache.path, w.live_size, w.blob_size);
+        unlink(tb_cache.path);
+        goto out;
+    }
+
+    /* Write to a temporary file so that concurrent runs see a whole cache */
+    tmp = g_strdup_printf("%s.XXXXXX", tb_cache.path);
+    fd = g_mkstemp(tmp);
+    f = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (!f) {
+        warn_report("tb-cache: cannot create %s: %s", tmp, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+    } else {
+        ok = tb_cache_write(f, &w);
+        ok &= fclose(f) == 0;
+        if (!ok || rename(tmp, tb_cache.path) < 0) {
+            warn_report("tb-cache: cannot write %s: %s",
+                        tb_cache.path, strerror(errno));
+            unlink(tmp);
+        }
+    }
+
+out:
+    g_hash_table_destroy(w.seen);
+    g_array_free(w.addrs, true);
+    g_ptr_array_free(w.data, true);
+    g_array_free(w.offsets, true);
+    tb_cache.dirty = false;
+    mmap_unlock();
+}
@@ -34,6 +34,9 @@ struct TBContext {
 
     /* statistics */
     unsigned tb_flush_count;
+    unsigned tb_evict_count;
+    unsigned tb_trace_count;
+    unsigned tb_bg_count;
 };
 
 extern TBContext tb_ctx;
@@ -30,6 +30,8 @@
 #include "qemu/main-loop.h"
 #include "qemu/guest-random.h"
 #include "exec/exec-all.h"
+#include "sysemu/cpus.h"
+#include "sysemu/cpu-timers.h"
 
 #include "tcg-accel-ops.h"
 #include "tcg-accel-ops-icount.h"
@@ -67,6 +69,16 @@ static int64_t icount_get_limit(void)
     }
 }
 
+/*
+ * With parallel icount, a vCPU may not run past the end of the current
+ * quantum: its budget is further limited by what it has already run in
+ * the quantum.
+ */
+static int64_t icount_get_parallel_limit(CPUState *cpu)
+{
+    return MIN(icount_get_limit(), icount_quantum() - cpu->icount_local);
+}
+
 static void icount_notify_aio_contexts(void)
 {
     /* Wake up other AioContexts.  */
@@ -103,7 +115,11 @@ void icount_prepare_for_run(CPUState *cpu)
     g_assert(cpu_neg(cpu)->icount_decr.u16.low == 0);
     g_assert(cpu->icount_extra == 0);
 
-    cpu->icount_budget = icount_get_limit();
+    if (icount_parallel_enabled()) {
+        cpu->icount_budget = icount_get_parallel_limit(cpu);
+    } else {
+        cpu->icount_budget = icount_get_limit();
+    }
     insns_left = MIN(0xffff, cpu->icount_budget);
     cpu_neg(cpu)->icount_decr.u16.low = insns_left;
     cpu->icount_extra = cpu->icount_budget - insns_left;
@@ -130,6 +146,84 @@ void icount_process_data(CPUState *cpu)
     replay_mutex_unlock();
 }
 
+/*
+ * Number of vCPUs waiting in icount_quantum_sync() for the current
+ * quantum to end, and a counter of quanta.  Protected by the BQL.
+ */
+static int icount_quantum_waiters;
+static unsigned icount_quantum_gen;
+
+/* The quantum is over once every vCPU that is not idle waits for it. */
+static bool icount_quantum_done(void)
+{
+    CPUState *cpu;
+    int busy = 0;
+
+    CPU_FOREACH(cpu) {
+        if (!cpu_thread_is_idle(cpu)) {
+            busy++;
+        }
+    }
+    return busy <= icount_quantum_waiters;
+}
+
+/*
+ * Move QEMU_CLOCK_VIRTUAL to the end of the quantum, which is as far as
+ * the vCPU that ran the most instructions got, and start the next one.
+ */
+static void icount_quantum_next(void)
+{
+    CPUState *cpu;
+    int64_t insns = 0;
+
+    CPU_FOREACH(cpu) {
+        insns = MAX(insns, cpu->icount_local);
+    }
+    icount_account_quantum(insns);
+    CPU_FOREACH(cpu) {
+        cpu->icount_local = 0;
+        qemu_cond_broadcast(cpu->halt_cond);
+    }
+    icount_quantum_gen++;
+
+    icount_handle_deadline();
+}
+
+void icount_quantum_sync(CPUState *cpu)
+{
+    unsigned gen = icount_quantum_gen;
+
+    assert(qemu_mutex_iothread_locked());
+
+    if (cpu_thread_is_idle(cpu)) {
+        /* Do not hold back the others while sleeping */
+        if (icount_quantum_done()) {
+            icount_quantum_next();
+        }
+        if (all_cpu_threads_idle()) {
+            /* Wake up the main loop in order to start the warp timer */
+            qemu_notify_event();
+        }
+        return;
+    }
+    if (icount_get_parallel_limit(cpu) > 0) {
+        return;
+    }
+
+    icount_quantum_waiters++;
+    while (gen == icount_quantum_gen) {
+        if (icount_quantum_done()) {
+            icount_quantum_next();
+            break;
+        }
+        if (cpu->stop || cpu->exit_request || !cpu_work_list_empty(cpu)) {
+            break;
+        }
+        qemu_cond_wait_iothread(cpu->halt_cond);
+    }
+    icount_quantum_waiters--;
+}
+
 void icount_handle_interrupt(CPUState *cpu, int mask)
 {
     int old_mask = cpu->interrupt_request;
@@ -13,6 +13,11 @@
 void icount_handle_deadline(void);
 void icount_prepare_for_run(CPUState *cpu);
 void icount_process_data(CPUState *cpu);
+/*
+ * With parallel icount, wait until all vCPUs are done with the current
+ * quantum if @cpu is.  Called with the BQL held.
+ */
+void icount_quantum_sync(CPUState *cpu);
 
 void icount_handle_interrupt(CPUState *cpu, int mask);
 
@@ -34,6 +34,7 @@
 
 #include "tcg-accel-ops.h"
 #include "tcg-accel-ops-mttcg.h"
+#include "tcg-accel-ops-icount.h"
 
 /*
  * In the multi-threaded case each vCPU has its own thread. The TLS
@@ -46,7 +47,7 @@ static void *mttcg_cpu_thread_fn(void *arg)
     CPUState *cpu = arg;
 
     assert(tcg_enabled());
-    g_assert(!icount_enabled());
+    g_assert(!icount_enabled() || icount_parallel_enabled());
 
     rcu_register_thread();
     tcg_register_thread();
@@ -64,10 +65,21 @@ static void *mttcg_cpu_thread_fn(void *arg)
     cpu->exit_request = 1;
 
     do {
+        if (icount_enabled()) {
+            /* Account partial waits to QEMU_CLOCK_VIRTUAL.  */
+            icount_account_warp_timer();
+        }
+
         if (cpu_can_run(cpu)) {
             int r;
             qemu_mutex_unlock_iothread();
+            if (icount_enabled()) {
+                icount_prepare_for_run(cpu);
+            }
             r = tcg_cpus_exec(cpu);
+            if (icount_enabled()) {
+                icount_process_data(cpu);
+            }
             qemu_mutex_lock_iothread();
             switch (r) {
             case EXCP_DEBUG:
@@ -94,6 +106,10 @@ static void *mttcg_cpu_thread_fn(void *arg)
             }
         }
 
+        if (icount_enabled()) {
+            icount_quantum_sync(cpu);
+        }
+
         qatomic_mb_set(&cpu->exit_request, 0);
         qemu_wait_io_event(cpu);
     } while (!cpu->unplug || cpu_can_run(cpu));
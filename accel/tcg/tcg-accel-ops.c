@@ -37,6 +37,7 @@
 #include "tcg-accel-ops-mttcg.h"
 #include "tcg-accel-ops-rr.h"
 #include "tcg-accel-ops-icount.h"
+#include "internal.h"
 
 /* common functionality among all TCG variants */
 
@@ -50,6 +51,7 @@ void tcg_cpu_init_cflags(CPUState *cpu, bool parallel)
 
 void tcg_cpus_destroy(CPUState *cpu)
 {
+    tb_bg_cancel(cpu);
     cpu_thread_signal_destroyed(cpu);
 }
 
@@ -96,7 +98,13 @@ static void tcg_accel_ops_init(AccelOpsClass *ops)
     if (qemu_tcg_mttcg_enabled()) {
         ops->create_vcpu_thread = mttcg_start_vcpu_thread;
         ops->kick_vcpu_thread = mttcg_kick_vcpu_thread;
-        ops->handle_interrupt = tcg_handle_interrupt;
+        if (icount_enabled()) {
+            ops->handle_interrupt = icount_handle_interrupt;
+            ops->get_virtual_clock = icount_get;
+            ops->get_elapsed_ticks = icount_get;
+        } else {
+            ops->handle_interrupt = tcg_handle_interrupt;
+        }
     } else if (icount_enabled()) {
         ops->create_vcpu_thread = rr_start_vcpu_thread;
         ops->kick_vcpu_thread = rr_kick_vcpu_thread;
@@ -27,7 +27,9 @@
 #include "qemu-common.h"
 #include "sysemu/tcg.h"
 #include "sysemu/cpu-timers.h"
+#include "sysemu/replay.h"
 #include "tcg/tcg.h"
+#include "tcg/perf.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
 #include "qemu/accel.h"
@@ -43,7 +45,12 @@ struct TCGState {
 
     bool mttcg_enabled;
     int splitwx_enabled;
+    bool tb_evict_enabled;
+    bool perfmap_enabled;
+    bool jitdump_enabled;
     unsigned long tb_size;
+    uint32_t tb_trace;
+    uint32_t tb_bg_threads;
 };
 typedef struct TCGState TCGState;
 
@@ -118,13 +125,44 @@ static int tcg_init_machine(MachineState *ms)
 #else
     unsigned max_cpus = ms->smp.max_cpus;
 #endif
+    unsigned bg_threads = 0;
 
     tcg_allowed = true;
     mttcg_enabled = s->mttcg_enabled;
+#ifndef CONFIG_USER_ONLY
+    if (mttcg_enabled && icount_enabled()) {
+        icount_enable_parallel();
+    }
+    if (s->tb_bg_threads) {
+#ifdef TCG_TB_BG_SUPPORTED
+        if (mttcg_enabled) {
+            bg_threads = s->tb_bg_threads;
+        } else {
+            warn_report("tb-bg-threads requires thread=multi, ignoring");
+        }
+#else
+        warn_report("tb-bg-threads is not supported for this target, "
+                    "ignoring");
+#endif
+    }
+#endif
+
+#ifdef CONFIG_LINUX
+    if (s->perfmap_enabled) {
+        perf_enable_perfmap();
+    }
+    if (s->jitdump_enabled) {
+        perf_enable_jitdump();
+    }
+#endif
+
+    tb_trace_threshold = s->tb_trace;
 
     page_init();
     tb_htable_init();
-    tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_cpus);
+    /* background translation threads each need a TCG context */
+    tcg_init(s->tb_size * MiB, s->splitwx_enabled, s->tb_evict_enabled,
+             max_cpus + bg_threads);
 
 #if defined(CONFIG_SOFTMMU)
     /*
@@ -132,6 +170,7 @@ static int tcg_init_machine(MachineState *ms)
      * initialize the prologue now.
      */
     tcg_prologue_init(tcg_ctx);
+    tb_bg_init(bg_threads);
 #endif
 
     return 0;
@@ -151,8 +190,8 @@ static void tcg_set_thread(Object *obj, const char *value, Error **errp)
     if (strcmp(value, "multi") == 0) {
         if (TCG_OVERSIZED_GUEST) {
             error_setg(errp, "No MTTCG when guest word size > hosts");
-        } else if (icount_enabled()) {
-            error_setg(errp, "No MTTCG when icount is enabled");
+        } else if (replay_mode != REPLAY_MODE_NONE) {
+            error_setg(errp, "No MTTCG when record/replay is enabled");
         } else {
 #ifndef TARGET_SUPPORTS_MTTCG
             warn_report("Guest not yet converted to MTTCG - "
@@ -196,6 +235,69 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_tb_trace(Object *obj, Visitor *v,
+                             const char *name, void *opaque,
+                             Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->tb_trace;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_tb_trace(Object *obj, Visitor *v,
+                             const char *name, void *opaque,
+                             Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    /* The execution counters saturate at twice the threshold */
+    if (value > UINT32_MAX / 2) {
+        error_setg(errp, "tb-trace must be at most %u", UINT32_MAX / 2);
+        return;
+    }
+
+    s->tb_trace = value;
+}
+
+static void tcg_get_tb_bg_threads(Object *obj, Visitor *v,
+                                  const char *name, void *opaque,
+                                  Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->tb_bg_threads;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_tb_bg_threads(Object *obj, Visitor *v,
+                                  const char *name, void *opaque,
+                                  Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+#ifdef CONFIG_USER_ONLY
+    if (value) {
+        error_setg(errp, "tb-bg-threads is not supported in user mode");
+        return;
+    }
+#endif
+    if (value > 64) {
+        error_setg(errp, "tb-bg-threads must be at most 64");
+        return;
+    }
+
+    s->tb_bg_threads = value;
+}
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -208,6 +310,56 @@ static void tcg_set_splitwx(Object *obj, bool value, Error **errp)
     s->splitwx_enabled = value;
 }
 
+static bool tcg_get_tb_evict(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->tb_evict_enabled;
+}
+
+static void tcg_set_tb_evict(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->tb_evict_enabled = value;
+}
+
+static bool tcg_get_perfmap(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->perfmap_enabled;
+}
+
+static void tcg_set_perfmap(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+#ifndef CONFIG_LINUX
+    if (value) {
+        error_setg(errp, "perfmap is only supported on Linux hosts");
+        return;
+    }
+#endif
+    s->perfmap_enabled = value;
+}
+
+static bool tcg_get_jitdump(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->jitdump_enabled;
+}
+
+static void tcg_set_jitdump(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+#ifndef CONFIG_LINUX
+    if (value) {
+        error_setg(errp, "jitdump is only supported on Linux hosts");
+        return;
+    }
+#endif
+    s->jitdump_enabled = value;
+}
+
 static void tcg_accel_class_init(ObjectClass *oc, void *data)
 {
     AccelClass *ac = ACCEL_CLASS(oc);
@@ -225,10 +377,39 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add(oc, "tb-trace", "int",
+        tcg_get_tb_trace, tcg_set_tb_trace,
+        NULL, NULL);
+    object_class_property_set_description(oc, "tb-trace",
+        "Executions after which a translation block is retranslated "
+        "as a trace (0 to disable)");
+
+    object_class_property_add(oc, "tb-bg-threads", "int",
+        tcg_get_tb_bg_threads, tcg_set_tb_bg_threads,
+        NULL, NULL);
+    object_class_property_set_description(oc, "tb-bg-threads",
+        "Threads that translate code ahead of the vCPUs (0 to disable)");
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
         "Map jit pages into separate RW and RX regions");
+
+    object_class_property_add_bool(oc, "tb-evict",
+        tcg_get_tb_evict, tcg_set_tb_evict);
+    object_class_property_set_description(oc, "tb-evict",
+        "Evict the oldest translations instead of flushing the TB cache "
+        "when it is full");
+
+    object_class_property_add_bool(oc, "perfmap",
+        tcg_get_perfmap, tcg_set_perfmap);
+    object_class_property_set_description(oc, "perfmap",
+        "Write /tmp/perf-<pid>.map for perf to symbolize translated code");
+
+    object_class_property_add_bool(oc, "jitdump",
+        tcg_get_jitdump, tcg_set_jitdump);
+    object_class_property_set_description(oc, "jitdump",
+        "Write jit-<pid>.dump with the translated code for perf inject");
 }
 
 static const TypeInfo tcg_accel_type = {
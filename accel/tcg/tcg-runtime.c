@@ -166,6 +166,17 @@ const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
     return tb->tc.ptr;
 }
 
+void HELPER(tb_hot)(CPUArchState *env, void *ptr)
+{
+    TranslationBlock *tb = ptr;
+
+    /* Leave the TB before it runs, so that tb_find() can build the trace */
+    if (qatomic_cmpxchg(&tb->trace_state, TB_TRACE_NONE, TB_TRACE_HOT) ==
+        TB_TRACE_NONE) {
+        qatomic_set(&cpu_neg(env_cpu(env))->icount_decr.u16.high, -1);
+    }
+}
+
 void HELPER(exit_atomic)(CPUArchState *env)
 {
     cpu_loop_exit_atomic(env_cpu(env), GETPC());
@@ -25,8 +25,10 @@
 #include "disas/disas.h"
 #include "exec/exec-all.h"
 #include "tcg/tcg.h"
+#include "tcg/perf.h"
 #if defined(CONFIG_USER_ONLY)
 #include "qemu.h"
+#include "exec/tb-cache.h"
 #if defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
 #include <sys/param.h>
 #if __FreeBSD_version >= 700104
@@ -47,6 +49,7 @@
 
 #include "exec/cputlb.h"
 #include "exec/translate-all.h"
+#include "exec/translator.h"
 #include "qemu/bitmap.h"
 #include "qemu/qemu-print.h"
 #include "qemu/timer.h"
@@ -111,6 +114,8 @@ typedef struct PageDesc {
        of lookups we do to a given page to use a bitmap */
     unsigned long *code_bitmap;
     unsigned int code_write_count;
+    /* incremented under @lock whenever a write to the page is trapped */
+    unsigned int write_gen;
 #else
     unsigned long flags;
     void *target_data;
@@ -220,6 +225,70 @@ static void *l1_map[V_L1_MAX_SIZE];
 
 TBContext tb_ctx;
 
+uint32_t tb_trace_threshold;
+
+/*
+ * Execution counters for tiered translation.  They are not kept in the
+ * TranslationBlock, which sits right before its host code: stores that
+ * close to code being executed are expensive on some hosts.  Counters of
+ * evicted TBs are reused, all of them are released on flush.
+ */
+#define TB_EXEC_COUNT_CHUNK 1024
+
+static struct {
+    QemuMutex lock;
+    GPtrArray *chunks;
+    GPtrArray *free;
+    size_t next;
+} tb_exec_counts;
+
+static uint32_t *tb_exec_count_alloc(void)
+{
+    uint32_t *count;
+
+    qemu_mutex_lock(&tb_exec_counts.lock);
+    if (tb_exec_counts.free->len) {
+        count = g_ptr_array_remove_index_fast(tb_exec_counts.free,
+                                              tb_exec_counts.free->len - 1);
+    } else {
+        if (!tb_exec_counts.chunks->len ||
+            tb_exec_counts.next == TB_EXEC_COUNT_CHUNK) {
+            g_ptr_array_add(tb_exec_counts.chunks,
+                            g_new(uint32_t, TB_EXEC_COUNT_CHUNK));
+            tb_exec_counts.next = 0;
+        }
+        count = g_ptr_array_index(tb_exec_counts.chunks,
+                                  tb_exec_counts.chunks->len - 1);
+        count += tb_exec_counts.next++;
+    }
+    qemu_mutex_unlock(&tb_exec_counts.lock);
+    *count = 0;
+    return count;
+}
+
+static void tb_exec_count_free(uint32_t *count)
+{
+    if (count) {
+        qemu_mutex_lock(&tb_exec_counts.lock);
+        g_ptr_array_add(tb_exec_counts.free, count);
+        qemu_mutex_unlock(&tb_exec_counts.lock);
+    }
+}
+
+/* Called with all vCPUs and background translation stopped */
+static void tb_exec_count_flush(void)
+{
+    qemu_mutex_lock(&tb_exec_counts.lock);
+    g_ptr_array_set_size(tb_exec_counts.free, 0);
+    g_ptr_array_set_size(tb_exec_counts.chunks, 0);
+    qemu_mutex_unlock(&tb_exec_counts.lock);
+}
+
+static uint32_t tb_exec_count_read(TranslationBlock *tb)
+{
+    return tb->exec_count ? qatomic_read(tb->exec_count) : 0;
+}
+
 static void page_table_config_init(void)
 {
     uint32_t v_l1_bits;
@@ -909,6 +978,10 @@ void tb_htable_init(void)
     unsigned int mode = QHT_MODE_AUTO_RESIZE;
 
     qht_init(&tb_ctx.htable, tb_cmp, CODE_GEN_HTABLE_SIZE, mode);
+
+    qemu_mutex_init(&tb_exec_counts.lock);
+    tb_exec_counts.chunks = g_ptr_array_new_with_free_func(g_free);
+    tb_exec_counts.free = g_ptr_array_new();
 }
 
 /* call with @p->lock held */
@@ -966,12 +1039,174 @@ static gboolean tb_host_size_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
+#ifdef CONFIG_SOFTMMU
+/*
+ * Background translation.
+ *
+ * After a vCPU translates a block, helper threads translate the blocks
+ * that follow it in the same guest page, so that the vCPU finds them
+ * in tb_ctx.htable when it falls through to them.  The helpers must not
+ * touch the state of the vCPU, which keeps running, so the vCPU hands
+ * them a snapshot of itself and a copy of the page: translators read
+ * their CPU state from the snapshot, code loads are redirected to the
+ * copy by cpu_ld*_code(), and a block that does not fit in it is
+ * abandoned.  The page already holds code and is thus write-protected,
+ * so a write after the copy is trapped and bumps PageDesc.write_gen;
+ * tb_link_page() then refuses the blocks translated from the stale copy.
+ *
+ * Both are shared by the requests of a vCPU for as long as they are
+ * valid, so that most requests copy neither.  A translation may only
+ * depend on the CPU state that tb_ctx.htable looks TBs up with, so a
+ * snapshot serves any block with the same cs_base and flags; a page copy
+ * serves until the page is written.
+ */
+typedef struct TBBgSnapshot {
+    unsigned int refcount;
+    unsigned int flush_count;
+    target_ulong cs_base;
+    uint32_t flags;
+    ArchCPU cpu;                /* what the translator sees as the vCPU */
+} TBBgSnapshot;
+
+typedef struct TBBgPage {
+    unsigned int refcount;
+    unsigned int write_gen;
+    target_ulong addr;
+    tb_page_addr_t phys_addr;
+    const void *host;
+    MemoryRegion *mr;           /* keeps @host mapped */
+    uint8_t code[];
+} TBBgPage;
+
+typedef struct TBBgRequest {
+    CPUState *cpu;              /* owner, only used to cancel requests */
+    TBBgSnapshot *snapshot;
+    TBBgPage *page;
+    target_ulong pc;
+    uint32_t cflags;
+    unsigned int flush_count;
+    QSIMPLEQ_ENTRY(TBBgRequest) entry;
+} TBBgRequest;
+
+/* Pending requests; more are dropped rather than slowing down vCPUs */
+#define TB_BG_QUEUE_MAX   64
+/* Pending requests of one vCPU, so that a busy one does not starve others */
+#define TB_BG_QUEUE_CPU_MAX 8
+/* Blocks translated in a row from one request */
+#define TB_BG_MAX_BLOCKS  8
+
+static struct {
+    QemuMutex lock;
+    /* signalled when a request is queued or the helpers are resumed */
+    QemuCond cond;
+    /* signalled when @active drops to zero */
+    QemuCond idle_cond;
+    QSIMPLEQ_HEAD(, TBBgRequest) queue;
+    unsigned int queued;
+    unsigned int active;
+    unsigned int paused;
+    unsigned int nr_threads;
+} tb_bg;
+
+/* The snapshot and page copy last used by the vCPU of this thread */
+static __thread struct {
+    CPUState *cpu;
+    TBBgSnapshot *snapshot;
+    TBBgPage *page;
+} tb_bg_last;
+
+__thread const TBBgRequest *tb_bg_code;
+
+const void *tb_bg_code_ptr(target_ulong addr, int size)
+{
+    target_ulong offset = addr - tb_bg_code->page->addr;
+
+    if (offset > TARGET_PAGE_SIZE - size) {
+        siglongjmp(tcg_ctx->jmp_trans, -3);
+    }
+    return tb_bg_code->page->code + offset;
+}
+
+/*
+ * Whether the page of @tb, locked as @p, was written since it was
+ * copied for background translation.  The comparison also catches a
+ * store that was already past the write trap when the copy was taken.
+ */
+static bool tb_bg_page_changed(PageDesc *p, TranslationBlock *tb)
+{
+    const TBBgPage *page = tb_bg_code->page;
+    target_ulong offset = tb->pc - page->addr;
+
+    return p->write_gen != page->write_gen ||
+           memcmp(page->code + offset, page->host + offset, tb->size);
+}
+
+/* Wait for the helpers to be idle, and keep them so until resumed */
+static void tb_bg_pause(void)
+{
+    if (!tb_bg.nr_threads) {
+        return;
+    }
+    qemu_mutex_lock(&tb_bg.lock);
+    tb_bg.paused++;
+    while (tb_bg.active) {
+        qemu_cond_wait(&tb_bg.idle_cond, &tb_bg.lock);
+    }
+    qemu_mutex_unlock(&tb_bg.lock);
+}
+
+static void tb_bg_resume(void)
+{
+    if (!tb_bg.nr_threads) {
+        return;
+    }
+    qemu_mutex_lock(&tb_bg.lock);
+    if (--tb_bg.paused == 0) {
+        qemu_cond_broadcast(&tb_bg.cond);
+    }
+    qemu_mutex_unlock(&tb_bg.lock);
+}
+
+static void tb_bg_snapshot_unref(TBBgSnapshot *snap)
+{
+    if (snap && qatomic_fetch_dec(&snap->refcount) == 1) {
+        qemu_vfree(snap);
+    }
+}
+
+static void tb_bg_page_unref(TBBgPage *page)
+{
+    if (page && qatomic_fetch_dec(&page->refcount) == 1) {
+        memory_region_unref(page->mr);
+        g_free(page);
+    }
+}
+
+static void tb_bg_free(TBBgRequest *req)
+{
+    if (req) {
+        tb_bg_snapshot_unref(req->snapshot);
+        tb_bg_page_unref(req->page);
+        g_free(req);
+    }
+}
+#else
+static inline void tb_bg_pause(void)
+{
+}
+
+static inline void tb_bg_resume(void)
+{
+}
+#endif
+
 /* flush all the translation blocks */
 static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
 {
     bool did_flush = false;
 
     mmap_lock();
+    tb_bg_pause();
     /* If it is already been done on request of another CPU,
      * just retry.
      */
@@ -997,11 +1232,16 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     page_flush_tb();
 
     tcg_region_reset_all();
+    tb_exec_count_flush();
+#ifdef CONFIG_USER_ONLY
+    tb_cache_flush();
+#endif
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
     qatomic_mb_set(&tb_ctx.tb_flush_count, tb_ctx.tb_flush_count + 1);
 
 done:
+    tb_bg_resume();
     mmap_unlock();
     if (did_flush) {
         qemu_plugin_flush_cb();
@@ -1022,6 +1262,77 @@ void tb_flush(CPUState *cpu)
     }
 }
 
+static gboolean tb_evict_iter(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+
+    tb_phys_invalidate(tb, -1);
+    tb_exec_count_free(tb->exec_count);
+    return false;
+}
+
+/* evict the oldest translation blocks, or flush them all */
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data tb_flush_count)
+{
+    size_t evicted = 0;
+
+    mmap_lock();
+    tb_bg_pause();
+    /*
+     * If a flush or another eviction has already made room,
+     * just retry.
+     */
+    if (tb_ctx.tb_flush_count != tb_flush_count.host_int ||
+        tcg_region_has_free()) {
+        tb_bg_resume();
+        mmap_unlock();
+        return;
+    }
+
+    /*
+     * Plugins keep data for each translated instruction that is only
+     * released by a full flush.
+     */
+    if (!test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask)) {
+        qemu_thread_jit_write();
+        evicted = tcg_region_evict(tb_evict_iter);
+        qemu_thread_jit_execute();
+    }
+    if (evicted) {
+        qatomic_set(&tb_ctx.tb_evict_count, tb_ctx.tb_evict_count + 1);
+    }
+    tb_bg_resume();
+    mmap_unlock();
+
+    /* Nothing to reclaim while all regions are in use */
+    if (!evicted) {
+        do_tb_flush(cpu, tb_flush_count);
+    }
+}
+
+/*
+ * Make room in the code buffer once it is full: with partial eviction,
+ * only the regions holding the oldest translation blocks are reclaimed,
+ * otherwise everything is flushed.
+ */
+static void tb_reclaim(CPUState *cpu)
+{
+    unsigned tb_flush_count;
+
+    if (!tcg_region_evict_enabled()) {
+        tb_flush(cpu);
+        return;
+    }
+
+    tb_flush_count = qatomic_mb_read(&tb_ctx.tb_flush_count);
+    if (cpu_in_exclusive_context(cpu)) {
+        do_tb_evict(cpu, RUN_ON_CPU_HOST_INT(tb_flush_count));
+    } else {
+        async_safe_run_on_cpu(cpu, do_tb_evict,
+                              RUN_ON_CPU_HOST_INT(tb_flush_count));
+    }
+}
+
 /*
  * Formerly ifdef DEBUG_TB_CHECK. These debug functions are user-mode-only,
  * so in order to prevent bit rot we compile them unconditionally in user-mode,
@@ -1347,6 +1658,8 @@ static inline void tb_page_add(PageDesc *p, TranslationBlock *tb,
  * Note that in !user-mode, another thread might have already added a TB
  * for the same block of guest code that @tb corresponds to. In that case,
  * the caller should discard the original @tb, and use instead the returned TB.
+ * Returns NULL if @tb was translated in the background from a copy of its
+ * page that is now stale.
  */
 static TranslationBlock *
 tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
@@ -1369,6 +1682,12 @@ tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
      * we can only insert TBs that are fully initialized.
      */
     page_lock_pair(&p, phys_pc, &p2, phys_page2, 1);
+#ifdef CONFIG_SOFTMMU
+    if (unlikely(tb_bg_code) && tb_bg_page_changed(p, tb)) {
+        page_unlock(p);
+        return NULL;
+    }
+#endif
     tb_page_add(p, tb, 0, phys_pc & TARGET_PAGE_MASK);
     if (p2) {
         tb_page_add(p2, tb, 1, phys_page2);
@@ -1405,13 +1724,76 @@ tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
     return tb;
 }
 
+static void tb_init_jumps(TranslationBlock *tb)
+{
+    /* init jump list */
+    qemu_spin_init(&tb->jmp_lock);
+    tb->jmp_list_head = (uintptr_t)NULL;
+    tb->jmp_list_next[0] = (uintptr_t)NULL;
+    tb->jmp_list_next[1] = (uintptr_t)NULL;
+    tb->jmp_dest[0] = (uintptr_t)NULL;
+    tb->jmp_dest[1] = (uintptr_t)NULL;
+
+    /* init original jump addresses which have been set during tcg_gen_code() */
+    if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 0);
+    }
+    if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 1);
+    }
+}
+
+#ifdef CONFIG_USER_ONLY
+/*
+ * Make visible a TB whose code was loaded from the persistent TB cache,
+ * as tb_gen_code() would have done after translating it.  The TB and its
+ * code must already be in place in the code buffer.
+ *
+ * Called with mmap_lock held.  Returns false if an equivalent TB was
+ * already present, in which case @tb is left unused.
+ */
+bool tb_link_restored(TranslationBlock *tb)
+{
+    tb_page_addr_t phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
+
+    assert_memory_lock();
+    tb_init_jumps(tb);
+    /* Its execution counter, if any, belonged to the process that saved it */
+    tb->exec_count = NULL;
+    tb->trace_state = TB_TRACE_DONE;
+    if (tb_link_page(tb, phys_pc, tb->page_addr[1]) != tb) {
+        return false;
+    }
+    tcg_tb_insert(tb);
+    /* tcg_ctx describes some other translation, if any */
+    perf_report_code(tb, false);
+    return true;
+}
+
+const void *tb_code_end(const TranslationBlock *tb)
+{
+    const uint8_t *p = tb->tc.ptr + tb->tc.size;
+    int i, j;
+
+    /* Skip the search data, see encode_search() */
+    for (i = 0; i < tb->icount; ++i) {
+        for (j = 0; j <= TARGET_INSN_START_WORDS; ++j) {
+            decode_sleb128(&p);
+        }
+    }
+    return p;
+}
+#endif
+
 /* Called with mmap_lock held for user mode emulation.  */
-TranslationBlock *tb_gen_code(CPUState *cpu,
-                              target_ulong pc, target_ulong cs_base,
-                              uint32_t flags, int cflags)
+static TranslationBlock *do_tb_gen_code(CPUState *cpu,
+                                        target_ulong pc, target_ulong cs_base,
+                                        uint32_t flags, int cflags,
+                                        const TranslatorTrace *trace)
 {
     CPUArchState *env = cpu->env_ptr;
     TranslationBlock *tb, *existing_tb;
+    uint32_t *exec_count = NULL;
     tb_page_addr_t phys_pc, phys_page2;
     target_ulong virt_page2;
     tcg_insn_unit *gen_code_buf;
@@ -1424,13 +1806,29 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     assert_memory_lock();
     qemu_thread_jit_write();
 
-    phys_pc = get_page_addr_code(env, pc);
+#ifdef CONFIG_SOFTMMU
+    if (tb_bg_code) {
+        phys_pc = tb_bg_code->page->phys_addr | (pc & ~TARGET_PAGE_MASK);
+    } else
+#endif
+    {
+        phys_pc = get_page_addr_code(env, pc);
+    }
 
     if (phys_pc == -1) {
         /* Generate a one-shot TB with 1 insn in it */
         cflags = (cflags & ~CF_COUNT_MASK) | CF_LAST_IO | 1;
     }
 
+#ifdef CONFIG_USER_ONLY
+    if (phys_pc != -1) {
+        tb = tb_cache_lookup(cpu, pc, cs_base, flags, cflags);
+        if (tb) {
+            return tb;
+        }
+    }
+#endif
+
     max_insns = cflags & CF_COUNT_MASK;
     if (max_insns == 0) {
         max_insns = CF_COUNT_MASK;
@@ -1445,8 +1843,14 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
  buffer_overflow:
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
+#ifdef CONFIG_SOFTMMU
+        /* leave it to the vCPUs to make room */
+        if (tb_bg_code) {
+            return NULL;
+        }
+#endif
+        /* eviction or flush must be done */
+        tb_reclaim(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -1460,6 +1864,11 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->flags = flags;
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    if (!exec_count && !trace && tb_trace_threshold) {
+        exec_count = tb_exec_count_alloc();
+    }
+    tb->exec_count = exec_count;
+    tb->trace_state = trace ? TB_TRACE_DONE : TB_TRACE_NONE;
     tcg_ctx->tb_cflags = cflags;
  tb_overflow:
 
@@ -1477,6 +1886,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tcg_func_start(tcg_ctx);
 
     tcg_ctx->cpu = env_cpu(env);
+    tcg_ctx->trace = trace;
     gen_intermediate_code(cpu, tb, max_insns);
     assert(tb->size != 0);
     tcg_ctx->cpu = NULL;
@@ -1540,6 +1950,15 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
                           max_insns);
             goto tb_overflow;
 
+        case -3:
+            /* A background translation needed code outside of its page. */
+            tcg_ctx->cpu = NULL;
+            qatomic_set(&tcg_ctx->code_gen_ptr, (void *)
+                ((uintptr_t)gen_code_buf -
+                 ROUND_UP(sizeof(*tb), qemu_icache_linesize)));
+            tb_exec_count_free(exec_count);
+            return NULL;
+
         default:
             g_assert_not_reached();
         }
@@ -1630,21 +2049,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
                  CODE_GEN_ALIGN));
 
-    /* init jump list */
-    qemu_spin_init(&tb->jmp_lock);
-    tb->jmp_list_head = (uintptr_t)NULL;
-    tb->jmp_list_next[0] = (uintptr_t)NULL;
-    tb->jmp_list_next[1] = (uintptr_t)NULL;
-    tb->jmp_dest[0] = (uintptr_t)NULL;
-    tb->jmp_dest[1] = (uintptr_t)NULL;
-
-    /* init original jump addresses which have been set during tcg_gen_code() */
-    if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
-        tb_reset_jump(tb, 0);
-    }
-    if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
-        tb_reset_jump(tb, 1);
-    }
+    tb_init_jumps(tb);
 
     /*
      * If the TB is not associated with a physical RAM page then
@@ -1654,6 +2059,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
      */
     if (phys_pc == -1) {
         tb->page_addr[0] = tb->page_addr[1] = -1;
+        perf_report_code(tb, true);
         return tb;
     }
 
@@ -1661,6 +2067,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     virt_page2 = (pc + tb->size - 1) & TARGET_PAGE_MASK;
     phys_page2 = -1;
     if ((pc & TARGET_PAGE_MASK) != virt_page2) {
+#ifdef CONFIG_SOFTMMU
+        tcg_debug_assert(!tb_bg_code);
+#endif
         phys_page2 = get_page_addr_code(env, virt_page2);
     }
     /*
@@ -1674,13 +2083,437 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 
         orig_aligned -= ROUND_UP(sizeof(*tb), qemu_icache_linesize);
         qatomic_set(&tcg_ctx->code_gen_ptr, (void *)orig_aligned);
+        tb_exec_count_free(exec_count);
         tb_destroy(tb);
+#ifdef CONFIG_SOFTMMU
+        /* the background thread only cares about new blocks */
+        if (tb_bg_code) {
+            return NULL;
+        }
+#endif
         return existing_tb;
     }
     tcg_tb_insert(tb);
+    perf_report_code(tb, true);
+#ifdef CONFIG_USER_ONLY
+    tb_cache_record(tb);
+#endif
+    return tb;
+}
+
+#ifdef CONFIG_SOFTMMU
+/* Translate the blocks that follow the one requested, see TBBgRequest */
+static void tb_bg_gen(TBBgRequest *req)
+{
+    CPUState *cpu = env_cpu(&req->snapshot->cpu.env);
+    target_ulong pc = req->pc;
+    int i;
+
+    if (qatomic_read(&tb_ctx.tb_flush_count) != req->flush_count) {
+        return;
+    }
+
+    tb_bg_code = req;
+    rcu_read_lock();
+    for (i = 0; i < TB_BG_MAX_BLOCKS; i++) {
+        TranslationBlock *tb;
+
+        if ((pc & TARGET_PAGE_MASK) != req->page->addr) {
+            break;
+        }
+        tb = do_tb_gen_code(cpu, pc, req->snapshot->cs_base,
+                            req->snapshot->flags, req->cflags, NULL);
+        if (!tb) {
+            break;
+        }
+        trace_tb_bg_gen(tb, tb->pc, tb->size);
+        qatomic_inc(&tb_ctx.tb_bg_count);
+        pc = tb->pc + tb->size;
+    }
+    rcu_read_unlock();
+    tb_bg_code = NULL;
+}
+
+static void *tb_bg_thread(void *opaque)
+{
+    rcu_register_thread();
+    tcg_register_thread();
+
+    qemu_mutex_lock(&tb_bg.lock);
+    while (true) {
+        TBBgRequest *req;
+
+        while (tb_bg.paused || QSIMPLEQ_EMPTY(&tb_bg.queue)) {
+            qemu_cond_wait(&tb_bg.cond, &tb_bg.lock);
+        }
+        req = QSIMPLEQ_FIRST(&tb_bg.queue);
+        QSIMPLEQ_REMOVE_HEAD(&tb_bg.queue, entry);
+        tb_bg.queued--;
+        tb_bg.active++;
+        qemu_mutex_unlock(&tb_bg.lock);
+
+        tb_bg_gen(req);
+        tb_bg_free(req);
+
+        qemu_mutex_lock(&tb_bg.lock);
+        if (--tb_bg.active == 0) {
+            qemu_cond_broadcast(&tb_bg.idle_cond);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Whether a request for @pc can be queued: it is not already pending,
+ * and neither the queue nor the share of @cpu in it is full.
+ */
+static bool tb_bg_can_queue(CPUState *cpu, target_ulong pc)
+{
+    TBBgRequest *req;
+    unsigned int n = 0;
+    bool ok = true;
+
+    if (qatomic_read(&tb_bg.queued) >= TB_BG_QUEUE_MAX) {
+        return false;
+    }
+    qemu_mutex_lock(&tb_bg.lock);
+    QSIMPLEQ_FOREACH(req, &tb_bg.queue, entry) {
+        if (req->cpu == cpu &&
+            (req->pc == pc || ++n == TB_BG_QUEUE_CPU_MAX)) {
+            ok = false;
+            break;
+        }
+    }
+    qemu_mutex_unlock(&tb_bg.lock);
+    return ok;
+}
+
+/*
+ * The snapshot of @cpu for translating with @cs_base and @flags, which
+ * match the state of the vCPU right now.  Make the snapshot self-contained
+ * where the translator could otherwise follow it back into live state;
+ * the breakpoint list is known to be empty.  Translators only reach the
+ * snapshot through its env and CPU casts, so QOM must not see it either.
+ */
+static TBBgSnapshot *tb_bg_snapshot(CPUState *cpu, target_ulong cs_base,
+                                    uint32_t flags)
+{
+    TBBgSnapshot *snap = tb_bg_last.snapshot;
+    unsigned int flush_count = qatomic_read(&tb_ctx.tb_flush_count);
+    CPUState *snap_cpu;
+
+    if (!snap || snap->cs_base != cs_base || snap->flags != flags ||
+        snap->flush_count != flush_count) {
+        tb_bg_snapshot_unref(snap);
+        snap = qemu_memalign(__alignof__(TBBgSnapshot), sizeof(*snap));
+        snap->refcount = 1;
+        snap->flush_count = flush_count;
+        snap->cs_base = cs_base;
+        snap->flags = flags;
+        memcpy(&snap->cpu, env_archcpu(cpu->env_ptr), sizeof(snap->cpu));
+        snap_cpu = env_cpu(&snap->cpu.env);
+        snap_cpu->env_ptr = &snap->cpu.env;
+        QTAILQ_INIT(&snap_cpu->breakpoints);
+        QTAILQ_INIT(&snap_cpu->watchpoints);
+        OBJECT(snap_cpu)->parent = NULL;
+        OBJECT(snap_cpu)->properties = NULL;
+        tb_bg_last.snapshot = snap;
+    }
+    qatomic_inc(&snap->refcount);
+    return snap;
+}
+
+/*
+ * The copy of the code page @addr, mapped at @host, that
+ * starts at @phys_addr; NULL if writes to it would go unnoticed.
+ */
+static TBBgPage *tb_bg_page(target_ulong addr, tb_page_addr_t phys_addr,
+                            void *host)
+{
+    TBBgPage *page = tb_bg_last.page;
+    PageDesc *p = page_find(phys_addr >> TARGET_PAGE_BITS);
+    unsigned int write_gen = qatomic_read(&p->write_gen);
+    MemoryRegion *mr;
+    ram_addr_t offset;
+
+    smp_rmb();
+    if (cpu_physical_memory_get_dirty_flag(phys_addr, DIRTY_MEMORY_CODE)) {
+        return NULL;
+    }
+    if (!page || page->addr != addr || page->phys_addr != phys_addr ||
+        page->host != host || page->write_gen != write_gen) {
+        /*
+         * @host is only valid within the RCU critical section of the vCPU;
+         * the helper compares against it later, so keep the RAM alive.
+         */
+        mr = memory_region_from_host(host, &offset);
+        if (!mr) {
+            return NULL;
+        }
+        memory_region_ref(mr);
+        tb_bg_page_unref(page);
+        page = g_malloc(sizeof(*page) + TARGET_PAGE_SIZE);
+        page->refcount = 1;
+        page->write_gen = write_gen;
+        page->addr = addr;
+        page->phys_addr = phys_addr;
+        page->host = host;
+        page->mr = mr;
+        memcpy(page->code, host, TARGET_PAGE_SIZE);
+        tb_bg_last.page = page;
+    }
+    qatomic_inc(&page->refcount);
+    return page;
+}
+
+/* Drop what tb_bg_last holds for @cpu, or for any vCPU if NULL */
+static void tb_bg_forget(CPUState *cpu)
+{
+    if (!cpu || tb_bg_last.cpu == cpu) {
+        tb_bg_snapshot_unref(tb_bg_last.snapshot);
+        tb_bg_page_unref(tb_bg_last.page);
+        tb_bg_last.snapshot = NULL;
+        tb_bg_last.page = NULL;
+        tb_bg_last.cpu = NULL;
+    }
+}
+
+/*
+ * Ask the helpers to translate the code that follows @tb, which @cpu
+ * just translated, unless it is already there or already asked for.
+ */
+static void tb_bg_queue(CPUState *cpu, TranslationBlock *tb)
+{
+    CPUArchState *env = cpu->env_ptr;
+    target_ulong page = tb->pc & TARGET_PAGE_MASK;
+    target_ulong pc = tb->pc + tb->size;
+    uint32_t cflags = tb_cflags(tb);
+    TBBgRequest *req;
+    TBBgPage *copy;
+    void *host;
+
+    if ((pc & TARGET_PAGE_MASK) != page ||
+        tb->page_addr[0] == -1 || tb->page_addr[1] != -1 ||
+        (cflags & (CF_COUNT_MASK | CF_LAST_IO | CF_INVALID)) ||
+        cpu->singlestep_enabled || singlestep ||
+        !QTAILQ_EMPTY(&cpu->breakpoints) ||
+        test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask) ||
+        !tb_bg_can_queue(cpu, pc)) {
+        return;
+    }
+
+    /* Does not fault, unlike the lookup below if the page were gone */
+    host = tlb_vaddr_to_host(env, page, MMU_INST_FETCH,
+                             cpu_mmu_index(env, true));
+    if (!host ||
+        tb_htable_lookup(cpu, pc, tb->cs_base, tb->flags, cflags)) {
+        return;
+    }
+
+    if (tb_bg_last.cpu != cpu) {
+        tb_bg_forget(NULL);
+        tb_bg_last.cpu = cpu;
+    }
+    copy = tb_bg_page(page, tb->page_addr[0], host);
+    if (!copy) {
+        return;
+    }
+
+    req = g_new(TBBgRequest, 1);
+    req->cpu = cpu;
+    req->snapshot = tb_bg_snapshot(cpu, tb->cs_base, tb->flags);
+    req->page = copy;
+    req->pc = pc;
+    req->cflags = cflags;
+    req->flush_count = req->snapshot->flush_count;
+
+    qemu_mutex_lock(&tb_bg.lock);
+    if (tb_bg.queued < TB_BG_QUEUE_MAX) {
+        QSIMPLEQ_INSERT_TAIL(&tb_bg.queue, req, entry);
+        tb_bg.queued++;
+        qemu_cond_signal(&tb_bg.cond);
+        req = NULL;
+    }
+    qemu_mutex_unlock(&tb_bg.lock);
+    tb_bg_free(req);
+}
+
+void tb_bg_init(unsigned int nr_threads)
+{
+    unsigned int i;
+
+    qemu_mutex_init(&tb_bg.lock);
+    qemu_cond_init(&tb_bg.cond);
+    qemu_cond_init(&tb_bg.idle_cond);
+    QSIMPLEQ_INIT(&tb_bg.queue);
+    tb_bg.nr_threads = nr_threads;
+
+    for (i = 0; i < nr_threads; i++) {
+        QemuThread thread;
+        char name[16];
+
+        snprintf(name, sizeof(name), "TCG bg %u", i);
+        qemu_thread_create(&thread, name, tb_bg_thread, NULL,
+                           QEMU_THREAD_DETACHED);
+    }
+}
+
+/* Drop the requests of @cpu, which is going away */
+void tb_bg_cancel(CPUState *cpu)
+{
+    TBBgRequest *req, *next;
+
+    if (!tb_bg.nr_threads) {
+        return;
+    }
+    tb_bg_forget(cpu);
+    tb_bg_pause();
+    qemu_mutex_lock(&tb_bg.lock);
+    QSIMPLEQ_FOREACH_SAFE(req, &tb_bg.queue, entry, next) {
+        if (req->cpu == cpu) {
+            QSIMPLEQ_REMOVE(&tb_bg.queue, req, TBBgRequest, entry);
+            tb_bg.queued--;
+            tb_bg_free(req);
+        }
+    }
+    qemu_mutex_unlock(&tb_bg.lock);
+    tb_bg_resume();
+}
+#endif
+
+/* Called with mmap_lock held for user mode emulation.  */
+TranslationBlock *tb_gen_code(CPUState *cpu,
+                              target_ulong pc, target_ulong cs_base,
+                              uint32_t flags, int cflags)
+{
+    TranslationBlock *tb;
+
+    tb = do_tb_gen_code(cpu, pc, cs_base, flags, cflags, NULL);
+#ifdef CONFIG_SOFTMMU
+    if (tb_bg.nr_threads) {
+        tb_bg_queue(cpu, tb);
+    }
+#endif
     return tb;
 }
 
+/*
+ * Whether @next can follow the blocks already in @trace.  Blocks must be
+ * translated in the same context as the first one, and stay after it in
+ * its page so that the trace TB is tracked like any other TB whose code
+ * covers [pc, pc + size).
+ */
+static bool tb_trace_can_follow(TranslationBlock *head, TranslationBlock *next,
+                                const TranslatorTrace *trace)
+{
+    target_ulong page = head->pc & TARGET_PAGE_MASK;
+    int i;
+
+    if ((tb_cflags(next) & CF_INVALID) ||
+        next->page_addr[1] != -1 ||
+        next->pc <= head->pc ||
+        next->pc + next->size > page + TARGET_PAGE_SIZE ||
+        next->pc + next->size - head->pc > UINT16_MAX ||
+        next->cs_base != head->cs_base ||
+        next->flags != head->flags ||
+        tb_cflags(next) != tb_cflags(head) ||
+        next->trace_vcpu_dstate != head->trace_vcpu_dstate) {
+        return false;
+    }
+    for (i = 0; i < trace->nb_blocks; i++) {
+        if (trace->block[i].pc == next->pc) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Follow the jumps that the execution of @head chained, always taking
+ * the hotter of the two successors, to pick the blocks of its trace.
+ */
+static bool tb_trace_plan(CPUState *cpu, TranslationBlock *head,
+                          TranslatorTrace *trace)
+{
+    TranslationBlock *tb = head;
+
+    if (cpu->singlestep_enabled || singlestep ||
+        !QTAILQ_EMPTY(&cpu->breakpoints) ||
+        (tb_cflags(head) & (CF_COUNT_MASK | CF_LAST_IO | CF_USE_ICOUNT |
+                             CF_INVALID)) ||
+        head->page_addr[1] != -1) {
+        return false;
+    }
+    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask)) {
+        return false;
+    }
+
+    trace->nb_blocks = 0;
+    while (true) {
+        TranslatorTraceBlock *b = &trace->block[trace->nb_blocks++];
+        TranslationBlock *next = NULL;
+        uint32_t best = 0;
+        int i;
+
+        b->pc = tb->pc;
+        b->size = tb->size;
+        b->icount = tb->icount;
+        b->slot = -1;
+        if (trace->nb_blocks == TB_TRACE_MAX_BLOCKS) {
+            break;
+        }
+        for (i = 0; i < 2; i++) {
+            uintptr_t dest = qatomic_read(&tb->jmp_dest[i]);
+            TranslationBlock *t = (TranslationBlock *)dest;
+
+            /* The LSB is set while the TB is being invalidated */
+            if (dest && !(dest & 1) && tb_exec_count_read(t) > best) {
+                best = tb_exec_count_read(t);
+                next = t;
+                b->slot = i;
+            }
+        }
+        if (!next || !tb_trace_can_follow(head, next, trace)) {
+            break;
+        }
+        tb = next;
+    }
+    return trace->nb_blocks > 1;
+}
+
+/*
+ * Replace @tb, which just got hot, with a trace that continues into the
+ * blocks it most often jumps to.  Keeping them in a single TB avoids the
+ * goto_tb between them; where a block falls through into the next one,
+ * the optimizer and the register allocator also work across both, see
+ * translator_trace_link().  The trace is invalidated like any other TB when
+ * the guest code it covers changes.
+ */
+TranslationBlock *tb_gen_trace(CPUState *cpu, TranslationBlock *tb)
+{
+    TranslatorTrace trace;
+    TranslationBlock *trace_tb;
+
+    if (qatomic_cmpxchg(&tb->trace_state, TB_TRACE_HOT, TB_TRACE_DONE) !=
+        TB_TRACE_HOT) {
+        return tb;
+    }
+    /* Saturate the counter, so that the code of @tb stops updating it */
+    qatomic_set(tb->exec_count, 2 * tb_trace_threshold);
+    if (!tb_trace_plan(cpu, tb, &trace)) {
+        return tb;
+    }
+
+    mmap_lock();
+    tb_phys_invalidate(tb, -1);
+    trace_tb = do_tb_gen_code(cpu, tb->pc, tb->cs_base, tb->flags,
+                              tb_cflags(tb) & ~CF_INVALID, &trace);
+    mmap_unlock();
+    qatomic_inc(&tb_ctx.tb_trace_count);
+    trace_tb_gen_trace(tb, trace_tb, trace.nb_blocks, trace_tb->icount);
+    return trace_tb;
+}
+
 /*
  * @p must be non-NULL.
  * user-mode: call with mmap_lock held.
@@ -1707,6 +2540,9 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
 #endif /* TARGET_HAS_PRECISE_SMC */
 
     assert_page_locked(p);
+#ifdef CONFIG_SOFTMMU
+    qatomic_set(&p->write_gen, p->write_gen + 1);
+#endif
 
 #if defined(TARGET_HAS_PRECISE_SMC)
     if (cpu != NULL) {
@@ -1853,6 +2689,7 @@ void tb_invalidate_phys_page_fast(struct page_collection *pages,
     }
 
     assert_page_locked(p);
+    qatomic_set(&p->write_gen, p->write_gen + 1);
     if (!p->code_bitmap &&
         ++p->code_write_count >= SMC_BITMAP_USE_THRESHOLD) {
         build_page_bitmap(p);
@@ -2093,6 +2930,7 @@ void dump_exec_info(void)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t flush_large, flush_large_full;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2127,6 +2965,12 @@ void dump_exec_info(void)
     qemu_printf("\nStatistics:\n");
     qemu_printf("TB flush count      %u\n",
                 qatomic_read(&tb_ctx.tb_flush_count));
+    qemu_printf("TB evict count      %u\n",
+                qatomic_read(&tb_ctx.tb_evict_count));
+    qemu_printf("TB trace count      %u\n",
+                qatomic_read(&tb_ctx.tb_trace_count));
+    qemu_printf("TB background count %u\n",
+                qatomic_read(&tb_ctx.tb_bg_count));
     qemu_printf("TB invalidate count %zu\n",
                 tcg_tb_phys_invalidate_count());
 
@@ -2134,6 +2978,9 @@ void dump_exec_info(void)
     qemu_printf("TLB full flushes    %zu\n", flush_full);
     qemu_printf("TLB partial flushes %zu\n", flush_part);
     qemu_printf("TLB elided flushes  %zu\n", flush_elide);
+    tlb_flush_large_counts(&flush_large, &flush_large_full);
+    qemu_printf("TLB large page flushes %zu (%zu forced a full flush)\n",
+                flush_large, flush_large_full);
     tcg_dump_info();
 }
 
@@ -16,7 +16,9 @@
 #include "exec/log.h"
 #include "exec/translator.h"
 #include "exec/plugin-gen.h"
+#include "exec/helper-gen.h"
 #include "sysemu/replay.h"
+#include "internal.h"
 
 /* Pairs with tcg_clear_temp_count.
    To be called by #TranslatorOps.{translate_insn,tb_stop} if
@@ -31,35 +33,123 @@ void translator_loop_temp_check(DisasContextBase *db)
     }
 }
 
-void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
-                     CPUState *cpu, TranslationBlock *tb, int max_insns)
+/*
+ * Count the executions of @tb and mark it hot once it reaches
+ * tb_trace_threshold, see tb_gen_trace().  This comes before the exit
+ * request check of gen_tb_start(), so that the TB is left right away
+ * and tb_find() gets a chance to replace it with a trace.
+ *
+ * The increment is not atomic, so with MTTCG concurrent executions can
+ * lose counts or store a stale value.  Rather than testing for the exact
+ * threshold, the helper is called for any count in
+ * [threshold, 2 * threshold), where helper_tb_hot() only acts once.  The
+ * counter saturates at 2 * threshold, which tb_gen_trace() also stores once
+ * the TB is TB_TRACE_DONE, so that from then on it is only loaded.
+ */
+static void gen_tb_exec_count(TranslationBlock *tb)
 {
-    int bp_insn = 0;
-    bool plugin_enabled;
+    TCGv_ptr ptr = tcg_const_local_ptr(tb->exec_count);
+    TCGv_i32 count = tcg_temp_new_i32();
+    TCGLabel *skip = gen_new_label();
 
-    /* Initialize DisasContext */
-    db->tb = tb;
-    db->pc_first = tb->pc;
-    db->pc_next = db->pc_first;
-    db->is_jmp = DISAS_NEXT;
-    db->num_insns = 0;
-    db->max_insns = max_insns;
-    db->singlestep_enabled = cpu->singlestep_enabled;
+    tcg_gen_ld_i32(count, ptr, 0);
+    tcg_gen_brcondi_i32(TCG_COND_GEU, count, 2 * tb_trace_threshold, skip);
+    /* Temps do not survive the branch, only the local pointer does */
+    tcg_gen_ld_i32(count, ptr, 0);
+    tcg_gen_addi_i32(count, count, 1);
+    tcg_gen_st_i32(count, ptr, 0);
+    tcg_gen_subi_i32(count, count, tb_trace_threshold);
+    tcg_gen_brcondi_i32(TCG_COND_GEU, count, tb_trace_threshold, skip);
+    tcg_temp_free_ptr(ptr);
+    ptr = tcg_const_ptr(tb);
+    gen_helper_tb_hot(cpu_env, ptr);
+    gen_set_label(skip);
+    tcg_temp_free_i32(count);
+    tcg_temp_free_ptr(ptr);
+}
 
-    ops->init_disas_context(db, cpu);
-    tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
+static bool translator_counts_execs(TranslationBlock *tb)
+{
+    return tb->exec_count &&
+        !(tb_cflags(tb) & (CF_COUNT_MASK | CF_LAST_IO | CF_USE_ICOUNT));
+}
 
-    /* Reset the temp count so that we can identify leaks */
-    tcg_clear_temp_count();
+/*
+ * Turn the exit of a trace block through goto_tb @slot into a jump to the
+ * next block of the trace, whose code is about to be emitted after @last.
+ * The other goto_tb of the block is dropped and its exit does not chain,
+ * so that both jump slots of the TB remain for the last block.
+ *
+ * Return the label to set before the next block, NULL if the next block
+ * simply falls through, or (TCGLabel *)-1 if the exit was not found.
+ */
+static TCGLabel *translator_trace_link(TranslationBlock *tb, TCGOp *first,
+                                       int slot)
+{
+    uintptr_t exit_val = (uintptr_t)tcg_splitwx_to_rx(tb);
+    TCGOp *op, *next, *jump = NULL, *jump_exit = NULL;
+    TCGLabel *label;
 
-    /* Start translating.  */
-    gen_tb_start(db->tb);
-    ops->tb_start(db, cpu);
-    tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
+    for (op = QTAILQ_NEXT(first, link); op; op = QTAILQ_NEXT(op, link)) {
+        if (op->opc == INDEX_op_goto_tb && op->args[0] == slot) {
+            jump = op;
+        } else if (jump && !jump_exit && op->opc == INDEX_op_exit_tb &&
+                   op->args[0] == exit_val + slot) {
+            jump_exit = op;
+        }
+    }
+    if (!jump || !jump_exit) {
+        return (TCGLabel *)-1;
+    }
 
-    plugin_enabled = plugin_gen_tb_start(cpu, tb,
-                                         tb_cflags(db->tb) & CF_MEMI_ONLY);
+    for (op = QTAILQ_NEXT(first, link); op; op = next) {
+        next = QTAILQ_NEXT(op, link);
+        if (op->opc == INDEX_op_goto_tb && op != jump) {
+            tcg_op_remove(tcg_ctx, op);
+        } else if (op->opc == INDEX_op_exit_tb && op != jump_exit &&
+                   (op->args[0] == exit_val + TB_EXIT_IDX0 ||
+                    op->args[0] == exit_val + TB_EXIT_IDX1)) {
+            op->args[0] = 0;
+        }
+    }
 
+    /*
+     * If this exit ends the block, just fall through into the next one;
+     * the stores of the guest pc in between are kept.  Otherwise branch.
+     *
+     * Only the fallthrough case lets the next block benefit from the
+     * previous one: the optimizer forgets what it knows about temps at
+     * every label, and liveness treats the branch as the end of a basic
+     * block, so TEMP_NORMAL temps die and globals are synced to env as
+     * they would be at a goto_tb.  A branch still saves the exit to the
+     * main loop and the TB lookup, but nothing more.
+     */
+    if (jump_exit == tcg_last_op()) {
+        for (op = QTAILQ_NEXT(jump, link); op != jump_exit;
+             op = QTAILQ_NEXT(op, link)) {
+            if (op->opc == INDEX_op_set_label) {
+                break;
+            }
+        }
+        if (op == jump_exit) {
+            tcg_op_remove(tcg_ctx, jump);
+            tcg_op_remove(tcg_ctx, jump_exit);
+            return NULL;
+        }
+    }
+    label = gen_new_label();
+    label->refs++;
+    jump->opc = INDEX_op_br;
+    jump->args[0] = label_arg(label);
+    jump_exit->args[0] = 0;
+    return label;
+}
+
+/* Translate guest instructions from db->pc_next until the block ends. */
+static void translator_block(const TranslatorOps *ops, DisasContextBase *db,
+                             CPUState *cpu, bool plugin_enabled,
+                             int *bp_insn)
+{
     while (true) {
         db->num_insns++;
         ops->insn_start(db, cpu);
@@ -76,7 +166,7 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
             QTAILQ_FOREACH(bp, &cpu->breakpoints, entry) {
                 if (bp->pc == db->pc_next) {
                     if (ops->breakpoint_check(db, cpu, bp)) {
-                        bp_insn = 1;
+                        *bp_insn = 1;
                         break;
                     }
                 }
@@ -128,15 +218,113 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
 
     /* Emit code to exit the TB, as indicated by db->is_jmp.  */
     ops->tb_stop(db, cpu);
-    gen_tb_end(db->tb, db->num_insns - bp_insn);
+}
+
+/*
+ * Continue a trace with the blocks that followed its first one when it
+ * got hot.  Each block is only linked to the next if it translated to the
+ * same extent as when the plan was made; otherwise it becomes the last.
+ */
+static void translator_trace(const TranslatorOps *ops, DisasContextBase *db,
+                             CPUState *cpu, TranslationBlock *tb,
+                             const TranslatorTrace *trace, TCGOp *first,
+                             int *num_insns)
+{
+    target_ulong end = db->pc_next;
+    int max_insns = db->max_insns;
+    int i;
+
+    for (i = 0; i + 1 < trace->nb_blocks; i++) {
+        const TranslatorTraceBlock *b = &trace->block[i];
+        TCGLabel *label;
+        int bp_insn = 0;
+
+        if (db->pc_first != b->pc || db->pc_next - db->pc_first != b->size ||
+            db->num_insns != b->icount ||
+            *num_insns + trace->block[i + 1].icount > max_insns) {
+            break;
+        }
+        label = translator_trace_link(tb, first, b->slot);
+        if (label == (TCGLabel *)-1) {
+            break;
+        }
+        if (label) {
+            gen_set_label(label);
+        }
+
+        first = tcg_last_op();
+        db->pc_first = trace->block[i + 1].pc;
+        db->pc_next = db->pc_first;
+        db->is_jmp = DISAS_NEXT;
+        db->num_insns = 0;
+        db->max_insns = max_insns - *num_insns;
+#ifdef CONFIG_DEBUG_TCG
+        tcg_ctx->goto_tb_issue_mask = 0;
+#endif
+        ops->init_disas_context(db, cpu);
+        tcg_clear_temp_count();
+        ops->tb_start(db, cpu);
+        translator_block(ops, db, cpu, false, &bp_insn);
+        *num_insns += db->num_insns;
+        end = MAX(end, db->pc_next);
+    }
+    tb->size = end - tb->pc;
+    db->pc_first = tb->pc;
+}
+
+void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
+                     CPUState *cpu, TranslationBlock *tb, int max_insns)
+{
+    const TranslatorTrace *trace = tcg_ctx->trace;
+    int bp_insn = 0;
+    int num_insns;
+    bool plugin_enabled;
+    TCGOp *first;
+
+    /* Only the translation that tb_gen_trace() asked for is a trace */
+    tcg_ctx->trace = NULL;
+
+    /* Initialize DisasContext */
+    db->tb = tb;
+    db->pc_first = tb->pc;
+    db->pc_next = db->pc_first;
+    db->is_jmp = DISAS_NEXT;
+    db->num_insns = 0;
+    db->max_insns = max_insns;
+    db->singlestep_enabled = cpu->singlestep_enabled;
+
+    ops->init_disas_context(db, cpu);
+    tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
+
+    /* Reset the temp count so that we can identify leaks */
+    tcg_clear_temp_count();
+
+    /* Start translating.  */
+    if (!trace && translator_counts_execs(tb)) {
+        gen_tb_exec_count(tb);
+    }
+    gen_tb_start(db->tb);
+    ops->tb_start(db, cpu);
+    tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
+    first = tcg_last_op();
+
+    plugin_enabled = plugin_gen_tb_start(cpu, tb,
+                                         tb_cflags(db->tb) & CF_MEMI_ONLY);
+
+    translator_block(ops, db, cpu, plugin_enabled, &bp_insn);
+    tb->size = db->pc_next - db->pc_first;
+    num_insns = db->num_insns;
+    if (trace) {
+        translator_trace(ops, db, cpu, tb, trace, first, &num_insns);
+    }
+    gen_tb_end(db->tb, num_insns - bp_insn);
 
     if (plugin_enabled) {
         plugin_gen_tb_end(cpu);
     }
 
     /* The disas_log hook may use these values rather than recompute.  */
-    tb->size = db->pc_next - db->pc_first;
-    tb->icount = db->num_insns;
+    tb->icount = num_insns;
 
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_IN_ASM)
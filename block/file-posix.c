@@ -161,6 +161,9 @@ typedef struct BDRVRawState {
     bool discard_zeroes:1;
     bool use_linux_aio:1;
     bool use_linux_io_uring:1;
+    bool use_io_uring_fixed:1;
+    bool use_io_uring_sqpoll:1;
+    int io_uring_sqpoll_cpu;
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
     bool needs_alignment;
@@ -529,6 +532,24 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_STRING,
             .help = "host AIO implementation (threads, native, io_uring)",
         },
+        {
+            .name = "x-io-uring-fixed",
+            .type = QEMU_OPT_BOOL,
+            .help = "register the image file and guest RAM with io_uring "
+                    "(default: off)",
+        },
+        {
+            .name = "x-io-uring-sqpoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "submit io_uring requests through a kernel polling "
+                    "thread (default: off)",
+        },
+        {
+            .name = "x-io-uring-sqpoll-cpu",
+            .type = QEMU_OPT_NUMBER,
+            .help = "host CPU for the io_uring kernel polling thread "
+                    "(default: no affinity)",
+        },
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -557,6 +578,24 @@ static QemuOptsList raw_runtime_opts = {
 
 static const char *const mutable_opts[] = { "x-check-cache-dropped", NULL };
 
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * The io_uring ring is shared by all nodes in an AioContext and its setup
+ * flags are fixed by whichever node created it.
+ */
+static void raw_check_io_uring_sqpoll(BlockDriverState *bs, LuringState *aio)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_io_uring_sqpoll != luring_is_sqpoll(aio)) {
+        warn_report("'%s': io_uring ring of this AioContext was created "
+                    "with x-io-uring-sqpoll=%s, ignoring x-io-uring-sqpoll=%s",
+                    bs->filename, luring_is_sqpoll(aio) ? "on" : "off",
+                    s->use_io_uring_sqpoll ? "on" : "off");
+    }
+}
+#endif
+
 static int raw_open_common(BlockDriverState *bs, QDict *options,
                            int bdrv_flags, int open_flags,
                            bool device, Error **errp)
@@ -607,6 +646,36 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 #ifdef CONFIG_LINUX_IO_URING
     s->use_linux_io_uring = (aio == BLOCKDEV_AIO_OPTIONS_IO_URING);
 #endif
+    s->use_io_uring_fixed = qemu_opt_get_bool(opts, "x-io-uring-fixed", false);
+    if (s->use_io_uring_fixed && !s->use_linux_io_uring) {
+        error_setg(errp, "x-io-uring-fixed requires aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
+    s->use_io_uring_sqpoll = qemu_opt_get_bool(opts, "x-io-uring-sqpoll",
+                                               false);
+    s->io_uring_sqpoll_cpu = -1;
+    if (qemu_opt_get(opts, "x-io-uring-sqpoll-cpu")) {
+        uint64_t cpu = qemu_opt_get_number(opts, "x-io-uring-sqpoll-cpu", 0);
+
+        if (!s->use_io_uring_sqpoll) {
+            error_setg(errp, "x-io-uring-sqpoll-cpu requires "
+                       "x-io-uring-sqpoll=on");
+            ret = -EINVAL;
+            goto fail;
+        }
+        if (cpu > INT_MAX) {
+            error_setg(errp, "x-io-uring-sqpoll-cpu is out of range");
+            ret = -EINVAL;
+            goto fail;
+        }
+        s->io_uring_sqpoll_cpu = cpu;
+    }
+    if (s->use_io_uring_sqpoll && !s->use_linux_io_uring) {
+        error_setg(errp, "x-io-uring-sqpoll requires aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
 
     locking = qapi_enum_parse(&OnOffAuto_lookup,
                               qemu_opt_get(opts, "locking"),
@@ -702,10 +771,18 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
-        if (!aio_setup_linux_io_uring(bdrv_get_aio_context(bs), errp)) {
+        LuringState *aio = aio_setup_linux_io_uring(bdrv_get_aio_context(bs),
+                                                    s->use_io_uring_sqpoll,
+                                                    s->io_uring_sqpoll_cpu,
+                                                    errp);
+        if (!aio) {
             error_prepend(errp, "Unable to use io_uring: ");
             goto fail;
         }
+        raw_check_io_uring_sqpoll(bs, aio);
+        if (s->use_io_uring_fixed) {
+            luring_enable_fixed(aio);
+        }
     }
 #else
     if (s->use_linux_io_uring) {
@@ -2028,7 +2105,8 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
     } else if (s->use_linux_io_uring) {
         LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
         assert(qiov->size == bytes);
-        return luring_co_submit(bs, aio, s->fd, offset, qiov, type);
+        return luring_co_submit(bs, aio, s->fd, offset, qiov, type,
+                                s->use_io_uring_fixed);
 #endif
 #ifdef CONFIG_LINUX_AIO
     } else if (s->use_linux_aio) {
@@ -2123,7 +2201,8 @@ static int raw_co_flush_to_disk(BlockDriverState *bs)
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
         LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
-        return luring_co_submit(bs, aio, s->fd, 0, NULL, QEMU_AIO_FLUSH);
+        return luring_co_submit(bs, aio, s->fd, 0, NULL, QEMU_AIO_FLUSH,
+                                s->use_io_uring_fixed);
     }
 #endif
     return raw_thread_pool_submit(bs, handle_aiocb_flush, &acb);
@@ -2146,20 +2225,55 @@ static void raw_aio_attach_aio_context(BlockDriverState *bs,
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
         Error *local_err = NULL;
-        if (!aio_setup_linux_io_uring(new_context, &local_err)) {
+        LuringState *aio = aio_setup_linux_io_uring(new_context,
+                                                    s->use_io_uring_sqpoll,
+                                                    s->io_uring_sqpoll_cpu,
+                                                    &local_err);
+        if (!aio) {
             error_reportf_err(local_err, "Unable to use linux io_uring, "
                                          "falling back to thread pool: ");
             s->use_linux_io_uring = false;
+        } else {
+            raw_check_io_uring_sqpoll(bs, aio);
+            if (s->use_io_uring_fixed) {
+                luring_enable_fixed(aio);
+            }
         }
     }
 #endif
 }
 
+/*
+ * Drop @fd from the io_uring registered file table before it is closed or
+ * used from another AioContext.  This is done whether or not the node uses
+ * x-io-uring-fixed itself: a stale slot would otherwise be matched by any
+ * later file that happens to reuse the descriptor number.
+ */
+static void raw_io_uring_unregister_fd(BlockDriverState *bs, int fd)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_linux_io_uring && fd >= 0) {
+        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        luring_unregister_file(aio, fd);
+    }
+#endif
+}
+
+static void raw_aio_detach_aio_context(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+
+    raw_io_uring_unregister_fd(bs, s->fd);
+}
+
 static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
     if (s->fd >= 0) {
+        raw_io_uring_unregister_fd(bs, s->fd);
         qemu_close(s->fd);
         s->fd = -1;
     }
@@ -3153,6 +3267,7 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+        raw_io_uring_unregister_fd(bs, s->fd);
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
@@ -3255,6 +3370,7 @@ BlockDriver bdrv_file = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
 
     .bdrv_co_truncate = raw_co_truncate,
     .bdrv_getlength = raw_getlength,
@@ -3621,6 +3737,7 @@ static BlockDriver bdrv_host_device = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
 
     .bdrv_co_truncate       = raw_co_truncate,
     .bdrv_getlength	= raw_getlength,
@@ -3745,6 +3862,7 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
 
     .bdrv_co_truncate    = raw_co_truncate,
     .bdrv_getlength      = raw_getlength,
@@ -3875,6 +3993,7 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
 
     .bdrv_co_truncate    = raw_co_truncate,
     .bdrv_getlength      = raw_getlength,
@@ -16,12 +16,26 @@
 #include "block/block.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
+#include "qemu/error-report.h"
 #include "qapi/error.h"
+#include "exec/ramlist.h"
 #include "trace.h"
 
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Number of slots in the registered file table */
+#define MAX_FIXED_FILES 64
+
+/* The kernel refuses to register buffers larger than 1 GiB */
+#define MAX_FIXED_BUF_SIZE (1ULL << 30)
+
+/* The kernel refuses to register more than UIO_MAXIOV buffers */
+#define MAX_FIXED_BUFS 1024
+
+/* Milliseconds without submissions before the SQPOLL kernel thread sleeps */
+#define SQPOLL_IDLE_MS 1000
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -50,14 +64,30 @@ typedef struct LuringState {
     AioContext *aio_context;
 
     struct io_uring ring;
+    bool sqpoll;                /* ring created with IORING_SETUP_SQPOLL */
 
     /* io queue for submit at batch.  Protected by AioContext lock. */
     LuringQueue io_q;
 
     /* I/O completion processing.  Only runs in I/O thread.  */
     QEMUBH *completion_bh;
+
+    /*
+     * Registered files and buffers, see luring_enable_fixed().  Protected by
+     * AioContext lock.
+     */
+    bool fixed_enabled;
+    bool fixed_files_registered;
+    int fixed_files[MAX_FIXED_FILES];
+
+    RAMBlockNotifier ram_notifier;
+    GArray *fixed_bufs;         /* struct iovec, in registration order */
+    bool fixed_bufs_registered;
+    bool fixed_bufs_dirty;      /* fixed_bufs differs from the kernel table */
 } LuringState;
 
+static void luring_update_fixed_bufs(LuringState *s);
+
 /**
  * luring_resubmit:
  *
@@ -104,8 +134,15 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 
     /* Update sqe */
     luringcb->sqeq.off = nread;
-    luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
-    luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        /* Fixed buffer requests always have a single iovec */
+        luringcb->sqeq.addr =
+            (__u64)(uintptr_t)luringcb->resubmit_qiov.iov[0].iov_base;
+        luringcb->sqeq.len = luringcb->resubmit_qiov.iov[0].iov_len;
+    } else {
+        luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
+        luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    }
 
     luring_resubmit(s, luringcb);
 }
@@ -205,6 +242,10 @@ end:
         }
     }
     qemu_bh_cancel(s->completion_bh);
+
+    if (s->fixed_bufs_dirty) {
+        luring_update_fixed_bufs(s);
+    }
 }
 
 static int ioq_submit(LuringState *s)
@@ -312,6 +353,285 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
     }
 }
 
+/**
+ * luring_fixed_file_index:
+ * @s: AIO state
+ * @fd: file descriptor for I/O
+ *
+ * Returns the slot of @fd in the registered file table, registering it on
+ * first use, or -1 if @fd should be passed to the kernel as is.
+ */
+static int luring_fixed_file_index(LuringState *s, int fd)
+{
+    int free_slot = -1;
+    int i, ret;
+
+    if (!s->fixed_files_registered) {
+        return -1;
+    }
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_files[i] == fd) {
+            return i;
+        }
+        if (free_slot < 0 && s->fixed_files[i] == -1) {
+            free_slot = i;
+        }
+    }
+    if (free_slot < 0) {
+        return -1;
+    }
+
+    ret = io_uring_register_files_update(&s->ring, free_slot, &fd, 1);
+    trace_luring_register_file(s, fd, free_slot, ret);
+    if (ret < 0) {
+        return -1;
+    }
+    s->fixed_files[free_slot] = fd;
+    return free_slot;
+}
+
+/**
+ * luring_fixed_buf_index:
+ * @s: AIO state
+ * @qiov: I/O vector of a read or write request
+ *
+ * Returns the index of the registered buffer that contains @qiov, or -1 if
+ * the request cannot use READ_FIXED/WRITE_FIXED.  Only single-element
+ * vectors qualify because fixed buffer operations take a flat buffer.
+ */
+static int luring_fixed_buf_index(LuringState *s, QEMUIOVector *qiov)
+{
+    uintptr_t base, end;
+    guint i;
+
+    if (!s->fixed_bufs_registered || s->fixed_bufs_dirty ||
+        qiov->niov != 1) {
+        return -1;
+    }
+
+    base = (uintptr_t)qiov->iov[0].iov_base;
+    end = base + qiov->iov[0].iov_len;
+    for (i = 0; i < s->fixed_bufs->len; i++) {
+        struct iovec *buf = &g_array_index(s->fixed_bufs, struct iovec, i);
+        uintptr_t buf_base = (uintptr_t)buf->iov_base;
+
+        if (base >= buf_base && end <= buf_base + buf->iov_len) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * luring_update_fixed_bufs:
+ * @s: AIO state
+ *
+ * Pushes @s->fixed_bufs to the kernel.  Requests that were prepared with a
+ * buffer index must not be in flight when the table changes, so this is
+ * deferred until the ring is idle; in the meantime requests fall back to
+ * unregistered buffers.
+ */
+static void luring_update_fixed_bufs(LuringState *s)
+{
+    int ret;
+
+    if (s->io_q.in_flight || s->io_q.in_queue) {
+        return;
+    }
+
+    if (s->fixed_bufs_registered) {
+        io_uring_unregister_buffers(&s->ring);
+        s->fixed_bufs_registered = false;
+    }
+    s->fixed_bufs_dirty = false;
+
+    if (!s->fixed_bufs->len) {
+        return;
+    }
+
+    ret = io_uring_register_buffers(&s->ring,
+                                    (struct iovec *)s->fixed_bufs->data,
+                                    s->fixed_bufs->len);
+    trace_luring_register_buffers(s, s->fixed_bufs->len, ret);
+    if (ret < 0) {
+        warn_report_once("io_uring: unable to register guest RAM as fixed "
+                         "buffers: %s", strerror(-ret));
+        return;
+    }
+    s->fixed_bufs_registered = true;
+}
+
+/* Append the buffers that cover @size bytes of RAM at @host */
+static void luring_add_fixed_bufs(LuringState *s, void *host, size_t size)
+{
+    uint8_t *p = host;
+
+    while (size) {
+        struct iovec buf = {
+            .iov_base = p,
+            .iov_len = MIN(size, MAX_FIXED_BUF_SIZE),
+        };
+
+        if (s->fixed_bufs->len == MAX_FIXED_BUFS) {
+            /*
+             * Whatever does not fit keeps using readv/writev.  RAM added
+             * later may still fit once other blocks have been removed.
+             */
+            warn_report_once("io_uring: the fixed buffer table is full "
+                             "(%d entries), I/O to some guest RAM will not "
+                             "use fixed buffers", MAX_FIXED_BUFS);
+            break;
+        }
+        g_array_append_val(s->fixed_bufs, buf);
+        p += buf.iov_len;
+        size -= buf.iov_len;
+    }
+}
+
+/* Drop the buffers that start within @size bytes of RAM at @host */
+static void luring_remove_fixed_bufs(LuringState *s, void *host, size_t size)
+{
+    uintptr_t start = (uintptr_t)host;
+    guint i;
+
+    for (i = 0; i < s->fixed_bufs->len;) {
+        struct iovec *buf = &g_array_index(s->fixed_bufs, struct iovec, i);
+        uintptr_t buf_base = (uintptr_t)buf->iov_base;
+
+        if (buf_base >= start && buf_base < start + size) {
+            g_array_remove_index(s->fixed_bufs, i);
+        } else {
+            i++;
+        }
+    }
+}
+
+/*
+ * Only the used part of a RAM block is registered: the rest of a resizable
+ * block may not be backed by memory that the kernel can pin.
+ */
+static void luring_ram_block_added(RAMBlockNotifier *n, void *host,
+                                   size_t size, size_t max_size)
+{
+    LuringState *s = container_of(n, LuringState, ram_notifier);
+
+    if (!host) {
+        return;
+    }
+
+    aio_context_acquire(s->aio_context);
+    luring_add_fixed_bufs(s, host, size);
+    s->fixed_bufs_dirty = true;
+    luring_update_fixed_bufs(s);
+    aio_context_release(s->aio_context);
+}
+
+static void luring_ram_block_removed(RAMBlockNotifier *n, void *host,
+                                     size_t size, size_t max_size)
+{
+    LuringState *s = container_of(n, LuringState, ram_notifier);
+
+    if (!host) {
+        return;
+    }
+
+    aio_context_acquire(s->aio_context);
+    luring_remove_fixed_bufs(s, host, max_size);
+    s->fixed_bufs_dirty = true;
+    luring_update_fixed_bufs(s);
+    aio_context_release(s->aio_context);
+}
+
+/*
+ * The kernel pinned the pages that were registered, so a block that shrank
+ * must not keep its old buffers and one that grew needs new ones.
+ */
+static void luring_ram_block_resized(RAMBlockNotifier *n, void *host,
+                                     size_t old_size, size_t new_size)
+{
+    LuringState *s = container_of(n, LuringState, ram_notifier);
+
+    if (!host) {
+        return;
+    }
+
+    aio_context_acquire(s->aio_context);
+    luring_remove_fixed_bufs(s, host, old_size);
+    luring_add_fixed_bufs(s, host, new_size);
+    s->fixed_bufs_dirty = true;
+    luring_update_fixed_bufs(s);
+    aio_context_release(s->aio_context);
+}
+
+/**
+ * luring_enable_fixed:
+ * @s: AIO state
+ *
+ * Registers files used with this ring as fixed files and guest RAM as fixed
+ * buffers, saving the kernel a file table lookup and page pinning for each
+ * request.  Once enabled, this stays on for the lifetime of the ring.
+ * Failure to set up either table is not fatal; requests then simply use
+ * the regular opcodes.
+ *
+ * Context: QEMU global mutex held, AioContext lock held
+ */
+void luring_enable_fixed(LuringState *s)
+{
+    int ret;
+    int i;
+
+    if (s->fixed_enabled) {
+        return;
+    }
+    s->fixed_enabled = true;
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        s->fixed_files[i] = -1;
+    }
+    ret = io_uring_register_files(&s->ring, s->fixed_files, MAX_FIXED_FILES);
+    if (ret < 0) {
+        warn_report("io_uring: unable to register fixed files: %s",
+                    strerror(-ret));
+    } else {
+        s->fixed_files_registered = true;
+    }
+
+    s->ram_notifier.ram_block_added = luring_ram_block_added;
+    s->ram_notifier.ram_block_removed = luring_ram_block_removed;
+    s->ram_notifier.ram_block_resized = luring_ram_block_resized;
+    ram_block_notifier_add(&s->ram_notifier);
+}
+
+/**
+ * luring_unregister_file:
+ * @s: AIO state
+ * @fd: file descriptor that is about to be closed or moved to another ring
+ *
+ * Drops @fd from the registered file table.  Must be called before @fd is
+ * closed, otherwise a new file reusing the descriptor number would be
+ * mistaken for the old one.
+ */
+void luring_unregister_file(LuringState *s, int fd)
+{
+    int i;
+
+    if (!s->fixed_files_registered) {
+        return;
+    }
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_files[i] == fd) {
+            int unused = -1;
+
+            io_uring_register_files_update(&s->ring, i, &unused, 1);
+            trace_luring_register_file(s, unused, i, 0);
+            s->fixed_files[i] = -1;
+            return;
+        }
+    }
+}
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
@@ -319,24 +639,53 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
  * @s: AIO state
  * @offset: offset for request
  * @type: type of request
+ * @fixed: use the registered file and buffer tables if possible
  *
  * Fetches sqes from ring, adds to pending queue and preps them
  *
  */
 static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
-                            uint64_t offset, int type)
+                            uint64_t offset, int type, bool fixed)
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
+    int file_index = -1;
+    int buf_index = -1;
+
+    /*
+     * The ring is shared by all nodes in the AioContext, but only nodes
+     * with x-io-uring-fixed put their fd in the file table.
+     */
+    if (fixed) {
+        file_index = luring_fixed_file_index(s, fd);
+        if (type == QEMU_AIO_READ || type == QEMU_AIO_WRITE) {
+            buf_index = luring_fixed_buf_index(s, luringcb->qiov);
+        }
+    }
+    if (file_index >= 0) {
+        fd = file_index;
+    }
 
     switch (type) {
     case QEMU_AIO_WRITE:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                      luringcb->qiov->iov[0].iov_len, offset,
+                                      buf_index);
+        } else {
+            io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
+                                 luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_READ:
-        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
-                            luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                     luringcb->qiov->iov[0].iov_len, offset,
+                                     buf_index);
+        } else {
+            io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
+                                luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_FLUSH:
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
@@ -346,6 +695,9 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+    if (file_index >= 0) {
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -363,7 +715,8 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
 }
 
 int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
-                                  uint64_t offset, QEMUIOVector *qiov, int type)
+                                  uint64_t offset, QEMUIOVector *qiov, int type,
+                                  bool fixed)
 {
     int ret;
     LuringAIOCB luringcb = {
@@ -374,7 +727,7 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
     };
     trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
                            type);
-    ret = luring_do_submit(fd, &luringcb, s, offset, type);
+    ret = luring_do_submit(fd, &luringcb, s, offset, type, fixed);
 
     if (ret < 0) {
         return ret;
@@ -402,28 +755,61 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_completion_cb, NULL, qemu_luring_poll_cb, s);
 }
 
-LuringState *luring_init(Error **errp)
+/**
+ * luring_init:
+ * @sqpoll: create the ring with a kernel submission queue polling thread
+ * @sqpoll_cpu: host CPU to bind the polling thread to, or -1 for no affinity
+ * @errp: error object
+ *
+ * With @sqpoll, submitting requests only needs an io_uring_enter() syscall
+ * when the kernel thread went to sleep after SQPOLL_IDLE_MS without work.
+ * Together with AioContext polling of the completion queue this makes the
+ * I/O fast path free of syscalls, at the cost of a busy kernel thread.
+ */
+LuringState *luring_init(bool sqpoll, int sqpoll_cpu, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
+    struct io_uring_params params = {};
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    if (sqpoll) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = SQPOLL_IDLE_MS;
+        if (sqpoll_cpu >= 0) {
+            params.flags |= IORING_SETUP_SQ_AFF;
+            params.sq_thread_cpu = sqpoll_cpu;
+        }
+    }
+
+    rc = io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
     if (rc < 0) {
-        error_setg_errno(errp, errno, "failed to init linux io_uring ring");
+        error_setg_errno(errp, -rc, "failed to init linux io_uring ring%s",
+                         sqpoll ? " with SQPOLL" : "");
         g_free(s);
         return NULL;
     }
+    s->sqpoll = sqpoll;
 
     ioq_init(&s->io_q);
+    s->fixed_bufs = g_array_new(false, false, sizeof(struct iovec));
     return s;
 
 }
 
+bool luring_is_sqpoll(LuringState *s)
+{
+    return s->sqpoll;
+}
+
 void luring_cleanup(LuringState *s)
 {
+    if (s->fixed_enabled) {
+        ram_block_notifier_remove(&s->ram_notifier);
+    }
+    g_array_free(s->fixed_bufs, true);
     io_uring_queue_exit(&s->ring);
     trace_luring_cleanup_state(s);
     g_free(s);
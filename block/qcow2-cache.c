@@ -26,11 +26,24 @@
 #include "qcow2.h"
 #include "trace.h"
 
+/*
+ * Cached tables are found through a hash table that maps the table offset
+ * to its entry, so that lookups don't depend on the size of the cache.
+ * Entries with the same hash are chained through Qcow2CachedTable.next.
+ *
+ * Replacement uses the CLOCK algorithm: every lookup sets the referenced
+ * bit of the entry, and on a miss the clock hand sweeps over the entries,
+ * clearing the referenced bits, until it finds an unused entry whose bit
+ * is already clear.
+ */
+
 typedef struct Qcow2CachedTable {
     int64_t  offset;
     uint64_t lru_counter;
+    int      next;
     int      ref;
     bool     dirty;
+    bool     referenced;
 } Qcow2CachedTable;
 
 struct Qcow2Cache {
@@ -42,6 +55,11 @@ struct Qcow2Cache {
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+    int                    *buckets;
+    int                     nb_buckets;
+    int                     clock_hand;
+    uint64_t                hits;
+    uint64_t                misses;
 };
 
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
@@ -69,6 +87,74 @@ static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
     }
 }
 
+static inline int qcow2_cache_bucket(Qcow2Cache *c, uint64_t offset)
+{
+    return (offset / c->table_size) & (c->nb_buckets - 1);
+}
+
+static int qcow2_cache_lookup(Qcow2Cache *c, uint64_t offset)
+{
+    int i;
+
+    for (i = c->buckets[qcow2_cache_bucket(c, offset)]; i != -1;
+         i = c->entries[i].next) {
+        if (c->entries[i].offset == offset) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Changes the offset of entry @i and moves it to the right hash bucket */
+static void qcow2_cache_set_offset(Qcow2Cache *c, int i, uint64_t offset)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+    int *p;
+
+    if (t->offset) {
+        p = &c->buckets[qcow2_cache_bucket(c, t->offset)];
+        while (*p != i) {
+            assert(*p != -1);
+            p = &c->entries[*p].next;
+        }
+        *p = t->next;
+        t->next = -1;
+    }
+
+    t->offset = offset;
+
+    if (offset) {
+        p = &c->buckets[qcow2_cache_bucket(c, offset)];
+        t->next = *p;
+        *p = i;
+    }
+}
+
+/* Returns the index of the entry to replace, or -1 if all are in use */
+static int qcow2_cache_find_victim(Qcow2Cache *c)
+{
+    int n;
+
+    /* Two rounds clear all referenced bits and come back to the start */
+    for (n = 0; n < 2 * c->size; n++) {
+        Qcow2CachedTable *t = &c->entries[c->clock_hand];
+        int i = c->clock_hand;
+
+        if (++c->clock_hand == c->size) {
+            c->clock_hand = 0;
+        }
+        if (t->ref) {
+            continue;
+        }
+        if (t->referenced) {
+            t->referenced = false;
+            continue;
+        }
+        return i;
+    }
+    return -1;
+}
+
 static void qcow2_cache_table_release(Qcow2Cache *c, int i, int num_tables)
 {
 /* Using MADV_DONTNEED to discard memory is a Linux-specific feature */
@@ -104,8 +190,9 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
+            qcow2_cache_set_offset(c, i, 0);
             c->entries[i].lru_counter = 0;
+            c->entries[i].referenced = false;
             i++;
             to_clean++;
         }
@@ -123,6 +210,7 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2Cache *c;
+    int i;
 
     assert(num_tables > 0);
     assert(is_power_of_2(table_size));
@@ -132,15 +220,25 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
     c = g_new0(Qcow2Cache, 1);
     c->size = num_tables;
     c->table_size = table_size;
+    c->nb_buckets = pow2ceil(num_tables);
     c->entries = g_try_new0(Qcow2CachedTable, num_tables);
+    c->buckets = g_try_new(int, c->nb_buckets);
     c->table_array = qemu_try_blockalign(bs->file->bs,
                                          (size_t) num_tables * c->table_size);
 
-    if (!c->entries || !c->table_array) {
+    if (!c->entries || !c->buckets || !c->table_array) {
         qemu_vfree(c->table_array);
+        g_free(c->buckets);
         g_free(c->entries);
         g_free(c);
-        c = NULL;
+        return NULL;
+    }
+
+    for (i = 0; i < num_tables; i++) {
+        c->entries[i].next = -1;
+    }
+    for (i = 0; i < c->nb_buckets; i++) {
+        c->buckets[i] = -1;
     }
 
     return c;
@@ -155,6 +253,7 @@ int qcow2_cache_destroy(Qcow2Cache *c)
     }
 
     qemu_vfree(c->table_array);
+    g_free(c->buckets);
     g_free(c->entries);
     g_free(c);
 
@@ -307,11 +406,17 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
         assert(c->entries[i].ref == 0);
         c->entries[i].offset = 0;
         c->entries[i].lru_counter = 0;
+        c->entries[i].next = -1;
+        c->entries[i].referenced = false;
+    }
+    for (i = 0; i < c->nb_buckets; i++) {
+        c->buckets[i] = -1;
     }
 
     qcow2_cache_table_release(c, 0, c->size);
 
     c->lru_counter = 0;
+    c->clock_hand = 0;
 
     return 0;
 }
@@ -322,9 +427,6 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     BDRVQcow2State *s = bs->opaque;
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     assert(offset != 0);
 
@@ -339,29 +441,21 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     }
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / c->table_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
-        }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+    i = qcow2_cache_lookup(c, offset);
+    if (i != -1) {
+        c->hits++;
+        goto found;
+    }
 
-    if (min_lru_index == -1) {
+    c->misses++;
+    i = qcow2_cache_find_victim(c);
+    if (i == -1) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
     /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -372,7 +466,7 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    qcow2_cache_set_offset(c, i, 0);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -386,11 +480,12 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
         }
     }
 
-    c->entries[i].offset = offset;
+    qcow2_cache_set_offset(c, i, offset);
 
     /* And return the right table */
 found:
     c->entries[i].ref++;
+    c->entries[i].referenced = true;
     *table = qcow2_cache_get_table_addr(c, i);
 
     trace_qcow2_cache_get_done(qemu_coroutine_self(),
@@ -434,14 +529,9 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
 
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
-    int i;
+    int i = qcow2_cache_lookup(c, offset);
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(c, i);
-        }
-    }
-    return NULL;
+    return i == -1 ? NULL : qcow2_cache_get_table_addr(c, i);
 }
 
 void qcow2_cache_discard(Qcow2Cache *c, void *table)
@@ -450,9 +540,16 @@ void qcow2_cache_discard(Qcow2Cache *c, void *table)
 
     assert(c->entries[i].ref == 0);
 
-    c->entries[i].offset = 0;
+    qcow2_cache_set_offset(c, i, 0);
     c->entries[i].lru_counter = 0;
     c->entries[i].dirty = false;
+    c->entries[i].referenced = false;
 
     qcow2_cache_table_release(c, i, 1);
 }
+
+void qcow2_cache_get_stats(Qcow2Cache *c, uint64_t *hits, uint64_t *misses)
+{
+    *hits = c->hits;
+    *misses = c->misses;
+}
@@ -1582,15 +1582,15 @@ static int do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
     /* Allocate new clusters */
     trace_qcow2_cluster_alloc_phys(qemu_coroutine_self());
     if (*host_offset == INV_OFFSET) {
-        int64_t cluster_offset =
-            qcow2_alloc_clusters(bs, *nb_clusters * s->cluster_size);
+        int64_t cluster_offset = qcow2_alloc_data_clusters(bs, *nb_clusters);
         if (cluster_offset < 0) {
             return cluster_offset;
         }
         *host_offset = cluster_offset;
         return 0;
     } else {
-        int64_t ret = qcow2_alloc_clusters_at(bs, *host_offset, *nb_clusters);
+        int64_t ret = qcow2_alloc_data_clusters_at(bs, *host_offset,
+                                                   *nb_clusters);
         if (ret < 0) {
             return ret;
         }
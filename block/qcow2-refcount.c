@@ -1063,6 +1063,101 @@ int64_t qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
     return i;
 }
 
+/*
+ * Data cluster allocation batching
+ *
+ * With the alloc-batch-size option, data clusters are not allocated one
+ * write request at a time.  Instead a range of alloc_batch_clusters is
+ * allocated (i.e. its refcounts are set) with a single refcount update,
+ * and write requests are then served from that range without touching
+ * the refcount blocks.  Clusters that are reserved but not used yet are
+ * leaked if QEMU crashes; they are returned by
+ * qcow2_release_reserved_clusters() on every clean shutdown.
+ */
+
+/*
+ * Allocates @nb_clusters contiguous data clusters and returns the offset
+ * of the first one, or -errno.
+ */
+int64_t qcow2_alloc_data_clusters(BlockDriverState *bs, uint64_t nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int64_t offset;
+    int ret;
+
+    if (nb_clusters > s->alloc_batch_clusters) {
+        return qcow2_alloc_clusters(bs, nb_clusters << s->cluster_bits);
+    }
+
+    if (s->reserved_clusters < nb_clusters) {
+        ret = qcow2_release_reserved_clusters(bs);
+        if (ret < 0) {
+            return ret;
+        }
+
+        offset = qcow2_alloc_clusters(bs, s->alloc_batch_clusters <<
+                                          s->cluster_bits);
+        if (offset < 0) {
+            return offset;
+        }
+        trace_qcow2_alloc_batch(bs, offset, s->alloc_batch_clusters);
+        s->reserved_offset = offset;
+        s->reserved_clusters = s->alloc_batch_clusters;
+    }
+
+    offset = s->reserved_offset;
+    s->reserved_offset += nb_clusters << s->cluster_bits;
+    s->reserved_clusters -= nb_clusters;
+
+    return offset;
+}
+
+/*
+ * Like qcow2_alloc_clusters_at(), but takes the clusters from the reserved
+ * range if @offset is where it starts.  Returns the number of clusters
+ * allocated or -errno.
+ */
+int64_t qcow2_alloc_data_clusters_at(BlockDriverState *bs, uint64_t offset,
+                                     int64_t nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    assert(nb_clusters >= 0);
+    if (s->reserved_clusters && offset == s->reserved_offset) {
+        nb_clusters = MIN(nb_clusters, s->reserved_clusters);
+        s->reserved_offset += nb_clusters << s->cluster_bits;
+        s->reserved_clusters -= nb_clusters;
+        return nb_clusters;
+    }
+
+    return qcow2_alloc_clusters_at(bs, offset, nb_clusters);
+}
+
+/*
+ * Frees the clusters that were reserved by qcow2_alloc_data_clusters() but
+ * not handed out yet.
+ */
+int qcow2_release_reserved_clusters(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    if (!s->reserved_clusters) {
+        return 0;
+    }
+
+    ret = update_refcount(bs, s->reserved_offset,
+                          s->reserved_clusters << s->cluster_bits, 1, true,
+                          QCOW2_DISCARD_NEVER);
+    if (ret < 0) {
+        return ret;
+    }
+
+    s->reserved_offset = 0;
+    s->reserved_clusters = 0;
+    return 0;
+}
+
 /* only used to allocate compressed sectors. We try to allocate
    contiguous sectors. size must be <= cluster_size */
 int64_t qcow2_alloc_bytes(BlockDriverState *bs, int size)
@@ -611,6 +611,12 @@ static int coroutine_fn qcow2_co_check_locked(BlockDriverState *bs,
 
     memset(result, 0, sizeof(*result));
 
+    /* Reserved clusters would show up as leaks */
+    ret = qcow2_release_reserved_clusters(bs);
+    if (ret < 0) {
+        return ret;
+    }
+
     ret = qcow2_check_read_snapshot_table(bs, &snapshot_res, fix);
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
@@ -697,6 +703,7 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_ALLOC_BATCH_SIZE,
     NULL
 };
 
@@ -808,6 +815,11 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_ALLOC_BATCH_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Allocate data clusters in batches of this size",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -969,6 +981,7 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     uint64_t cache_clean_interval;
+    uint64_t alloc_batch_clusters;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -982,6 +995,7 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
     const char *opt_overlap_check, *opt_overlap_check_template;
     int overlap_check_template = 0;
     uint64_t l2_cache_size, l2_cache_entry_size, refcount_cache_size;
+    uint64_t alloc_batch_size;
     int i;
     const char *encryptfmt;
     QDict *encryptopts = NULL;
@@ -1070,6 +1084,21 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
+    alloc_batch_size = qemu_opt_get_size(opts, QCOW2_OPT_ALLOC_BATCH_SIZE, 0);
+    if (!QEMU_IS_ALIGNED(alloc_batch_size, s->cluster_size)) {
+        error_setg(errp, QCOW2_OPT_ALLOC_BATCH_SIZE
+                   " must be a multiple of the cluster size");
+        ret = -EINVAL;
+        goto fail;
+    }
+    if (alloc_batch_size > QCOW2_MAX_ALLOC_BATCH_SIZE) {
+        error_setg(errp, QCOW2_OPT_ALLOC_BATCH_SIZE " must not exceed %"
+                   PRIu64, (uint64_t)QCOW2_MAX_ALLOC_BATCH_SIZE);
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->alloc_batch_clusters = alloc_batch_size >> s->cluster_bits;
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1225,6 +1254,10 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    /* qcow2_reopen_prepare() has released the reserved clusters */
+    assert(!s->reserved_clusters);
+    s->alloc_batch_clusters = r->alloc_batch_clusters;
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1932,6 +1965,12 @@ static int qcow2_reopen_prepare(BDRVReopenState *state,
     r = g_new0(Qcow2ReopenState, 1);
     state->opaque = r;
 
+    ret = qcow2_release_reserved_clusters(state->bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to release reserved clusters");
+        goto fail;
+    }
+
     ret = qcow2_update_options_prepare(state->bs, r, state->options,
                                        state->flags, errp);
     if (ret < 0) {
@@ -2662,6 +2701,13 @@ static int qcow2_inactivate(BlockDriverState *bs)
                           bdrv_get_device_or_node_name(bs));
     }
 
+    ret = qcow2_release_reserved_clusters(bs);
+    if (ret) {
+        result = ret;
+        error_report("Failed to release reserved clusters: %s",
+                     strerror(-ret));
+    }
+
     ret = qcow2_cache_flush(bs, s->l2_table_cache);
     if (ret) {
         result = ret;
@@ -4187,6 +4233,12 @@ static int coroutine_fn qcow2_co_truncate(BlockDriverState *bs, int64_t offset,
         goto fail;
     }
 
+    ret = qcow2_release_reserved_clusters(bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to release reserved clusters");
+        goto fail;
+    }
+
     old_length = bs->total_sectors * BDRV_SECTOR_SIZE;
     new_l1_size = size_to_l1(s, offset);
 
@@ -5174,6 +5226,21 @@ static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs,
     return spec_info;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+    BDRVQcow2State *s = bs->opaque;
+    BlockStatsSpecificQcow2 *q = &stats->u.qcow2;
+
+    stats->driver = BLOCKDEV_DRIVER_QCOW2;
+    qcow2_cache_get_stats(s->l2_table_cache, &q->l2_cache_hits,
+                          &q->l2_cache_misses);
+    qcow2_cache_get_stats(s->refcount_block_cache, &q->refcount_cache_hits,
+                          &q->refcount_cache_misses);
+
+    return stats;
+}
+
 static int qcow2_has_zero_init(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -5941,6 +6008,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure           = qcow2_measure,
     .bdrv_get_info          = qcow2_get_info,
     .bdrv_get_specific_info = qcow2_get_specific_info,
+    .bdrv_get_specific_stats = qcow2_get_specific_stats,
 
     .bdrv_save_vmstate    = qcow2_save_vmstate,
     .bdrv_load_vmstate    = qcow2_load_vmstate,
@@ -43,6 +43,21 @@ struct VirtIOBlockDataPlane {
      */
     IOThread *iothread;
     AioContext *ctx;
+
+    /*
+     * Additional IOThreads from the "iothreads" property.  The BlockBackend
+     * lives in the AioContext of the first one (ctx above) while virtqueue
+     * ioeventfds are spread round-robin over all of them.  Only the event
+     * loop wakeups and polling are distributed: virtio_blk_handle_vq() and
+     * the block layer below it are not multiqueue-safe, so request
+     * processing remains serialized on the BlockBackend's AioContext.
+     * Requests complete in ctx, which updates the vring of their virtqueue,
+     * so the host notifier handlers and polling callbacks of virtqueues in
+     * other IOThreads run with ctx acquired as well.
+     */
+    IOThread **iothreads;
+    unsigned num_iothreads;
+    AioContext **vq_aio_context;
 };
 
 /* Raise an interrupt to signal guest, if necessary */
@@ -63,6 +78,16 @@ static void notify_guest_bh(void *opaque)
     unsigned long bitmap[BITS_TO_LONGS(nvqs)];
     unsigned j;
 
+    /*
+     * With an iothread list, virtqueues are processed by other threads
+     * holding the BlockBackend's AioContext.  Take it too so that the
+     * notification does not race with those threads' vring accesses.
+     * A single IOThread already runs this BH in s->ctx and needs no lock.
+     */
+    if (s->num_iothreads > 1) {
+        aio_context_acquire(s->ctx);
+    }
+
     memcpy(bitmap, s->batch_notify_vqs, sizeof(bitmap));
     memset(s->batch_notify_vqs, 0, sizeof(bitmap));
 
@@ -78,6 +103,10 @@ static void notify_guest_bh(void *opaque)
             bits &= bits - 1; /* clear right-most bit */
         }
     }
+
+    if (s->num_iothreads > 1) {
+        aio_context_release(s->ctx);
+    }
 }
 
 /* Context: QEMU global mutex held */
@@ -88,10 +117,24 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     VirtIOBlockDataPlane *s;
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    unsigned i;
 
     *dataplane = NULL;
 
-    if (conf->iothread) {
+    if (conf->iothread && conf->num_iothreads) {
+        error_setg(errp, "iothread and iothreads properties are mutually "
+                   "exclusive");
+        return false;
+    }
+    for (i = 0; i < conf->num_iothreads; i++) {
+        if (!conf->iothread_ids[i] || !iothread_by_id(conf->iothread_ids[i])) {
+            error_setg(errp, "iothreads[%u]: IOThread '%s' not found", i,
+                       conf->iothread_ids[i] ? conf->iothread_ids[i] : "");
+            return false;
+        }
+    }
+
+    if (conf->iothread || conf->num_iothreads) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -120,13 +163,35 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s->vdev = vdev;
     s->conf = conf;
 
-    if (conf->iothread) {
+    if (conf->num_iothreads) {
+        s->num_iothreads = conf->num_iothreads;
+        s->iothreads = g_new(IOThread *, s->num_iothreads);
+        for (i = 0; i < s->num_iothreads; i++) {
+            s->iothreads[i] = iothread_by_id(conf->iothread_ids[i]);
+            object_ref(OBJECT(s->iothreads[i]));
+        }
+        s->iothread = s->iothreads[0];
+        object_ref(OBJECT(s->iothread));
+        s->ctx = iothread_get_aio_context(s->iothread);
+    } else if (conf->iothread) {
         s->iothread = conf->iothread;
         object_ref(OBJECT(s->iothread));
         s->ctx = iothread_get_aio_context(s->iothread);
     } else {
         s->ctx = qemu_get_aio_context();
     }
+
+    s->vq_aio_context = g_new(AioContext *, conf->num_queues);
+    for (i = 0; i < conf->num_queues; i++) {
+        if (s->num_iothreads) {
+            IOThread *iothread = s->iothreads[i % s->num_iothreads];
+
+            s->vq_aio_context[i] = iothread_get_aio_context(iothread);
+        } else {
+            s->vq_aio_context[i] = s->ctx;
+        }
+    }
+
     s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
     s->batch_notify_vqs = bitmap_new(conf->num_queues);
 
@@ -139,6 +204,7 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
 void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 {
     VirtIOBlock *vblk;
+    unsigned i;
 
     if (!s) {
         return;
@@ -151,6 +217,11 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
     if (s->iothread) {
         object_unref(OBJECT(s->iothread));
     }
+    for (i = 0; i < s->num_iothreads; i++) {
+        object_unref(OBJECT(s->iothreads[i]));
+    }
+    g_free(s->iothreads);
+    g_free(s->vq_aio_context);
     g_free(s);
 }
 
@@ -246,14 +317,16 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     }
 
     /* Get this show started by hooking up our callbacks */
-    aio_context_acquire(s->ctx);
     for (i = 0; i < nvqs; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
+        AioContext *ctx = s->vq_aio_context[i];
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx,
+        aio_context_acquire(ctx);
+        virtio_queue_aio_set_host_notifier_handler_locked(vq, ctx,
+                ctx != s->ctx ? s->ctx : NULL,
                 virtio_blk_data_plane_handle_output);
+        aio_context_release(ctx);
     }
-    aio_context_release(s->ctx);
     return 0;
 
   fail_aio_context:
@@ -289,12 +362,16 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
 static void virtio_blk_data_plane_stop_bh(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
     unsigned i;
 
     for (i = 0; i < s->conf->num_queues; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx, NULL);
+        if (s->vq_aio_context[i] != ctx) {
+            continue;
+        }
+        virtio_queue_aio_set_host_notifier_handler(vq, ctx, NULL);
     }
 }
 
@@ -321,6 +398,15 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     s->stopping = true;
     trace_virtio_blk_data_plane_stop(s);
 
+    /* The first IOThread is s->ctx and is handled below */
+    for (i = 1; i < s->num_iothreads; i++) {
+        AioContext *ctx = iothread_get_aio_context(s->iothreads[i]);
+
+        aio_context_acquire(ctx);
+        aio_wait_bh_oneshot(ctx, virtio_blk_data_plane_stop_bh, s);
+        aio_context_release(ctx);
+    }
+
     aio_context_acquire(s->ctx);
     aio_wait_bh_oneshot(s->ctx, virtio_blk_data_plane_stop_bh, s);
 
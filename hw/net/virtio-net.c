@@ -44,6 +44,8 @@
 #include "hw/pci/pci.h"
 #include "net_rx_pkt.h"
 #include "hw/virtio/vhost.h"
+#include "exec/memory.h"
+#include "block/aio-wait.h"
 
 #define VIRTIO_NET_VM_VERSION    11
 
@@ -350,11 +352,78 @@ static void virtio_net_vnet_endian_status(VirtIONet *n, uint8_t status)
     }
 }
 
+/*
+ * Notify the guest about a data virtqueue.  While the dataplane runs the
+ * queue may be processed outside the main loop, where only the irqfd
+ * path is safe.
+ */
+static void virtio_net_notify_queue(VirtIONet *n, VirtQueue *vq)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+
+    if (n->dataplane_started) {
+        virtio_notify_irqfd(vdev, vq);
+    } else {
+        virtio_notify(vdev, vq);
+    }
+}
+
 static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
 {
     unsigned int dropped = virtqueue_drop_all(vq);
     if (dropped) {
-        virtio_notify(vdev, vq);
+        virtio_net_notify_queue(VIRTIO_NET(vdev), vq);
+    }
+}
+
+static void virtio_net_dataplane_start(VirtIONet *n);
+static void virtio_net_dataplane_stop(VirtIONet *n);
+
+static void virtio_net_dataplane_status(VirtIONet *n, uint8_t status)
+{
+    if (!n->num_iothreads) {
+        return;
+    }
+
+    if (!virtio_net_started(n, status) || n->vhost_started) {
+        /* A failed start is retried the next time the device starts */
+        n->dataplane_disabled = false;
+        if (n->dataplane_started) {
+            virtio_net_dataplane_stop(n);
+        }
+        return;
+    }
+
+    if (!n->dataplane_started && !n->dataplane_disabled) {
+        virtio_net_dataplane_start(n);
+    }
+}
+
+/*
+ * Acquire the AioContexts of all IOThreads so that no queue pair runs
+ * while device state shared with the datapath changes.  Returns false
+ * if the dataplane is not running and nothing was acquired.
+ */
+static bool virtio_net_dataplane_acquire(VirtIONet *n)
+{
+    int i;
+
+    if (!n->dataplane_started) {
+        return false;
+    }
+
+    for (i = 0; i < n->num_iothreads; i++) {
+        aio_context_acquire(iothread_get_aio_context(n->iothreads[i]));
+    }
+    return true;
+}
+
+static void virtio_net_dataplane_release(VirtIONet *n)
+{
+    int i;
+
+    for (i = 0; i < n->num_iothreads; i++) {
+        aio_context_release(iothread_get_aio_context(n->iothreads[i]));
     }
 }
 
@@ -367,6 +436,7 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 
     virtio_net_vnet_endian_status(n, status);
     virtio_net_vhost_status(n, status);
+    virtio_net_dataplane_status(n, status);
 
     for (i = 0; i < n->max_queues; i++) {
         NetClientState *ncs = qemu_get_subqueue(n->nic, i);
@@ -381,11 +451,15 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
         queue_started =
             virtio_net_started(n, queue_status) && !n->vhost_started;
 
+        /* The queue pair may be running in an IOThread */
+        qemu_net_client_lock(ncs);
+
         if (queue_started) {
             qemu_flush_queued_packets(ncs);
         }
 
         if (!q->tx_waiting) {
+            qemu_net_client_unlock(ncs);
             continue;
         }
 
@@ -412,6 +486,8 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
                 virtio_net_drop_tx_queue_data(vdev, q->tx_vq);
             }
         }
+
+        qemu_net_client_unlock(ncs);
     }
 }
 
@@ -1434,6 +1510,7 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
     size_t s;
     struct iovec *iov, *iov2;
     unsigned int iov_cnt;
+    bool locked;
 
     for (;;) {
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
@@ -1452,6 +1529,9 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         iov2 = iov = g_memdup(elem->out_sg, sizeof(struct iovec) * elem->out_num);
         s = iov_to_buf(iov, iov_cnt, 0, &ctrl, sizeof(ctrl));
         iov_discard_front(&iov, &iov_cnt, sizeof(ctrl));
+
+        /* Keep IOThreads from receiving while the filters change */
+        locked = virtio_net_dataplane_acquire(n);
         if (s != sizeof(ctrl)) {
             status = VIRTIO_NET_ERR;
         } else if (ctrl.class == VIRTIO_NET_CTRL_RX) {
@@ -1467,6 +1547,9 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         } else if (ctrl.class == VIRTIO_NET_CTRL_GUEST_OFFLOADS) {
             status = virtio_net_handle_offloads(n, ctrl.cmd, iov, iov_cnt);
         }
+        if (locked) {
+            virtio_net_dataplane_release(n);
+        }
 
         s = iov_from_buf(elem->in_sg, elem->in_num, 0, &status, sizeof(status));
         assert(s == sizeof(status));
@@ -1852,7 +1935,11 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    if (q->rx_batching) {
+        q->rx_notify_pending = true;
+    } else {
+        virtio_net_notify_queue(n, q->rx_vq);
+    }
 
     return size;
 }
@@ -1865,6 +1952,25 @@ static ssize_t virtio_net_do_receive(NetClientState *nc, const uint8_t *buf,
     return virtio_net_receive_rcu(nc, buf, size, false);
 }
 
+static void virtio_net_receive_batch_begin(NetClientState *nc)
+{
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+
+    q->rx_batching = true;
+}
+
+static void virtio_net_receive_batch_end(NetClientState *nc)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+
+    q->rx_batching = false;
+    if (q->rx_notify_pending) {
+        q->rx_notify_pending = false;
+        virtio_net_notify_queue(n, q->rx_vq);
+    }
+}
+
 static void virtio_net_rsc_extract_unit4(VirtioNetRscChain *chain,
                                          const uint8_t *buf,
                                          VirtioNetRscUnit *unit)
@@ -2475,10 +2581,9 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
-    VirtIODevice *vdev = VIRTIO_DEVICE(n);
 
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
-    virtio_notify(vdev, q->tx_vq);
+    virtio_net_notify_queue(n, q->tx_vq);
 
     g_free(q->async_tx.elem);
     q->async_tx.elem = NULL;
@@ -2573,7 +2678,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 
 drop:
         virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
+        virtio_net_notify_queue(n, q->tx_vq);
         g_free(elem);
 
         if (++num_packets >= n->tx_burst) {
@@ -2708,6 +2813,254 @@ static void virtio_net_tx_bh(void *opaque)
     }
 }
 
+/* Dataplane: queue pairs processed in IOThreads */
+
+static bool virtio_net_dataplane_handle_rx(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
+
+    aio_context_acquire(q->ctx);
+    virtio_net_handle_rx(vdev, vq);
+    aio_context_release(q->ctx);
+
+    /* New rx buffers alone are no reason to keep polling */
+    return false;
+}
+
+static bool virtio_net_dataplane_handle_tx(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
+
+    aio_context_acquire(q->ctx);
+    virtio_net_handle_tx_bh(vdev, vq);
+    aio_context_release(q->ctx);
+
+    return true;
+}
+
+static void virtio_net_dataplane_tx_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+    AioContext *ctx = q->ctx;
+
+    aio_context_acquire(ctx);
+    virtio_net_tx_bh(q);
+    aio_context_release(ctx);
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_net_dataplane_start(VirtIONet *n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int queues = n->multiqueue ? n->max_queues : 1;
+    int nvqs = queues * 2;
+    int i, r;
+
+    /* Set up guest notifier (irq) for the data virtqueues */
+    r = k->set_guest_notifiers(qbus->parent, nvqs, true);
+    if (r < 0) {
+        error_report("virtio-net failed to set guest notifier (%d), "
+                     "ensure -accel kvm is set; "
+                     "falling back on the main loop", r);
+        goto fail_guest_notifiers;
+    }
+
+    /* The control virtqueue stays with the main loop, like with vhost */
+    r = virtio_device_grab_ioeventfd(vdev);
+    if (r < 0) {
+        error_report("virtio-net binding does not support host notifiers; "
+                     "falling back on the main loop");
+        goto fail_grab;
+    }
+
+    memory_region_transaction_begin();
+
+    for (i = 0; i < nvqs; i++) {
+        r = virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, true);
+        if (r < 0) {
+            int j = i;
+
+            error_report("virtio-net failed to set host notifier (%d)", r);
+            while (i--) {
+                virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+            }
+
+            memory_region_transaction_commit();
+
+            while (j--) {
+                virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), j);
+            }
+            goto fail_host_notifiers;
+        }
+    }
+
+    memory_region_transaction_commit();
+
+    n->dataplane_started = true;
+    trace_virtio_net_dataplane_start(n, queues);
+
+    for (i = 0; i < queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+        IOThread *iothread = n->iothreads[i % n->num_iothreads];
+        AioContext *ctx = iothread_get_aio_context(iothread);
+
+        aio_context_acquire(ctx);
+        q->ctx = ctx;
+        qemu_bh_delete(q->tx_bh);
+        q->tx_bh = aio_bh_new(ctx, virtio_net_dataplane_tx_bh, q);
+        qemu_net_client_set_aio_context(qemu_get_subqueue(n->nic, i), ctx);
+        virtio_queue_aio_set_host_notifier_handler(q->rx_vq, ctx,
+                virtio_net_dataplane_handle_rx);
+        virtio_queue_aio_set_host_notifier_handler(q->tx_vq, ctx,
+                virtio_net_dataplane_handle_tx);
+        aio_context_release(ctx);
+
+        /* Kick right away to process buffers already in the vrings */
+        event_notifier_set(virtio_queue_get_host_notifier(q->rx_vq));
+        event_notifier_set(virtio_queue_get_host_notifier(q->tx_vq));
+    }
+    return;
+
+  fail_host_notifiers:
+    virtio_device_release_ioeventfd(vdev);
+  fail_grab:
+    k->set_guest_notifiers(qbus->parent, nvqs, false);
+  fail_guest_notifiers:
+    n->dataplane_disabled = true;
+}
+
+/* Move the queue pairs of this IOThread back to the main loop.
+ *
+ * Context: BH in IOThread
+ */
+static void virtio_net_dataplane_stop_bh(void *opaque)
+{
+    VirtIONet *n = opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
+    int i;
+
+    for (i = 0; i < n->max_queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        if (q->ctx != ctx) {
+            continue;
+        }
+        virtio_queue_aio_set_host_notifier_handler(q->rx_vq, ctx, NULL);
+        virtio_queue_aio_set_host_notifier_handler(q->tx_vq, ctx, NULL);
+        qemu_net_client_set_aio_context(qemu_get_subqueue(n->nic, i), NULL);
+        qemu_bh_delete(q->tx_bh);
+        q->tx_bh = qemu_bh_new(virtio_net_tx_bh, q);
+        q->ctx = NULL;
+    }
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_net_dataplane_stop(VirtIONet *n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int queues = n->multiqueue ? n->max_queues : 1;
+    int nvqs = queues * 2;
+    int i;
+
+    trace_virtio_net_dataplane_stop(n);
+
+    for (i = 0; i < n->num_iothreads; i++) {
+        AioContext *ctx = iothread_get_aio_context(n->iothreads[i]);
+
+        aio_context_acquire(ctx);
+        aio_wait_bh_oneshot(ctx, virtio_net_dataplane_stop_bh, n);
+        aio_context_release(ctx);
+    }
+
+    n->dataplane_started = false;
+
+    memory_region_transaction_begin();
+
+    for (i = 0; i < nvqs; i++) {
+        virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+    }
+
+    memory_region_transaction_commit();
+
+    for (i = 0; i < nvqs; i++) {
+        virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
+    }
+
+    /* This may run the main loop handlers right away */
+    virtio_device_release_ioeventfd(vdev);
+
+    /* Clean up guest notifier (irq) */
+    k->set_guest_notifiers(qbus->parent, nvqs, false);
+}
+
+/* Context: QEMU global mutex held */
+static bool virtio_net_dataplane_realize(VirtIONet *n, Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int i;
+
+    for (i = 0; i < n->num_iothreads; i++) {
+        if (!n->iothread_ids[i] || !iothread_by_id(n->iothread_ids[i])) {
+            error_setg(errp, "iothreads[%d]: IOThread '%s' not found", i,
+                       n->iothread_ids[i] ? n->iothread_ids[i] : "");
+            return false;
+        }
+    }
+
+    if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
+        error_setg(errp, "device is incompatible with iothreads "
+                   "(transport does not support notifiers)");
+        return false;
+    }
+    if (!virtio_device_ioeventfd_enabled(vdev)) {
+        error_setg(errp, "ioeventfd is required for iothreads");
+        return false;
+    }
+
+    if (n->net_conf.tx && !strcmp(n->net_conf.tx, "timer")) {
+        error_setg(errp, "tx=timer is not supported with iothreads");
+        return false;
+    }
+    if (virtio_has_feature(n->host_features, VIRTIO_NET_F_RSC_EXT)) {
+        error_setg(errp, "guest_rsc_ext is not supported with iothreads");
+        return false;
+    }
+    /*
+     * Software RSS hands packets to another queue pair, which may be owned
+     * by a different IOThread.
+     */
+    if (virtio_has_feature(n->host_features, VIRTIO_NET_F_RSS)) {
+        error_setg(errp, "rss is not supported with iothreads");
+        return false;
+    }
+
+    for (i = 0; i < n->nic_conf.peers.queues; i++) {
+        NetClientState *peer = n->nic_conf.peers.ncs[i];
+
+        if (peer && !peer->info->set_aio_context) {
+            error_setg(errp, "netdev '%s' cannot be used with iothreads",
+                       peer->name);
+            return false;
+        }
+    }
+
+    n->iothreads = g_new(IOThread *, n->num_iothreads);
+    for (i = 0; i < n->num_iothreads; i++) {
+        n->iothreads[i] = iothread_by_id(n->iothread_ids[i]);
+        object_ref(OBJECT(n->iothreads[i]));
+    }
+
+    return true;
+}
+
 static void virtio_net_add_queue(VirtIONet *n, int index)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -3142,6 +3495,8 @@ static NetClientInfo net_virtio_info = {
     .size = sizeof(NICState),
     .can_receive = virtio_net_can_receive,
     .receive = virtio_net_receive,
+    .receive_batch_begin = virtio_net_receive_batch_begin,
+    .receive_batch_end = virtio_net_receive_batch_end,
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
     .announce = virtio_net_announce,
@@ -3390,6 +3745,12 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
     n->net_conf.tx_queue_size = MIN(virtio_net_max_tx_queue_size(n),
                                     n->net_conf.tx_queue_size);
 
+    if (n->num_iothreads && !virtio_net_dataplane_realize(n, errp)) {
+        g_free(n->vqs);
+        virtio_cleanup(vdev);
+        return;
+    }
+
     for (i = 0; i < n->max_queues; i++) {
         virtio_net_add_queue(n, i);
     }
@@ -3468,9 +3829,15 @@ static void virtio_net_device_unrealize(DeviceState *dev)
         virtio_net_unload_ebpf(n);
     }
 
-    /* This will stop vhost backend if appropriate. */
+    /* This will stop vhost backend or dataplane if appropriate. */
     virtio_net_set_status(vdev, 0);
 
+    for (i = 0; i < n->num_iothreads; i++) {
+        object_unref(OBJECT(n->iothreads[i]));
+    }
+    g_free(n->iothreads);
+    n->iothreads = NULL;
+
     g_free(n->netclient_name);
     n->netclient_name = NULL;
     g_free(n->netclient_type);
@@ -3624,6 +3991,8 @@ static Property virtio_net_properties[] = {
     DEFINE_PROP_INT32("speed", VirtIONet, net_conf.speed, SPEED_UNKNOWN),
     DEFINE_PROP_STRING("duplex", VirtIONet, net_conf.duplex_str),
     DEFINE_PROP_BOOL("failover", VirtIONet, failover, false),
+    DEFINE_PROP_ARRAY("iothreads", VirtIONet, num_iothreads,
+                      iothread_ids, qdev_prop_string, char *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
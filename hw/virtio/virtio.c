@@ -126,6 +126,7 @@ struct VirtQueue
     uint16_t vector;
     VirtIOHandleOutput handle_output;
     VirtIOHandleAIOOutput handle_aio_output;
+    AioContext *handle_aio_lock;    /* acquired around host notifier handlers */
     VirtIODevice *vdev;
     EventNotifier guest_notifier;
     EventNotifier host_notifier;
@@ -3523,11 +3524,27 @@ EventNotifier *virtio_queue_get_guest_notifier(VirtQueue *vq)
     return &vq->guest_notifier;
 }
 
+static void virtio_queue_host_notifier_aio_lock(VirtQueue *vq)
+{
+    if (vq->handle_aio_lock) {
+        aio_context_acquire(vq->handle_aio_lock);
+    }
+}
+
+static void virtio_queue_host_notifier_aio_unlock(VirtQueue *vq)
+{
+    if (vq->handle_aio_lock) {
+        aio_context_release(vq->handle_aio_lock);
+    }
+}
+
 static void virtio_queue_host_notifier_aio_read(EventNotifier *n)
 {
     VirtQueue *vq = container_of(n, VirtQueue, host_notifier);
     if (event_notifier_test_and_clear(n)) {
+        virtio_queue_host_notifier_aio_lock(vq);
         virtio_queue_notify_aio_vq(vq);
+        virtio_queue_host_notifier_aio_unlock(vq);
     }
 }
 
@@ -3535,19 +3552,24 @@ static void virtio_queue_host_notifier_aio_poll_begin(EventNotifier *n)
 {
     VirtQueue *vq = container_of(n, VirtQueue, host_notifier);
 
+    virtio_queue_host_notifier_aio_lock(vq);
     virtio_queue_set_notification(vq, 0);
+    virtio_queue_host_notifier_aio_unlock(vq);
 }
 
 static bool virtio_queue_host_notifier_aio_poll(void *opaque)
 {
     EventNotifier *n = opaque;
     VirtQueue *vq = container_of(n, VirtQueue, host_notifier);
+    bool progress = false;
 
-    if (!vq->vring.desc || virtio_queue_empty(vq)) {
-        return false;
+    virtio_queue_host_notifier_aio_lock(vq);
+    if (vq->vring.desc && !virtio_queue_empty(vq)) {
+        progress = virtio_queue_notify_aio_vq(vq);
     }
+    virtio_queue_host_notifier_aio_unlock(vq);
 
-    return virtio_queue_notify_aio_vq(vq);
+    return progress;
 }
 
 static void virtio_queue_host_notifier_aio_poll_end(EventNotifier *n)
@@ -3555,14 +3577,26 @@ static void virtio_queue_host_notifier_aio_poll_end(EventNotifier *n)
     VirtQueue *vq = container_of(n, VirtQueue, host_notifier);
 
     /* Caller polls once more after this to catch requests that race with us */
+    virtio_queue_host_notifier_aio_lock(vq);
     virtio_queue_set_notification(vq, 1);
+    virtio_queue_host_notifier_aio_unlock(vq);
 }
 
 void virtio_queue_aio_set_host_notifier_handler(VirtQueue *vq, AioContext *ctx,
                                                 VirtIOHandleAIOOutput handle_output)
+{
+    virtio_queue_aio_set_host_notifier_handler_locked(vq, ctx, NULL,
+                                                      handle_output);
+}
+
+void virtio_queue_aio_set_host_notifier_handler_locked(VirtQueue *vq,
+                                                       AioContext *ctx,
+                                                       AioContext *lock_ctx,
+                                                       VirtIOHandleAIOOutput handle_output)
 {
     if (handle_output) {
         vq->handle_aio_output = handle_output;
+        vq->handle_aio_lock = lock_ctx;
         aio_set_event_notifier(ctx, &vq->host_notifier, true,
                                virtio_queue_host_notifier_aio_read,
                                virtio_queue_host_notifier_aio_poll);
@@ -3575,6 +3609,7 @@ void virtio_queue_aio_set_host_notifier_handler(VirtQueue *vq, AioContext *ctx,
          * in case poll callback didn't have time to run. */
         virtio_queue_host_notifier_aio_read(&vq->host_notifier);
         vq->handle_aio_output = NULL;
+        vq->handle_aio_lock = NULL;
     }
 }
 
@@ -487,8 +487,12 @@ struct LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp);
 /* Return the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_get_linux_aio(AioContext *ctx);
 
-/* Setup the LuringState bound to this AioContext */
-struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
+/*
+ * Setup the LuringState bound to this AioContext.  @sqpoll and @sqpoll_cpu
+ * only take effect if the ring does not exist yet, see luring_init().
+ */
+struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, bool sqpoll,
+                                             int sqpoll_cpu, Error **errp);
 
 /* Return the LuringState bound to this AioContext */
 struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
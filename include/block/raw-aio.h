@@ -60,14 +60,18 @@ void laio_io_unplug(BlockDriverState *bs, LinuxAioState *s);
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
 typedef struct LuringState LuringState;
-LuringState *luring_init(Error **errp);
+LuringState *luring_init(bool sqpoll, int sqpoll_cpu, Error **errp);
+bool luring_is_sqpoll(LuringState *s);
 void luring_cleanup(LuringState *s);
 int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
-                                uint64_t offset, QEMUIOVector *qiov, int type);
+                                uint64_t offset, QEMUIOVector *qiov, int type,
+                                bool fixed);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
 void luring_io_plug(BlockDriverState *bs, LuringState *s);
 void luring_io_unplug(BlockDriverState *bs, LuringState *s);
+void luring_enable_fixed(LuringState *s);
+void luring_unregister_file(LuringState *s, int fd);
 #endif
 
 #ifdef _WIN32
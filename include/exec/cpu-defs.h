@@ -150,14 +150,32 @@ typedef struct CPUIOTLBEntry {
     MemTxAttrs attrs;
 } CPUIOTLBEntry;
 
+/* Number of large pages tracked individually for each MMU mode. */
+#define CPU_TLB_LARGE_PAGES 8
+
+/*
+ * A large page allocated into the tlb.  A virtual address is within
+ * the page if (vaddr & mask) == addr.
+ */
+typedef struct CPUTLBLargePage {
+    target_ulong addr;
+    target_ulong mask;
+} CPUTLBLargePage;
+
 /*
  * Data elements that are per MMU mode, minus the bits accessed by
  * the TCG fast path.
  */
 typedef struct CPUTLBDesc {
     /*
-     * Describe a region covering all of the large pages allocated
-     * into the tlb.  When any page within this region is flushed,
+     * The large pages allocated into the tlb.  When a page within one
+     * of them is flushed, only the entries of that large page are.
+     */
+    CPUTLBLargePage large_page[CPU_TLB_LARGE_PAGES];
+    int n_large_pages;
+    /*
+     * Describe a region covering all of the large pages that did not
+     * fit in large_page[].  When any page within this region is flushed,
      * we must flush the entire tlb.  The region is matched if
      * (addr & large_page_mask) == large_page_addr.
      */
@@ -208,6 +226,9 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    /* Flushes limited to one large page, and full flushes they forced */
+    size_t large_flush_count;
+    size_t large_full_flush_count;
 } CPUTLBCommon;
 
 /*
@@ -554,6 +554,17 @@ struct TranslationBlock {
     uintptr_t jmp_list_head;
     uintptr_t jmp_list_next[2];
     uintptr_t jmp_dest[2];
+
+    /*
+     * Tiered translation, see tb_gen_trace(): the number of times the TB
+     * was entered, as counted by its own code (NULL if it does not count),
+     * and whether it should be replaced by a trace.
+     */
+    uint32_t *exec_count;
+    uint32_t trace_state;
+#define TB_TRACE_NONE   0
+#define TB_TRACE_HOT    1 /* hot, not yet replaced */
+#define TB_TRACE_DONE   2 /* replaced, or not worth replacing */
 };
 
 /* Hide the qatomic_read to make code a little easier on the eyes */
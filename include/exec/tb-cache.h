@@ -0,0 +1,41 @@
+/*
+ * Persistent translation cache for user-mode emulation
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef EXEC_TB_CACHE_H
+#define EXEC_TB_CACHE_H
+
+#include "exec/exec-all.h"
+
+/*
+ * Select the cache file for @exec_path in directory @dir.  Must be called
+ * before the accelerator is initialized, so that the code buffer can be
+ * placed where the cache expects it.
+ */
+void tb_cache_open(const char *dir, const char *exec_path,
+                   const char *cpu_type);
+
+/* Load the cache, or start recording a new one; call after the prologue. */
+void tb_cache_start(void);
+
+/*
+ * Look up a TB for @pc in the cache, making the cached TBs of its page
+ * visible if this is the first time the page is executed.
+ * Called with mmap_lock held.
+ */
+TranslationBlock *tb_cache_lookup(CPUState *cpu, target_ulong pc,
+                                  target_ulong cs_base, uint32_t flags,
+                                  uint32_t cflags);
+
+/* Note a freshly generated TB.  Called with mmap_lock held. */
+void tb_cache_record(TranslationBlock *tb);
+
+/* The code buffer has been flushed: forget about the cache. */
+void tb_cache_flush(void);
+
+/* Write the cache file back, if anything was added to it. */
+void tb_cache_save(void);
+
+#endif /* EXEC_TB_CACHE_H */
@@ -76,6 +76,37 @@ typedef struct DisasContextBase {
     bool singlestep_enabled;
 } DisasContextBase;
 
+/* Maximum number of guest blocks in a trace TB, see tb_gen_trace(). */
+#define TB_TRACE_MAX_BLOCKS 8
+
+/**
+ * TranslatorTraceBlock:
+ * @pc: Address of the first guest instruction of the block.
+ * @size: Size of the guest code of the block.
+ * @icount: Number of guest instructions in the block.
+ * @slot: goto_tb slot through which the block continues to the next one.
+ *
+ * One block of a trace, as it was translated on its own.
+ */
+typedef struct TranslatorTraceBlock {
+    target_ulong pc;
+    uint16_t size;
+    uint16_t icount;
+    int slot;
+} TranslatorTraceBlock;
+
+/**
+ * TranslatorTrace:
+ * @nb_blocks: Number of blocks in the trace.
+ * @block: The blocks, in execution order, starting with the TB's own pc.
+ *
+ * Blocks that translator_loop() should chain into a single TB.
+ */
+typedef struct TranslatorTrace {
+    int nb_blocks;
+    TranslatorTraceBlock block[TB_TRACE_MAX_BLOCKS];
+} TranslatorTrace;
+
 /**
  * TranslatorOps:
  * @init_disas_context:
@@ -20,6 +20,7 @@
 #include "net/announce.h"
 #include "qemu/option_int.h"
 #include "qom/object.h"
+#include "sysemu/iothread.h"
 
 #include "ebpf/ebpf_rss.h"
 
@@ -151,6 +152,11 @@ typedef struct VirtIONetQueue {
     struct {
         VirtQueueElement *elem;
     } async_tx;
+    /* rx guest notification deferred until the end of a receive batch */
+    bool rx_batching;
+    bool rx_notify_pending;
+    /* IOThread context of the queue pair while the dataplane runs */
+    AioContext *ctx;
     struct VirtIONet *n;
 } VirtIONetQueue;
 
@@ -213,6 +219,16 @@ struct VirtIONet {
     VirtioNetRssData rss_data;
     struct NetRxPkt *rx_pkt;
     struct EBPFRSSContext ebpf_rss;
+    /*
+     * Queue pairs are spread round-robin over these IOThreads when vhost
+     * is not in use.  Each queue pair's virtqueues, tx bottom half and
+     * peer net client then run in its IOThread's AioContext.
+     */
+    uint32_t num_iothreads;
+    char **iothread_ids;
+    IOThread **iothreads;
+    bool dataplane_started;
+    bool dataplane_disabled;
 };
 
 void virtio_net_set_netclient_name(VirtIONet *n, const char *name,
@@ -319,6 +319,16 @@ void virtio_queue_set_host_notifier_enabled(VirtQueue *vq, bool enabled);
 void virtio_queue_host_notifier_read(EventNotifier *n);
 void virtio_queue_aio_set_host_notifier_handler(VirtQueue *vq, AioContext *ctx,
                                                 VirtIOHandleAIOOutput handle_output);
+/*
+ * Like virtio_queue_aio_set_host_notifier_handler(), but the handlers, and
+ * the polling callbacks that look at the vring, run with @lock_ctx acquired.
+ * This is for virtqueues whose notifications come in an AioContext other
+ * than the one that completes their requests.
+ */
+void virtio_queue_aio_set_host_notifier_handler_locked(VirtQueue *vq,
+                                                       AioContext *ctx,
+                                                       AioContext *lock_ctx,
+                                                       VirtIOHandleAIOOutput handle_output);
 VirtQueue *virtio_vector_first_queue(VirtIODevice *vdev, uint16_t vector);
 VirtQueue *virtio_vector_next_queue(VirtQueue *vq);
 
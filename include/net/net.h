@@ -43,6 +43,8 @@ typedef struct NICConf {
 /* Net clients */
 
 typedef void (NetPoll)(NetClientState *, bool enable);
+typedef void (NetReceiveBatch)(NetClientState *);
+typedef void (NetSetAioContext)(NetClientState *, AioContext *);
 typedef bool (NetCanReceive)(NetClientState *);
 typedef ssize_t (NetReceive)(NetClientState *, const uint8_t *, size_t);
 typedef ssize_t (NetReceiveIOV)(NetClientState *, const struct iovec *, int);
@@ -69,6 +71,8 @@ typedef struct NetClientInfo {
     NetReceive *receive;
     NetReceive *receive_raw;
     NetReceiveIOV *receive_iov;
+    NetReceiveBatch *receive_batch_begin;
+    NetReceiveBatch *receive_batch_end;
     NetCanReceive *can_receive;
     NetCleanup *cleanup;
     LinkStatusChanged *link_status_changed;
@@ -84,6 +88,7 @@ typedef struct NetClientInfo {
     SetVnetBE *set_vnet_be;
     NetAnnounce *announce;
     SetSteeringEBPF *set_steering_ebpf;
+    NetSetAioContext *set_aio_context;
 } NetClientInfo;
 
 struct NetClientState {
@@ -103,6 +108,7 @@ struct NetClientState {
     int vnet_hdr_len;
     bool is_netdev;
     bool do_not_pad; /* do not pad to the minimum ethernet frame length */
+    AioContext *ctx; /* where the datapath runs; NULL for the main loop */
     QTAILQ_HEAD(, NetFilterState) filters;
 };
 
@@ -162,6 +168,11 @@ ssize_t qemu_send_packet_raw(NetClientState *nc, const uint8_t *buf, int size);
 ssize_t qemu_send_packet_async(NetClientState *nc, const uint8_t *buf,
                                int size, NetPacketSent *sent_cb);
 void qemu_purge_queued_packets(NetClientState *nc);
+bool qemu_net_client_set_aio_context(NetClientState *nc, AioContext *ctx);
+void qemu_net_client_lock(NetClientState *nc);
+void qemu_net_client_unlock(NetClientState *nc);
+void qemu_send_batch_begin(NetClientState *nc);
+void qemu_send_batch_end(NetClientState *nc);
 void qemu_flush_queued_packets(NetClientState *nc);
 void qemu_flush_or_purge_queued_packets(NetClientState *nc, bool purge);
 void qemu_format_nic_info_str(NetClientState *nc, uint8_t macaddr[6]);
@@ -71,6 +71,18 @@ enum plugin_dyn_cb_subtype {
     PLUGIN_N_CB_SUBTYPES,
 };
 
+/*
+ * Per-vCPU storage. Generated code loads @data on every access, so that
+ * growing the scoreboard does not require flushing the code cache.
+ */
+struct qemu_plugin_scoreboard {
+    void *data;
+    size_t element_size;
+    /* distance between two vCPUs' elements, a multiple of the cache line */
+    size_t stride;
+    QLIST_ENTRY(qemu_plugin_scoreboard) entry;
+};
+
 /*
  * A dynamic callback has an insertion point that is determined at run-time.
  * Usually the insertion point is somewhere in the code cache; think for
@@ -87,6 +99,8 @@ struct qemu_plugin_dyn_cb {
         struct {
             enum qemu_plugin_op op;
             uint64_t imm;
+            /* per-vCPU target; @userp is used when entry.score is NULL */
+            qemu_plugin_u64 entry;
         } inline_insn;
     };
 };
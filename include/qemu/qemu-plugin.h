@@ -50,7 +50,7 @@ typedef uint64_t qemu_plugin_id_t;
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 1
+#define QEMU_PLUGIN_VERSION 2
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -273,14 +273,121 @@ void qemu_plugin_register_vcpu_tb_exec_cb(struct qemu_plugin_tb *tb,
  * enum qemu_plugin_op - describes an inline op
  *
  * @QEMU_PLUGIN_INLINE_ADD_U64: add an immediate value uint64_t
+ * @QEMU_PLUGIN_INLINE_STORE_U64: store an immediate value uint64_t
+ * @QEMU_PLUGIN_INLINE_STORE_VADDR: store the virtual address of the
+ * memory access as a uint64_t (memory callbacks only)
+ * @QEMU_PLUGIN_INLINE_STORE_MEMINFO: store the qemu_plugin_meminfo_t of
+ * the memory access as a uint64_t (memory callbacks only)
  *
- * Note: currently only a single inline op is supported.
+ * All inline ops write to a uint64_t in memory and are generated directly
+ * into the translated code, without calling back into the plugin.
  */
 
 enum qemu_plugin_op {
     QEMU_PLUGIN_INLINE_ADD_U64,
+    QEMU_PLUGIN_INLINE_STORE_U64,
+    QEMU_PLUGIN_INLINE_STORE_VADDR,
+    QEMU_PLUGIN_INLINE_STORE_MEMINFO,
 };
 
+/**
+ * struct qemu_plugin_scoreboard - per-vCPU storage
+ *
+ * A scoreboard holds one element per vCPU. Elements are padded to a
+ * host cache line so that vCPUs updating their own element do not
+ * share cache lines with each other. The storage is owned by QEMU and
+ * grows as vCPUs are created, so pointers returned by
+ * qemu_plugin_scoreboard_find() are only valid until the next vCPU
+ * is initialised.
+ */
+struct qemu_plugin_scoreboard;
+
+/**
+ * typedef qemu_plugin_u64 - uint64_t member of the elements of a scoreboard
+ * @score: the scoreboard
+ * @offset: offset of the uint64_t in the scoreboard element
+ *
+ * This is the target of the per-vCPU inline ops.
+ */
+typedef struct {
+    struct qemu_plugin_scoreboard *score;
+    size_t offset;
+} qemu_plugin_u64;
+
+/**
+ * qemu_plugin_scoreboard_new() - allocate a new scoreboard
+ * @element_size: size of each vCPU's element
+ *
+ * Returns: a scoreboard whose elements are all zero.
+ */
+struct qemu_plugin_scoreboard *qemu_plugin_scoreboard_new(size_t element_size);
+
+/**
+ * qemu_plugin_scoreboard_free() - free a scoreboard
+ * @score: scoreboard to free
+ *
+ * The scoreboard must not be the target of any inline op left in the
+ * code cache.
+ */
+void qemu_plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
+
+/**
+ * qemu_plugin_scoreboard_find() - get the element of a vCPU
+ * @score: scoreboard
+ * @vcpu_index: vCPU index
+ */
+void *qemu_plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                                  unsigned int vcpu_index);
+
+/* entry for a scoreboard of uint64_t */
+#define qemu_plugin_scoreboard_u64(score) \
+    ((qemu_plugin_u64) {score, 0})
+
+/* entry for a uint64_t member of a scoreboard of structs */
+#define qemu_plugin_scoreboard_u64_in_struct(score, type, member) \
+    ((qemu_plugin_u64) {score, offsetof(type, member)})
+
+/**
+ * qemu_plugin_u64_add() - add to the value of a vCPU's entry
+ * @entry: entry
+ * @vcpu_index: vCPU index
+ * @added: value to add
+ */
+void qemu_plugin_u64_add(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t added);
+
+/**
+ * qemu_plugin_u64_get() - get the value of a vCPU's entry
+ * @entry: entry
+ * @vcpu_index: vCPU index
+ */
+uint64_t qemu_plugin_u64_get(qemu_plugin_u64 entry, unsigned int vcpu_index);
+
+/**
+ * qemu_plugin_u64_set() - set the value of a vCPU's entry
+ * @entry: entry
+ * @vcpu_index: vCPU index
+ * @val: new value
+ */
+void qemu_plugin_u64_set(qemu_plugin_u64 entry, unsigned int vcpu_index,
+                         uint64_t val);
+
+/**
+ * qemu_plugin_u64_sum() - sum an entry over all vCPUs
+ * @entry: entry
+ *
+ * Merges the per-vCPU counters, typically from an atexit callback.
+ */
+uint64_t qemu_plugin_u64_sum(qemu_plugin_u64 entry);
+
+/**
+ * qemu_plugin_num_vcpus() - number of vCPUs that have been initialised
+ *
+ * Returns: one more than the highest vCPU index seen so far, i.e. the
+ * number of valid elements in a scoreboard.
+ */
+int qemu_plugin_num_vcpus(void);
+
 /**
  * qemu_plugin_register_vcpu_tb_exec_inline() - execution inline op
  * @tb: the opaque qemu_plugin_tb handle for the translation
@@ -299,6 +406,21 @@ void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
                                               enum qemu_plugin_op op,
                                               void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu() - per-vCPU inline op
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: the scoreboard entry updated by the op
+ * @imm: the op data (e.g. 1)
+ *
+ * Like qemu_plugin_register_vcpu_tb_exec_inline(), but the op targets
+ * the element of @entry that belongs to the executing vCPU, so the
+ * result is exact even with one thread per vCPU.
+ */
+void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+    struct qemu_plugin_tb *tb, enum qemu_plugin_op op,
+    qemu_plugin_u64 entry, uint64_t imm);
+
 /**
  * qemu_plugin_register_vcpu_insn_exec_cb() - register insn execution cb
  * @insn: the opaque qemu_plugin_insn handle for an instruction
@@ -327,6 +449,19 @@ void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
                                                 enum qemu_plugin_op op,
                                                 void *ptr, uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu() - per-vCPU inline op
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @entry: the scoreboard entry updated by the op
+ * @imm: the op data (e.g. 1)
+ *
+ * Per-vCPU variant of qemu_plugin_register_vcpu_insn_exec_inline().
+ */
+void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+    struct qemu_plugin_insn *insn, enum qemu_plugin_op op,
+    qemu_plugin_u64 entry, uint64_t imm);
+
 /**
  * qemu_plugin_tb_n_insns() - query helper for number of insns in TB
  * @tb: opaque handle to TB passed to callback
@@ -491,11 +626,41 @@ void qemu_plugin_register_vcpu_mem_cb(struct qemu_plugin_insn *insn,
                                       enum qemu_plugin_mem_rw rw,
                                       void *userdata);
 
+/**
+ * qemu_plugin_register_vcpu_mem_inline() - memory access inline op
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @rw: monitor reads, writes or both
+ * @op: the type of qemu_plugin_op
+ * @ptr: the target memory location for the op
+ * @imm: the op data (e.g. 1)
+ *
+ * Insert an inline op every time @insn accesses memory.  Besides
+ * counting accesses, QEMU_PLUGIN_INLINE_STORE_VADDR and
+ * QEMU_PLUGIN_INLINE_STORE_MEMINFO record the address and the size of the
+ * last access, which can then be read from an instruction callback.
+ *
+ * Note: ops are not atomic so in multi-threaded/multi-smp situations
+ * you will get inexact results.
+ */
 void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
                                           enum qemu_plugin_mem_rw rw,
                                           enum qemu_plugin_op op, void *ptr,
                                           uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_mem_inline_per_vcpu() - per-vCPU inline op
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @rw: monitor reads, writes or both
+ * @op: the type of qemu_plugin_op
+ * @entry: the scoreboard entry updated by the op
+ * @imm: the op data (e.g. 1)
+ *
+ * Per-vCPU variant of qemu_plugin_register_vcpu_mem_inline().
+ */
+void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+    struct qemu_plugin_insn *insn, enum qemu_plugin_mem_rw rw,
+    enum qemu_plugin_op op, qemu_plugin_u64 entry, uint64_t imm);
+
 
 
 typedef void
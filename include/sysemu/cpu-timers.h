@@ -37,6 +37,22 @@ extern int use_icount;
  */
 void icount_update(CPUState *cpu);
 
+/*
+ * Parallel icount, used with one thread per vCPU.  Each vCPU counts the
+ * instructions it runs in the current quantum, and QEMU_CLOCK_VIRTUAL
+ * only advances once every running vCPU has finished the quantum.
+ */
+#define ICOUNT_QUANTUM_DEFAULT 10000
+
+void icount_enable_parallel(void);
+bool icount_parallel_enabled(void);
+/* maximum number of instructions in a quantum */
+int64_t icount_quantum(void);
+/* whether -icount quantum was given; it needs parallel icount */
+bool icount_quantum_configured(void);
+/* advance the shared instruction counter at the end of a quantum */
+void icount_account_quantum(int64_t insns);
+
 /* get raw icount value */
 int64_t icount_get_raw(void);
 
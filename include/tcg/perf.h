@@ -0,0 +1,38 @@
+/*
+ * Linux perf perf-<pid>.map and jit-<pid>.dump integration.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef TCG_PERF_H
+#define TCG_PERF_H
+
+#ifdef CONFIG_LINUX
+/* Start writing perf-<pid>.map. */
+void perf_enable_perfmap(void);
+
+/* Start writing jit-<pid>.dump. */
+void perf_enable_jitdump(void);
+
+/* Add information about TCG prologue to profiler maps. */
+void perf_report_prologue(const void *start, size_t size);
+
+/*
+ * Add information about a TB to profiler maps.  @debug_info is true for a
+ * freshly generated TB, whose guest instructions tcg_ctx still describes.
+ */
+void perf_report_code(TranslationBlock *tb, bool debug_info);
+
+/* Stop writing perf-<pid>.map and jit-<pid>.dump. */
+void perf_exit(void);
+#else
+static inline void perf_report_prologue(const void *start, size_t size)
+{
+}
+
+static inline void perf_report_code(TranslationBlock *tb, bool debug_info)
+{
+}
+#endif
+
+#endif
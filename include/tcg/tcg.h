@@ -550,6 +550,9 @@ struct TCGContext {
 
     TCGRegSet reserved_regs;
     uint32_t tb_cflags; /* cflags of the current TB */
+    bool tb_has_host_ptr; /* current TB embeds a host pointer */
+    /* Blocks to chain into the current TB, see tb_gen_trace() */
+    const struct TranslatorTrace *trace;
     intptr_t current_frame_offset;
     intptr_t frame_start;
     intptr_t frame_end;
@@ -810,6 +813,10 @@ TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tb_destroy(TranslationBlock *tb);
 void tcg_region_reset_all(void);
+bool tcg_region_evict_enabled(void);
+bool tcg_region_has_free(void);
+size_t tcg_region_evict(GTraverseFunc evict_tb);
+void tcg_region_set_buffer_hint(void *hint);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -840,7 +847,7 @@ static inline void *tcg_malloc(int size)
     }
 }
 
-void tcg_init(size_t tb_size, int splitwx, unsigned max_cpus);
+void tcg_init(size_t tb_size, int splitwx, bool tb_evict, unsigned max_cpus);
 void tcg_register_thread(void);
 void tcg_prologue_init(TCGContext *s);
 void tcg_func_start(TCGContext *s);
@@ -1058,12 +1065,24 @@ static inline TCGv_i64 tcg_constant_i64(int64_t val)
 TCGv_vec tcg_constant_vec(TCGType type, unsigned vece, int64_t val);
 TCGv_vec tcg_constant_vec_matching(TCGv_vec match, unsigned vece, int64_t val);
 
+/*
+ * Host pointers make the generated code specific to this process, so
+ * keep track of them: such TBs cannot go to the persistent TB cache.
+ */
 #if UINTPTR_MAX == UINT32_MAX
-# define tcg_const_ptr(x)        ((TCGv_ptr)tcg_const_i32((intptr_t)(x)))
-# define tcg_const_local_ptr(x)  ((TCGv_ptr)tcg_const_local_i32((intptr_t)(x)))
+# define tcg_const_ptr(x)                                       \
+    (tcg_ctx->tb_has_host_ptr = true,                           \
+     (TCGv_ptr)tcg_const_i32((intptr_t)(x)))
+# define tcg_const_local_ptr(x)                                 \
+    (tcg_ctx->tb_has_host_ptr = true,                           \
+     (TCGv_ptr)tcg_const_local_i32((intptr_t)(x)))
 #else
-# define tcg_const_ptr(x)        ((TCGv_ptr)tcg_const_i64((intptr_t)(x)))
-# define tcg_const_local_ptr(x)  ((TCGv_ptr)tcg_const_local_i64((intptr_t)(x)))
+# define tcg_const_ptr(x)                                       \
+    (tcg_ctx->tb_has_host_ptr = true,                           \
+     (TCGv_ptr)tcg_const_i64((intptr_t)(x)))
+# define tcg_const_local_ptr(x)                                 \
+    (tcg_ctx->tb_has_host_ptr = true,                           \
+     (TCGv_ptr)tcg_const_local_i64((intptr_t)(x)))
 #endif
 
 TCGLabel *gen_new_label(void);
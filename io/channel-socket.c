@@ -26,6 +26,14 @@
 #include "io/channel-watch.h"
 #include "trace.h"
 #include "qapi/clone-visitor.h"
+#ifdef CONFIG_LINUX
+#include <linux/errqueue.h>
+#include <sys/socket.h>
+
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#define QEMU_MSG_ZEROCOPY
+#endif
+#endif
 
 #define SOCKET_MAX_FDS 16
 
@@ -55,6 +63,8 @@ qio_channel_socket_new(void)
 
     sioc = QIO_CHANNEL_SOCKET(object_new(TYPE_QIO_CHANNEL_SOCKET));
     sioc->fd = -1;
+    sioc->zero_copy_queued = 0;
+    sioc->zero_copy_sent = 0;
 
     ioc = QIO_CHANNEL(sioc);
     qio_channel_set_feature(ioc, QIO_CHANNEL_FEATURE_SHUTDOWN);
@@ -154,6 +164,22 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
         return -1;
     }
 
+#ifdef QEMU_MSG_ZEROCOPY
+    {
+        int v = 1;
+
+        /*
+         * SO_ZEROCOPY only allows MSG_ZEROCOPY to be used, it does not
+         * change plain sendmsg().  Older kernels and non-TCP sockets
+         * refuse it; just leave the feature off in that case.
+         */
+        if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)) == 0) {
+            qio_channel_set_feature(QIO_CHANNEL(ioc),
+                                    QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+        }
+    }
+#endif
+
     return 0;
 }
 
@@ -525,6 +551,7 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
                                          size_t niov,
                                          int *fds,
                                          size_t nfds,
+                                         int flags,
                                          Error **errp)
 {
     QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
@@ -533,6 +560,7 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
     char control[CMSG_SPACE(sizeof(int) * SOCKET_MAX_FDS)];
     size_t fdsize = sizeof(int) * nfds;
     struct cmsghdr *cmsg;
+    int sflags = 0;
 
     memset(control, 0, CMSG_SPACE(sizeof(int) * SOCKET_MAX_FDS));
 
@@ -557,8 +585,17 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
         memcpy(CMSG_DATA(cmsg), fds, fdsize);
     }
 
+    if (flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) {
+#ifdef QEMU_MSG_ZEROCOPY
+        sflags = MSG_ZEROCOPY;
+#else
+        /* Feature bit is never set without QEMU_MSG_ZEROCOPY */
+        g_assert_not_reached();
+#endif
+    }
+
  retry:
-    ret = sendmsg(sioc->fd, &msg, 0);
+    ret = sendmsg(sioc->fd, &msg, sflags);
     if (ret <= 0) {
         if (errno == EAGAIN) {
             return QIO_CHANNEL_ERR_BLOCK;
@@ -566,10 +603,20 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
         if (errno == EINTR) {
             goto retry;
         }
+        if (errno == ENOBUFS && (flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY)) {
+            error_setg_errno(errp, errno,
+                             "Process can't lock enough memory for "
+                             "zero copy writes");
+            return -1;
+        }
         error_setg_errno(errp, errno,
                          "Unable to write to socket");
         return -1;
     }
+
+    if (flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) {
+        sioc->zero_copy_queued++;
+    }
     return ret;
 }
 #else /* WIN32 */
@@ -620,6 +667,7 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
                                          size_t niov,
                                          int *fds,
                                          size_t nfds,
+                                         int flags,
                                          Error **errp)
 {
     QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
@@ -773,6 +821,81 @@ static GSource *qio_channel_socket_create_watch(QIOChannel *ioc,
                                            condition);
 }
 
+#ifdef QEMU_MSG_ZEROCOPY
+/*
+ * Each MSG_ZEROCOPY sendmsg() is numbered by the kernel; completions are
+ * reported on the socket error queue as ranges of those numbers, which
+ * may be coalesced.  Wait until all of the calls made so far completed.
+ */
+static int qio_channel_socket_flush(QIOChannel *ioc,
+                                    Error **errp)
+{
+    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
+    struct msghdr msg = { NULL, };
+    struct sock_extended_err *serr;
+    struct cmsghdr *cm;
+    char control[CMSG_SPACE(sizeof(*serr))];
+    int received;
+    int ret = 1;
+
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    while (sioc->zero_copy_sent < sioc->zero_copy_queued) {
+        memset(control, 0, sizeof(control));
+        msg.msg_controllen = sizeof(control);
+
+        received = recvmsg(sioc->fd, &msg, MSG_ERRQUEUE);
+        if (received < 0) {
+            if (errno == EAGAIN) {
+                /* Nothing completed yet */
+                qio_channel_wait(ioc, G_IO_ERR);
+                continue;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            error_setg_errno(errp, errno,
+                             "Unable to read socket error queue");
+            return -1;
+        }
+
+        cm = CMSG_FIRSTHDR(&msg);
+        if (!cm ||
+            !((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+              (cm->cmsg_level == SOL_IPV6 &&
+               cm->cmsg_type == IPV6_RECVERR))) {
+            error_setg_errno(errp, EPROTOTYPE,
+                             "Unexpected message on socket error queue");
+            return -1;
+        }
+
+        serr = (void *)CMSG_DATA(cm);
+        if (serr->ee_errno != 0) {
+            error_setg_errno(errp, serr->ee_errno,
+                             "Zero copy write failed");
+            return -1;
+        }
+        if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+            error_setg_errno(errp, EPROTOTYPE,
+                             "Unexpected origin on socket error queue");
+            return -1;
+        }
+
+        /* ee_info..ee_data is the range of completed sendmsg() calls */
+        sioc->zero_copy_sent += serr->ee_data - serr->ee_info + 1;
+
+        /* The kernel may have fallen back to copying, e.g. on loopback */
+        if (!(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)) {
+            ret = 0;
+        }
+    }
+
+    trace_qio_channel_socket_flush(sioc, sioc->zero_copy_sent, ret);
+    return ret;
+}
+#endif
+
 static void qio_channel_socket_class_init(ObjectClass *klass,
                                           void *class_data G_GNUC_UNUSED)
 {
@@ -787,6 +910,9 @@ static void qio_channel_socket_class_init(ObjectClass *klass,
     ioc_klass->io_set_delay = qio_channel_socket_set_delay;
     ioc_klass->io_create_watch = qio_channel_socket_create_watch;
     ioc_klass->io_set_aio_fd_handler = qio_channel_socket_set_aio_fd_handler;
+#ifdef QEMU_MSG_ZEROCOPY
+    ioc_klass->io_flush = qio_channel_socket_flush;
+#endif
 }
 
 static const TypeInfo qio_channel_socket_info = {
@@ -18,6 +18,8 @@
  */
 #include "qemu/osdep.h"
 #include "qemu.h"
+#include "exec/tb-cache.h"
+#include "tcg/perf.h"
 #ifdef CONFIG_GPROF
 #include <sys/gmon.h>
 #endif
@@ -36,4 +38,7 @@ void preexit_cleanup(CPUArchState *env, int code)
 #endif
         gdb_exit(code);
         qemu_plugin_atexit_cb();
+        tb_cache_save();
+        /* exit_group() does not run the atexit handlers */
+        perf_exit();
 }
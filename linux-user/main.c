@@ -39,6 +39,7 @@
 #include "qemu/module.h"
 #include "qemu/plugin.h"
 #include "exec/exec-all.h"
+#include "exec/tb-cache.h"
 #include "tcg/tcg.h"
 #include "qemu/timer.h"
 #include "qemu/envlist.h"
@@ -376,6 +377,31 @@ static void handle_arg_singlestep(const char *arg)
     singlestep = 1;
 }
 
+static bool enable_perfmap;
+static bool enable_jitdump;
+static const char *tb_cache_dir;
+static const char *tb_trace;
+
+static void handle_arg_perfmap(const char *arg)
+{
+    enable_perfmap = true;
+}
+
+static void handle_arg_jitdump(const char *arg)
+{
+    enable_jitdump = true;
+}
+
+static void handle_arg_tb_cache(const char *arg)
+{
+    tb_cache_dir = arg;
+}
+
+static void handle_arg_tb_trace(const char *arg)
+{
+    tb_trace = arg;
+}
+
 static void handle_arg_strace(const char *arg)
 {
     enable_strace = true;
@@ -458,6 +484,14 @@ static const struct qemu_argument arg_table[] = {
      "",           "log system calls"},
     {"seed",       "QEMU_RAND_SEED",   true,  handle_arg_seed,
      "",           "Seed for pseudo-random number generator"},
+    {"perfmap",    "QEMU_PERFMAP",     false, handle_arg_perfmap,
+     "",           "Generate a /tmp/perf-${pid}.map file for perf"},
+    {"jitdump",    "QEMU_JITDUMP",     false, handle_arg_jitdump,
+     "",           "Generate a jit-${pid}.dump file for perf"},
+    {"tb-cache",   "QEMU_TB_CACHE",    true,  handle_arg_tb_cache,
+     "dir",        "keep translated code in 'dir' across runs"},
+    {"tb-trace",   "QEMU_TB_TRACE",    true,  handle_arg_tb_trace,
+     "count",      "retranslate blocks run 'count' times as traces"},
     {"trace",      "QEMU_TRACE",       true,  handle_arg_trace,
      "",           "[[enable=]<pattern>][,events=<file>][,file=<file>]"},
 #ifdef CONFIG_PLUGIN
@@ -674,6 +708,15 @@ int main(int argc, char **argv, char **envp)
         exit(1);
     }
     trace_init_file();
+    if (tb_cache_dir && !QTAILQ_EMPTY(&plugins)) {
+        warn_report("-tb-cache is not supported with plugins, ignoring it");
+        tb_cache_dir = NULL;
+    }
+    /* The execution counters of -tb-trace are process-specific pointers */
+    if (tb_cache_dir && tb_trace) {
+        error_report("-tb-cache cannot be used together with -tb-trace");
+        exit(EXIT_FAILURE);
+    }
     qemu_plugin_load_list(&plugins, &error_fatal);
 
     /* Zero out regs */
@@ -720,11 +763,24 @@ int main(int argc, char **argv, char **envp)
     }
     cpu_type = parse_cpu_option(cpu_model);
 
+    if (tb_cache_dir) {
+        tb_cache_open(tb_cache_dir, exec_path, cpu_type);
+    }
+
     /* init tcg before creating CPUs and to get qemu_host_page_size */
     {
-        AccelClass *ac = ACCEL_GET_CLASS(current_accel());
+        AccelState *accel = current_accel();
+        AccelClass *ac = ACCEL_GET_CLASS(accel);
 
         accel_init_interfaces(ac);
+        object_property_set_bool(OBJECT(accel), "perfmap",
+                                 enable_perfmap, &error_abort);
+        object_property_set_bool(OBJECT(accel), "jitdump",
+                                 enable_jitdump, &error_abort);
+        if (tb_trace) {
+            object_property_parse(OBJECT(accel), "tb-trace", tb_trace,
+                                  &error_fatal);
+        }
         ac->init_machine(NULL);
     }
     cpu = cpu_create(cpu_type);
@@ -868,6 +924,7 @@ int main(int argc, char **argv, char **envp)
        generating the prologue until now so that the prologue can take
        the real value of GUEST_BASE into account.  */
     tcg_prologue_init(tcg_ctx);
+    tb_cache_start();
 
     target_cpu_copy_regs(env, regs);
 
@@ -0,0 +1,307 @@
+/*
+ * Multifd lz4 compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <lz4.h>
+#include "qemu/rcu.h"
+#include "qemu/cutils.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "trace.h"
+#include "multifd.h"
+
+/*
+ * Packet layout
+ *
+ * Unlike zlib and zstd, lz4 compresses each page on its own so that zero
+ * pages and incompressible pages can be handled without running them
+ * through the compressor.  The packet starts with one big endian uint32_t
+ * per page giving the size of that page's data, followed by the data of
+ * all pages back to back.  A size of 0 means a zero page (no data), a size
+ * of qemu_target_page_size() means the page is stored uncompressed, and
+ * anything else is an lz4 block.
+ */
+
+struct lz4_data {
+    /* lz4 compression state, see LZ4_sizeofState() */
+    void *state;
+    /* compressed buffer */
+    uint8_t *zbuff;
+    /* size of compressed buffer */
+    uint32_t zbuff_len;
+};
+
+/* Multifd lz4 compression */
+
+static uint32_t lz4_zbuff_len(void)
+{
+    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+
+    /*
+     * We will never have more than page_count pages, and no page takes
+     * more than page size bytes
+     */
+    return page_count * (sizeof(uint32_t) + qemu_target_page_size());
+}
+
+/**
+ * lz4_send_setup: setup send side
+ *
+ * Setup each channel with lz4 compression.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    p->data = z;
+    z->state = g_try_malloc(LZ4_sizeofState());
+    z->zbuff_len = lz4_zbuff_len();
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->state || !z->zbuff) {
+        g_free(z->state);
+        g_free(z->zbuff);
+        g_free(z);
+        p->data = NULL;
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * lz4_send_cleanup: cleanup send side
+ *
+ * Close the channel and return memory.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void lz4_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = p->data;
+
+    g_free(z->state);
+    z->state = NULL;
+    g_free(z->zbuff);
+    z->zbuff = NULL;
+    g_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * lz4_send_prepare: prepare date to be able to send
+ *
+ * Create a compressed buffer with all the pages that we are going to
+ * send.  Zero pages are detected here, in the channel thread, and take
+ * no space besides their entry in the size table.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ */
+static int lz4_send_prepare(MultiFDSendParams *p, uint32_t used, Error **errp)
+{
+    struct iovec *iov = p->pages->iov;
+    struct lz4_data *z = p->data;
+    uint32_t page_size = qemu_target_page_size();
+    uint32_t *sizes = (uint32_t *)z->zbuff;
+    uint8_t *out = z->zbuff + used * sizeof(uint32_t);
+    uint32_t i;
+
+    for (i = 0; i < used; i++) {
+        uint8_t *page = iov[i].iov_base;
+        int len;
+
+        if (buffer_is_zero(page, page_size)) {
+            sizes[i] = 0;
+            continue;
+        }
+
+        /*
+         * Give lz4 one byte less than a page so that it bails out early
+         * instead of producing output that is bigger than the input.
+         */
+        len = LZ4_compress_fast_extState(z->state, (const char *)page,
+                                         (char *)out, page_size,
+                                         page_size - 1, 1);
+        if (len <= 0) {
+            memcpy(out, page, page_size);
+            len = page_size;
+        }
+        sizes[i] = cpu_to_be32(len);
+        out += len;
+    }
+    p->next_packet_size = out - z->zbuff;
+    p->flags |= MULTIFD_FLAG_LZ4;
+
+    return 0;
+}
+
+/**
+ * lz4_send_write: do the actual write of the data
+ *
+ * Do the actual write of the comprresed buffer.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int lz4_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
+{
+    struct lz4_data *z = p->data;
+
+    return qio_channel_write_all(p->c, (void *)z->zbuff, p->next_packet_size,
+                                 errp);
+}
+
+/**
+ * lz4_recv_setup: setup receive side
+ *
+ * Create the compressed buffer.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    p->data = z;
+    z->zbuff_len = lz4_zbuff_len();
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        g_free(z);
+        p->data = NULL;
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * lz4_recv_cleanup: setup receive side
+ *
+ * Return the memory of the compressed buffer.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void lz4_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct lz4_data *z = p->data;
+
+    g_free(z->zbuff);
+    z->zbuff = NULL;
+    g_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * lz4_recv_pages: read the data from the channel into actual pages
+ *
+ * Read the compressed buffer, and uncompress it into the actual
+ * pages.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int lz4_recv_pages(MultiFDRecvParams *p, uint32_t used, Error **errp)
+{
+    uint32_t in_size = p->next_packet_size;
+    uint32_t page_size = qemu_target_page_size();
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    struct lz4_data *z = p->data;
+    uint32_t *sizes = (uint32_t *)z->zbuff;
+    uint8_t *in;
+    uint32_t remaining;
+    uint32_t i;
+    int ret;
+
+    if (flags != MULTIFD_FLAG_LZ4) {
+        error_setg(errp, "multifd %d: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_LZ4);
+        return -1;
+    }
+    if (in_size > z->zbuff_len || in_size < used * sizeof(uint32_t)) {
+        error_setg(errp, "multifd %d: packet size received %u is invalid "
+                   "for %u pages", p->id, in_size, used);
+        return -1;
+    }
+    ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    in = z->zbuff + used * sizeof(uint32_t);
+    remaining = in_size - used * sizeof(uint32_t);
+
+    for (i = 0; i < used; i++) {
+        uint8_t *page = p->pages->iov[i].iov_base;
+        uint32_t len = be32_to_cpu(sizes[i]);
+
+        if (len > remaining || len > page_size) {
+            error_setg(errp, "multifd %d: page %u size %u is invalid",
+                       p->id, i, len);
+            return -1;
+        }
+
+        if (len == 0) {
+            /* Avoid touching (and allocating) pages that are already zero */
+            if (!buffer_is_zero(page, page_size)) {
+                memset(page, 0, page_size);
+            }
+        } else if (len == page_size) {
+            memcpy(page, in, page_size);
+        } else {
+            ret = LZ4_decompress_safe((const char *)in, (char *)page, len,
+                                      page_size);
+            if (ret != page_size) {
+                error_setg(errp, "multifd %d: decompress of page %u "
+                           "returned %d", p->id, i, ret);
+                return -1;
+            }
+        }
+        in += len;
+        remaining -= len;
+    }
+    if (remaining) {
+        error_setg(errp, "multifd %d: %u trailing bytes in packet",
+                   p->id, remaining);
+        return -1;
+    }
+    return 0;
+}
+
+static MultiFDMethods multifd_lz4_ops = {
+    .send_setup = lz4_send_setup,
+    .send_cleanup = lz4_send_cleanup,
+    .send_prepare = lz4_send_prepare,
+    .send_write = lz4_send_write,
+    .recv_setup = lz4_recv_setup,
+    .recv_cleanup = lz4_recv_cleanup,
+    .recv_pages = lz4_recv_pages
+};
+
+static void multifd_lz4_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_LZ4, &multifd_lz4_ops);
+}
+
+migration_init(multifd_lz4_register);
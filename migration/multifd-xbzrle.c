@@ -0,0 +1,416 @@
+/*
+ * Multifd XBZRLE implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/rcu.h"
+#include "qemu/cutils.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "ram.h"
+#include "trace.h"
+#include "multifd.h"
+#include "page_cache.h"
+#include "xbzrle.h"
+
+/*
+ * Packet layout
+ *
+ * The packet starts with one big endian uint32_t per page.  The top
+ * byte gives the encoding of the page and the low 24 bits the size of
+ * its data; the data of all pages follows back to back.
+ *
+ * The sender keeps a copy of every page it sent in a page cache that
+ * is shared by all channels, and sends the XBZRLE delta between that
+ * copy and the current contents.  The destination applies the delta on
+ * top of the page it already has.  This only works because a page is
+ * never queued on two channels between two multifd syncs, so the
+ * destination always sees the previous version of a page before the
+ * delta against it.
+ */
+
+#define XBZRLE_PAGE_ZERO  0
+#define XBZRLE_PAGE_RAW   1
+#define XBZRLE_PAGE_DELTA 2
+
+#define XBZRLE_PAGE_TYPE_SHIFT 24
+#define XBZRLE_PAGE_LEN_MASK ((1 << XBZRLE_PAGE_TYPE_SHIFT) - 1)
+
+/* The cache is shared by all send channels */
+static struct {
+    PageCache *cache;
+    uint8_t *zero_page;
+    int refcount;
+} multifd_xbzrle;
+
+struct xbzrle_data {
+    /* copy of the page being sent, the guest may change it under us */
+    uint8_t *page;
+    /* packet buffer */
+    uint8_t *zbuff;
+    /* size of packet buffer */
+    uint32_t zbuff_len;
+};
+
+static uint32_t xbzrle_zbuff_len(void)
+{
+    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+
+    /*
+     * We will never have more than page_count pages, and no page takes
+     * more than page size bytes
+     */
+    return page_count * (sizeof(uint32_t) + qemu_target_page_size());
+}
+
+/* Multifd XBZRLE */
+
+/**
+ * xbzrle_send_setup: setup send side
+ *
+ * Setup each channel with XBZRLE encoding, the first channel also
+ * creates the shared page cache.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *z;
+
+    if (!multifd_xbzrle.refcount) {
+        multifd_xbzrle.cache = cache_init(migrate_xbzrle_cache_size(),
+                                          qemu_target_page_size(), errp);
+        if (!multifd_xbzrle.cache) {
+            return -1;
+        }
+        multifd_xbzrle.zero_page = g_malloc0(qemu_target_page_size());
+    }
+    multifd_xbzrle.refcount++;
+
+    z = g_new0(struct xbzrle_data, 1);
+    p->data = z;
+    z->page = g_malloc(qemu_target_page_size());
+    z->zbuff_len = xbzrle_zbuff_len();
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * xbzrle_send_cleanup: cleanup send side
+ *
+ * Return the memory of the channel, the last channel also frees the
+ * shared page cache.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void xbzrle_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *z = p->data;
+
+    if (!z) {
+        return;
+    }
+
+    g_free(z->page);
+    g_free(z->zbuff);
+    g_free(p->data);
+    p->data = NULL;
+
+    if (!--multifd_xbzrle.refcount) {
+        cache_fini(multifd_xbzrle.cache);
+        multifd_xbzrle.cache = NULL;
+        g_free(multifd_xbzrle.zero_page);
+        multifd_xbzrle.zero_page = NULL;
+    }
+}
+
+/**
+ * xbzrle_encode_page: encode one page against the cache
+ *
+ * Returns the page type and size, as stored in the packet
+ *
+ * @page: copy of the page contents
+ * @addr: ram_addr_t of the page, used as the cache key
+ * @out: where to store the page data
+ */
+static uint32_t xbzrle_encode_page(uint8_t *page, uint64_t addr,
+                                   uint8_t *out)
+{
+    PageCache *cache = multifd_xbzrle.cache;
+    uint32_t page_size = qemu_target_page_size();
+    /*
+     * Racy read, but it is only updated by the migration thread during
+     * a bitmap sync and a stale value just makes eviction less precise
+     */
+    uint64_t age = ram_counters.dirty_sync_count;
+    uint32_t type;
+    uint8_t *cached;
+    int len;
+
+    if (buffer_is_zero(page, page_size)) {
+        /*
+         * Replace a stale copy of the page.  We don't care if this fails
+         * to allocate a new cache page as long as it updated an old one
+         */
+        cache_lock(cache, addr);
+        cache_insert(cache, addr, multifd_xbzrle.zero_page, age);
+        cache_unlock(cache, addr);
+        return XBZRLE_PAGE_ZERO << XBZRLE_PAGE_TYPE_SHIFT;
+    }
+
+    cache_lock(cache, addr);
+    if (!cache_is_cached(cache, addr, age)) {
+        cache_insert(cache, addr, page, age);
+        memcpy(out, page, page_size);
+        type = XBZRLE_PAGE_RAW;
+        len = page_size;
+    } else {
+        cached = get_cached_data(cache, addr);
+        /* Bail out if the delta is not smaller than the page itself */
+        len = xbzrle_encode_buffer(cached, page, page_size, out,
+                                   page_size - 1);
+        if (len < 0) {
+            memcpy(out, page, page_size);
+            type = XBZRLE_PAGE_RAW;
+            len = page_size;
+        } else {
+            type = XBZRLE_PAGE_DELTA;
+        }
+        if (len) {
+            memcpy(cached, page, page_size);
+        }
+    }
+    cache_unlock(cache, addr);
+
+    return type << XBZRLE_PAGE_TYPE_SHIFT | len;
+}
+
+/**
+ * xbzrle_send_prepare: prepare date to be able to send
+ *
+ * Create a buffer with the encoding of all the pages that we are going
+ * to send.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_prepare(MultiFDSendParams *p, uint32_t used,
+                               Error **errp)
+{
+    struct iovec *iov = p->pages->iov;
+    struct xbzrle_data *z = p->data;
+    RAMBlock *block = p->pages->block;
+    uint32_t page_size = qemu_target_page_size();
+    uint32_t *sizes = (uint32_t *)z->zbuff;
+    uint8_t *out = z->zbuff + used * sizeof(uint32_t);
+    uint32_t i, entry;
+
+    for (i = 0; i < used; i++) {
+        uint8_t *host = iov[i].iov_base;
+
+        /* Encode from a copy, so that the cache matches what we send */
+        memcpy(z->page, host, page_size);
+        entry = xbzrle_encode_page(z->page,
+                                   block->offset + (host - block->host), out);
+        sizes[i] = cpu_to_be32(entry);
+        out += entry & XBZRLE_PAGE_LEN_MASK;
+    }
+    p->next_packet_size = out - z->zbuff;
+    p->flags |= MULTIFD_FLAG_XBZRLE;
+
+    return 0;
+}
+
+/**
+ * xbzrle_send_write: do the actual write of the data
+ *
+ * Do the actual write of the encoded buffer.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_write(MultiFDSendParams *p, uint32_t used,
+                             Error **errp)
+{
+    struct xbzrle_data *z = p->data;
+
+    return qio_channel_write_all(p->c, (void *)z->zbuff, p->next_packet_size,
+                                 errp);
+}
+
+/**
+ * xbzrle_recv_setup: setup receive side
+ *
+ * Create the packet buffer.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *z = g_new0(struct xbzrle_data, 1);
+
+    p->data = z;
+    z->zbuff_len = xbzrle_zbuff_len();
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        g_free(z);
+        p->data = NULL;
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * xbzrle_recv_cleanup: setup receive side
+ *
+ * Return the memory of the packet buffer.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void xbzrle_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct xbzrle_data *z = p->data;
+
+    g_free(z->zbuff);
+    z->zbuff = NULL;
+    g_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * xbzrle_recv_pages: read the data from the channel into actual pages
+ *
+ * Read the packet, and apply each page on top of the current contents
+ * of the destination page.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_pages(MultiFDRecvParams *p, uint32_t used,
+                             Error **errp)
+{
+    uint32_t in_size = p->next_packet_size;
+    uint32_t page_size = qemu_target_page_size();
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    struct xbzrle_data *z = p->data;
+    uint32_t *sizes = (uint32_t *)z->zbuff;
+    uint8_t *in;
+    uint32_t remaining;
+    uint32_t i;
+    int ret;
+
+    if (flags != MULTIFD_FLAG_XBZRLE) {
+        error_setg(errp, "multifd %d: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_XBZRLE);
+        return -1;
+    }
+    if (in_size > z->zbuff_len || in_size < used * sizeof(uint32_t)) {
+        error_setg(errp, "multifd %d: packet size received %u is invalid "
+                   "for %u pages", p->id, in_size, used);
+        return -1;
+    }
+    ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    in = z->zbuff + used * sizeof(uint32_t);
+    remaining = in_size - used * sizeof(uint32_t);
+
+    for (i = 0; i < used; i++) {
+        uint8_t *page = p->pages->iov[i].iov_base;
+        uint32_t entry = be32_to_cpu(sizes[i]);
+        uint32_t type = entry >> XBZRLE_PAGE_TYPE_SHIFT;
+        uint32_t len = entry & XBZRLE_PAGE_LEN_MASK;
+
+        if (len > remaining) {
+            error_setg(errp, "multifd %d: page %u size %u is invalid",
+                       p->id, i, len);
+            return -1;
+        }
+
+        switch (type) {
+        case XBZRLE_PAGE_ZERO:
+            if (len) {
+                error_setg(errp, "multifd %d: zero page %u has size %u",
+                           p->id, i, len);
+                return -1;
+            }
+            /* Avoid touching (and allocating) pages that are already zero */
+            if (!buffer_is_zero(page, page_size)) {
+                memset(page, 0, page_size);
+            }
+            break;
+        case XBZRLE_PAGE_RAW:
+            if (len != page_size) {
+                error_setg(errp, "multifd %d: raw page %u has size %u",
+                           p->id, i, len);
+                return -1;
+            }
+            memcpy(page, in, page_size);
+            break;
+        case XBZRLE_PAGE_DELTA:
+            if (len && xbzrle_decode_buffer(in, len, page, page_size) < 0) {
+                error_setg(errp, "multifd %d: failed to decode page %u",
+                           p->id, i);
+                return -1;
+            }
+            break;
+        default:
+            error_setg(errp, "multifd %d: page %u has unknown type %u",
+                       p->id, i, type);
+            return -1;
+        }
+        in += len;
+        remaining -= len;
+    }
+    if (remaining) {
+        error_setg(errp, "multifd %d: %u trailing bytes in packet",
+                   p->id, remaining);
+        return -1;
+    }
+    return 0;
+}
+
+static MultiFDMethods multifd_xbzrle_ops = {
+    .send_setup = xbzrle_send_setup,
+    .send_cleanup = xbzrle_send_cleanup,
+    .send_prepare = xbzrle_send_prepare,
+    .send_write = xbzrle_send_write,
+    .recv_setup = xbzrle_recv_setup,
+    .recv_cleanup = xbzrle_recv_cleanup,
+    .recv_pages = xbzrle_recv_pages
+};
+
+static void multifd_xbzrle_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_XBZRLE, &multifd_xbzrle_ops);
+}
+
+migration_init(multifd_xbzrle_register);
@@ -11,6 +11,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/cutils.h"
 #include "qemu/rcu.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
@@ -105,7 +106,8 @@ static int nocomp_send_prepare(MultiFDSendParams *p, uint32_t used,
  */
 static int nocomp_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
 {
-    return qio_channel_writev_all(p->c, p->pages->iov, used, errp);
+    return qio_channel_writev_full_all(p->c, p->pages->iov, used, NULL, 0,
+                                       p->write_flags, errp);
 }
 
 /**
@@ -239,6 +241,28 @@ static int multifd_recv_initial_packet(QIOChannel *c, Error **errp)
     return msg.id;
 }
 
+/*
+ * Size of a packet for @page_count pages.  With multifd-zero-page the
+ * offsets are followed by a zero page bitmap.
+ */
+static uint32_t multifd_packet_len(uint32_t page_count, bool zero_page)
+{
+    uint32_t len = sizeof(MultiFDPacket_t) + sizeof(uint64_t) * page_count;
+
+    if (zero_page) {
+        len += sizeof(uint64_t) * DIV_ROUND_UP(page_count, 64);
+    }
+    return len;
+}
+
+static uint64_t *multifd_packet_zero_bitmap(MultiFDPacket_t *packet)
+{
+    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+
+    return (uint64_t *)((uint8_t *)packet + sizeof(MultiFDPacket_t) +
+                        sizeof(uint64_t) * page_count);
+}
+
 static MultiFDPages_t *multifd_pages_init(size_t size)
 {
     MultiFDPages_t *pages = g_new0(MultiFDPages_t, 1);
@@ -290,6 +314,7 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
 {
     MultiFDPacket_t *packet = p->packet;
     uint32_t pages_max = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+    bool zero_page = migrate_multifd_zero_page();
     RAMBlock *block;
     int i;
 
@@ -339,8 +364,28 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    if (zero_page) {
+        if (!(p->flags & MULTIFD_FLAG_ZERO_PAGE)) {
+            error_setg(errp, "multifd: received packet without zero page "
+                       "bitmap, is multifd-zero-page enabled on the source?");
+            return -1;
+        }
+        if (p->pages->used > pages_max) {
+            error_setg(errp, "multifd: received packet with %d pages and "
+                       "zero page bitmap for %d pages",
+                       p->pages->used, pages_max);
+            return -1;
+        }
+    } else if (p->flags & MULTIFD_FLAG_ZERO_PAGE) {
+        error_setg(errp, "multifd: received packet with zero page bitmap, "
+                   "is multifd-zero-page enabled on the destination?");
+        return -1;
+    }
+
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
+    p->normal_num = 0;
+    p->zero_num = 0;
 
     if (p->pages->used == 0) {
         return 0;
@@ -364,8 +409,17 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
                        offset, block->used_length);
             return -1;
         }
-        p->pages->iov[i].iov_base = block->host + offset;
-        p->pages->iov[i].iov_len = qemu_target_page_size();
+        if (zero_page) {
+            uint64_t *bitmap = multifd_packet_zero_bitmap(packet);
+
+            if (ldq_be_p(&bitmap[i / 64]) & (1ULL << (i % 64))) {
+                p->zero[p->zero_num++] = block->host + offset;
+                continue;
+            }
+        }
+        p->pages->iov[p->normal_num].iov_base = block->host + offset;
+        p->pages->iov[p->normal_num].iov_len = qemu_target_page_size();
+        p->normal_num++;
     }
 
     return 0;
@@ -385,6 +439,8 @@ struct {
      * We will use atomic operations.  Only valid values are 0 and 1.
      */
     int exiting;
+    /* zero pages are detected by the channels, see multifd-zero-page */
+    bool zero_page;
     /* multifd ops */
     MultiFDMethods *ops;
 } *multifd_send_state;
@@ -407,6 +463,25 @@ struct {
  * false.
  */
 
+/*
+ * Move the zero pages found by channel @p from the normal to the duplicate
+ * page counter.  multifd_send_pages() charged them as full pages, but only
+ * their offset and bitmap bit, both part of p->packet_len, went out, so
+ * take their data back out of the transferred bytes.  Called from the
+ * migration thread with p->mutex held.
+ */
+static void multifd_send_account_zero_pages(QEMUFile *f, MultiFDSendParams *p)
+{
+    uint64_t zero_bytes = p->zero_pages_pending * qemu_target_page_size();
+
+    ram_counters.duplicate += p->zero_pages_pending;
+    ram_counters.normal -= p->zero_pages_pending;
+    qemu_file_update_transfer(f, -(int64_t)zero_bytes);
+    ram_counters.multifd_bytes -= zero_bytes;
+    ram_counters.transferred -= zero_bytes;
+    p->zero_pages_pending = 0;
+}
+
 static int multifd_send_pages(QEMUFile *f)
 {
     int i;
@@ -446,6 +521,7 @@ static int multifd_send_pages(QEMUFile *f)
     assert(!p->pages->block);
 
     p->packet_num = multifd_send_state->packet_num++;
+    multifd_send_account_zero_pages(f, p);
     multifd_send_state->pages = p->pages;
     p->pages = pages;
     transferred = ((uint64_t) pages->used) * qemu_target_page_size()
@@ -615,10 +691,54 @@ void multifd_send_sync_main(QEMUFile *f)
 
         trace_multifd_send_sync_main_wait(p->id);
         qemu_sem_wait(&p->sem_sync);
+
+        qemu_mutex_lock(&p->mutex);
+        multifd_send_account_zero_pages(f, p);
+        qemu_mutex_unlock(&p->mutex);
     }
     trace_multifd_send_sync_main(multifd_send_state->packet_num);
 }
 
+/**
+ * multifd_send_zero_pages: find the zero pages of a packet
+ *
+ * Zero pages are marked in the zero page bitmap of the packet and removed
+ * from p->pages->iov, so that the compression methods only see the pages
+ * whose data has to be sent.  p->pages->offset is left untouched, the
+ * receiver needs the offsets of all pages.
+ *
+ * Returns the number of pages left in p->pages->iov
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ */
+static uint32_t multifd_send_zero_pages(MultiFDSendParams *p, uint32_t used)
+{
+    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+    uint64_t *bitmap = multifd_packet_zero_bitmap(p->packet);
+    struct iovec *iov = p->pages->iov;
+    uint32_t normal = 0;
+    uint64_t word = 0;
+    uint32_t i;
+
+    memset(bitmap, 0, sizeof(uint64_t) * DIV_ROUND_UP(page_count, 64));
+
+    for (i = 0; i < used; i++) {
+        if (buffer_is_zero(iov[i].iov_base, iov[i].iov_len)) {
+            word |= 1ULL << (i % 64);
+        } else {
+            iov[normal++] = iov[i];
+        }
+        if (i % 64 == 63 || i == used - 1) {
+            stq_be_p(&bitmap[i / 64], word);
+            word = 0;
+        }
+    }
+    p->zero_pages_pending += used - normal;
+
+    return normal;
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
@@ -629,6 +749,17 @@ static void *multifd_send_thread(void *opaque)
     trace_multifd_send_thread_start(p->id);
     rcu_register_thread();
 
+    if (migrate_zero_copy_send()) {
+        if (!qio_channel_has_feature(p->c,
+                                     QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+            error_setg(&local_err, "multifd channel %d does not support "
+                       "zero-copy-send", p->id);
+            ret = -1;
+            goto out;
+        }
+        p->write_flags = QIO_CHANNEL_WRITE_FLAG_ZERO_COPY;
+    }
+
     if (multifd_send_initial_packet(p, &local_err) < 0) {
         ret = -1;
         goto out;
@@ -646,16 +777,24 @@ static void *multifd_send_thread(void *opaque)
 
         if (p->pending_job) {
             uint32_t used = p->pages->used;
+            uint32_t normal = used;
             uint64_t packet_num = p->packet_num;
+
+            if (multifd_send_state->zero_page) {
+                p->flags |= MULTIFD_FLAG_ZERO_PAGE;
+                normal = multifd_send_zero_pages(p, used);
+            }
             flags = p->flags;
 
-            if (used) {
-                ret = multifd_send_state->ops->send_prepare(p, used,
+            if (normal) {
+                ret = multifd_send_state->ops->send_prepare(p, normal,
                                                             &local_err);
                 if (ret != 0) {
                     qemu_mutex_unlock(&p->mutex);
                     break;
                 }
+            } else {
+                p->next_packet_size = 0;
             }
             multifd_send_fill_packet(p);
             p->flags = 0;
@@ -674,13 +813,28 @@ static void *multifd_send_thread(void *opaque)
                 break;
             }
 
-            if (used) {
-                ret = multifd_send_state->ops->send_write(p, used, &local_err);
+            if (normal) {
+                ret = multifd_send_state->ops->send_write(p, normal,
+                                                          &local_err);
                 if (ret != 0) {
                     break;
                 }
             }
 
+            /*
+             * Guest pages sent without copying may still be read by the
+             * kernel; make sure they are on the wire before the sync
+             * point completes.
+             */
+            if ((flags & MULTIFD_FLAG_SYNC) && p->write_flags) {
+                ret = qio_channel_flush(p->c, &local_err);
+                if (ret < 0) {
+                    break;
+                }
+                trace_multifd_send_flush(p->id, ret);
+                ret = 0;
+            }
+
             qemu_mutex_lock(&p->mutex);
             p->pending_job--;
             qemu_mutex_unlock(&p->mutex);
@@ -881,6 +1035,7 @@ int multifd_save_setup(Error **errp)
     multifd_send_state->pages = multifd_pages_init(page_count);
     qemu_sem_init(&multifd_send_state->channels_ready, 0);
     qatomic_set(&multifd_send_state->exiting, 0);
+    multifd_send_state->zero_page = migrate_multifd_zero_page();
     multifd_send_state->ops = multifd_ops[migrate_multifd_compression()];
 
     for (i = 0; i < thread_count; i++) {
@@ -893,8 +1048,8 @@ int multifd_save_setup(Error **errp)
         p->pending_job = 0;
         p->id = i;
         p->pages = multifd_pages_init(page_count);
-        p->packet_len = sizeof(MultiFDPacket_t)
-                      + sizeof(uint64_t) * page_count;
+        p->packet_len = multifd_packet_len(page_count,
+                                           multifd_send_state->zero_page);
         p->packet = g_malloc0(p->packet_len);
         p->packet->magic = cpu_to_be32(MULTIFD_MAGIC);
         p->packet->version = cpu_to_be32(MULTIFD_VERSION);
@@ -1003,6 +1158,8 @@ int multifd_load_cleanup(Error **errp)
         p->name = NULL;
         multifd_pages_clear(p->pages);
         p->pages = NULL;
+        g_free(p->zero);
+        p->zero = NULL;
         p->packet_len = 0;
         g_free(p->packet);
         p->packet = NULL;
@@ -1044,6 +1201,26 @@ void multifd_recv_sync_main(void)
     trace_multifd_recv_sync_main(multifd_recv_state->packet_num);
 }
 
+/**
+ * multifd_recv_zero_pages: clear the zero pages of a packet
+ *
+ * Pages that are already zero are not written, so that they are not
+ * allocated on the destination just to be filled with zeroes.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void multifd_recv_zero_pages(MultiFDRecvParams *p)
+{
+    size_t page_size = qemu_target_page_size();
+    uint32_t i;
+
+    for (i = 0; i < p->zero_num; i++) {
+        if (!buffer_is_zero(p->zero[i], page_size)) {
+            memset(p->zero[i], 0, page_size);
+        }
+    }
+}
+
 static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
@@ -1055,6 +1232,7 @@ static void *multifd_recv_thread(void *opaque)
 
     while (true) {
         uint32_t used;
+        uint32_t normal;
         uint32_t flags;
 
         if (p->quit) {
@@ -1078,6 +1256,7 @@ static void *multifd_recv_thread(void *opaque)
         }
 
         used = p->pages->used;
+        normal = p->normal_num;
         flags = p->flags;
         /* recv methods don't know how to handle the SYNC flag */
         p->flags &= ~MULTIFD_FLAG_SYNC;
@@ -1087,12 +1266,13 @@ static void *multifd_recv_thread(void *opaque)
         p->num_pages += used;
         qemu_mutex_unlock(&p->mutex);
 
-        if (used) {
-            ret = multifd_recv_state->ops->recv_pages(p, used, &local_err);
+        if (normal) {
+            ret = multifd_recv_state->ops->recv_pages(p, normal, &local_err);
             if (ret != 0) {
                 break;
             }
         }
+        multifd_recv_zero_pages(p);
 
         if (flags & MULTIFD_FLAG_SYNC) {
             qemu_sem_post(&multifd_recv_state->sem_sync);
@@ -1138,8 +1318,9 @@ int multifd_load_setup(Error **errp)
         p->quit = false;
         p->id = i;
         p->pages = multifd_pages_init(page_count);
-        p->packet_len = sizeof(MultiFDPacket_t)
-                      + sizeof(uint64_t) * page_count;
+        p->zero = g_new0(uint8_t *, page_count);
+        p->packet_len = multifd_packet_len(page_count,
+                                           migrate_multifd_zero_page());
         p->packet = g_malloc0(p->packet_len);
         p->name = g_strdup_printf("multifdrecv_%d", i);
     }
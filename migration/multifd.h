@@ -32,6 +32,14 @@ int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_LZ4 (3 << 1)
+#define MULTIFD_FLAG_XBZRLE (4 << 1)
+
+/*
+ * The packet carries a zero page bitmap after the offsets, see
+ * multifd-zero-page capability
+ */
+#define MULTIFD_FLAG_ZERO_PAGE (1 << 4)
 
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
@@ -48,6 +56,12 @@ typedef struct {
     uint64_t packet_num;
     uint64_t unused[4];    /* Reserved for future use */
     char ramblock[256];
+    /*
+     * pages_alloc offsets.  With MULTIFD_FLAG_ZERO_PAGE they are followed
+     * by a big endian bitmap of pages_alloc bits, stored as uint64_t, where
+     * a set bit means that the page at the same index is a zero page and
+     * has no data in the payload.
+     */
     uint64_t offset[];
 } __attribute__((packed)) MultiFDPacket_t;
 
@@ -104,6 +118,10 @@ typedef struct {
     uint64_t num_packets;
     /* pages sent through this channel */
     uint64_t num_pages;
+    /* zero pages found by this channel not yet added to ram_counters */
+    uint64_t zero_pages_pending;
+    /* QIO_CHANNEL_WRITE_FLAG_* used for the page data */
+    int write_flags;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
     /* used for compression methods */
@@ -143,6 +161,12 @@ typedef struct {
     uint64_t num_packets;
     /* pages sent through this channel */
     uint64_t num_pages;
+    /* number of pages in pages->iov that have data in the payload */
+    uint32_t normal_num;
+    /* host address of the zero pages of the current packet */
+    uint8_t **zero;
+    /* number of zero pages of the current packet */
+    uint32_t zero_num;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
     /* used for de-compression methods */
@@ -17,12 +17,16 @@
 #include "qapi/qmp/qerror.h"
 #include "qapi/error.h"
 #include "qemu/host-utils.h"
+#include "qemu/thread.h"
 #include "page_cache.h"
 #include "trace.h"
 
 /* the page in cache will not be replaced in two cycles */
 #define CACHED_PAGE_LIFETIME 2
 
+/* number of locks for concurrent users, see cache_lock() */
+#define CACHE_LOCK_SHARDS 256
+
 typedef struct CacheItem CacheItem;
 
 struct CacheItem {
@@ -36,6 +40,8 @@ struct PageCache {
     size_t page_size;
     size_t max_num_items;
     size_t num_items;
+    QemuMutex *locks;
+    size_t num_locks;
 };
 
 PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
@@ -84,6 +90,12 @@ PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
         cache->page_cache[i].it_addr = -1;
     }
 
+    cache->num_locks = MIN(cache->max_num_items, CACHE_LOCK_SHARDS);
+    cache->locks = g_new(QemuMutex, cache->num_locks);
+    for (i = 0; i < cache->num_locks; i++) {
+        qemu_mutex_init(&cache->locks[i]);
+    }
+
     return cache;
 }
 
@@ -98,6 +110,11 @@ void cache_fini(PageCache *cache)
         g_free(cache->page_cache[i].it_data);
     }
 
+    for (i = 0; i < cache->num_locks; i++) {
+        qemu_mutex_destroy(&cache->locks[i]);
+    }
+    g_free(cache->locks);
+
     g_free(cache->page_cache);
     cache->page_cache = NULL;
     g_free(cache);
@@ -110,6 +127,23 @@ static size_t cache_get_cache_pos(const PageCache *cache,
     return (address / cache->page_size) & (cache->max_num_items - 1);
 }
 
+static QemuMutex *cache_get_lock(PageCache *cache, uint64_t addr)
+{
+    /* max_num_items and num_locks are powers of two */
+    return &cache->locks[cache_get_cache_pos(cache, addr) &
+                         (cache->num_locks - 1)];
+}
+
+void cache_lock(PageCache *cache, uint64_t addr)
+{
+    qemu_mutex_lock(cache_get_lock(cache, addr));
+}
+
+void cache_unlock(PageCache *cache, uint64_t addr)
+{
+    qemu_mutex_unlock(cache_get_lock(cache, addr));
+}
+
 static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
 {
     size_t pos;
@@ -163,7 +197,7 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
             trace_migration_pagecache_insert();
             return -1;
         }
-        cache->num_items++;
+        qatomic_inc(&cache->num_items);
     }
 
     memcpy(it->it_data, pdata, cache->page_size);
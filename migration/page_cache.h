@@ -71,4 +71,25 @@ uint8_t *get_cached_data(const PageCache *cache, uint64_t addr);
 int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
                  uint64_t current_age);
 
+/**
+ * cache_lock: lock the cache entry used for an addr
+ *
+ * The cache itself is not thread safe.  Users that access it from
+ * several threads at once must hold this lock around any call that
+ * takes @addr.  The locks are sharded over the cache entries, so
+ * threads working on different pages rarely contend.
+ *
+ * @cache pointer to the PageCache struct
+ * @addr: page address
+ */
+void cache_lock(PageCache *cache, uint64_t addr);
+
+/**
+ * cache_unlock: unlock the cache entry used for an addr
+ *
+ * @cache pointer to the PageCache struct
+ * @addr: page address
+ */
+void cache_unlock(PageCache *cache, uint64_t addr);
+
 #endif
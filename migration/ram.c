@@ -842,6 +842,190 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     rs->num_dirty_pages_period += new_dirty_pages;
 }
 
+/*
+ * Parallel dirty bitmap sync
+ *
+ * On huge guests, merging the dirty memory log into the migration
+ * bitmap is a long serial loop that runs with the BQL held.  When
+ * dirty-sync-threads is set, each RAMBlock is split into chunks of
+ * DIRTY_SYNC_CHUNK_SIZE bytes and the chunks are shared between a pool
+ * of worker threads and the migration thread itself.
+ *
+ * The chunk size is a multiple of BITS_PER_LONG target pages, so no
+ * two chunks ever share a word of rb->bmap and the non-atomic update
+ * done by cpu_physical_memory_sync_dirty_bitmap() stays safe.
+ */
+#define DIRTY_SYNC_CHUNK_SIZE (1ULL << 30)
+
+typedef struct {
+    RAMBlock *block;
+    ram_addr_t start;
+    ram_addr_t length;
+} DirtySyncJob;
+
+typedef struct {
+    QemuThread thread;
+    /* posted by the migration thread to start a round */
+    QemuSemaphore sem;
+    /* pages found dirty by this thread in the last round */
+    uint64_t num_dirty;
+} DirtySyncThread;
+
+typedef struct {
+    DirtySyncThread *threads;
+    int thread_count;
+    /* posted by each worker when it is done with a round */
+    QemuSemaphore sem_done;
+    bool quit;
+    DirtySyncJob *jobs;
+    unsigned int nr_jobs;
+    unsigned int max_jobs;
+    /* index of the next job to pick, accessed atomically */
+    unsigned int next_job;
+} DirtySyncState;
+
+static DirtySyncState *dirty_sync_state;
+
+static uint64_t dirty_sync_run_jobs(void)
+{
+    uint64_t num_dirty = 0;
+    unsigned int i;
+
+    RCU_READ_LOCK_GUARD();
+
+    while ((i = qatomic_fetch_inc(&dirty_sync_state->next_job)) <
+           dirty_sync_state->nr_jobs) {
+        DirtySyncJob *job = &dirty_sync_state->jobs[i];
+
+        num_dirty += cpu_physical_memory_sync_dirty_bitmap(job->block,
+                                                           job->start,
+                                                           job->length);
+    }
+
+    return num_dirty;
+}
+
+static void *dirty_sync_thread(void *opaque)
+{
+    DirtySyncThread *t = opaque;
+
+    rcu_register_thread();
+
+    while (true) {
+        qemu_sem_wait(&t->sem);
+        if (qatomic_read(&dirty_sync_state->quit)) {
+            break;
+        }
+        t->num_dirty = dirty_sync_run_jobs();
+        qemu_sem_post(&dirty_sync_state->sem_done);
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void dirty_sync_threads_cleanup(void)
+{
+    int i;
+
+    if (!dirty_sync_state) {
+        return;
+    }
+
+    qatomic_set(&dirty_sync_state->quit, true);
+    for (i = 0; i < dirty_sync_state->thread_count; i++) {
+        qemu_sem_post(&dirty_sync_state->threads[i].sem);
+    }
+    for (i = 0; i < dirty_sync_state->thread_count; i++) {
+        qemu_thread_join(&dirty_sync_state->threads[i].thread);
+        qemu_sem_destroy(&dirty_sync_state->threads[i].sem);
+    }
+    qemu_sem_destroy(&dirty_sync_state->sem_done);
+    g_free(dirty_sync_state->threads);
+    g_free(dirty_sync_state->jobs);
+    g_free(dirty_sync_state);
+    dirty_sync_state = NULL;
+}
+
+static void dirty_sync_threads_setup(void)
+{
+    int i, thread_count = migrate_dirty_sync_threads();
+
+    if (!thread_count) {
+        return;
+    }
+
+    dirty_sync_state = g_new0(DirtySyncState, 1);
+    dirty_sync_state->threads = g_new0(DirtySyncThread, thread_count);
+    dirty_sync_state->thread_count = thread_count;
+    qemu_sem_init(&dirty_sync_state->sem_done, 0);
+    for (i = 0; i < thread_count; i++) {
+        qemu_sem_init(&dirty_sync_state->threads[i].sem, 0);
+        qemu_thread_create(&dirty_sync_state->threads[i].thread,
+                           "mig/dirtysync", dirty_sync_thread,
+                           &dirty_sync_state->threads[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void dirty_sync_add_job(RAMBlock *rb, ram_addr_t start,
+                               ram_addr_t length)
+{
+    DirtySyncJob *job;
+
+    if (dirty_sync_state->nr_jobs == dirty_sync_state->max_jobs) {
+        dirty_sync_state->max_jobs = MAX(16, dirty_sync_state->max_jobs * 2);
+        dirty_sync_state->jobs = g_renew(DirtySyncJob, dirty_sync_state->jobs,
+                                         dirty_sync_state->max_jobs);
+    }
+    job = &dirty_sync_state->jobs[dirty_sync_state->nr_jobs++];
+    job->block = rb;
+    job->start = start;
+    job->length = length;
+}
+
+/*
+ * Called with RCU critical section and bitmap_mutex held, from the
+ * migration thread only.
+ */
+static void ramblock_sync_dirty_bitmap_parallel(RAMState *rs)
+{
+    uint64_t new_dirty_pages;
+    RAMBlock *block;
+    int i;
+
+    dirty_sync_state->nr_jobs = 0;
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_addr_t start;
+
+        for (start = 0; start < block->used_length;
+             start += DIRTY_SYNC_CHUNK_SIZE) {
+            dirty_sync_add_job(block, start,
+                               MIN(DIRTY_SYNC_CHUNK_SIZE,
+                                   block->used_length - start));
+        }
+    }
+    qatomic_set(&dirty_sync_state->next_job, 0);
+    trace_migration_bitmap_sync_parallel(dirty_sync_state->thread_count,
+                                         dirty_sync_state->nr_jobs);
+
+    for (i = 0; i < dirty_sync_state->thread_count; i++) {
+        qemu_sem_post(&dirty_sync_state->threads[i].sem);
+    }
+
+    new_dirty_pages = dirty_sync_run_jobs();
+
+    for (i = 0; i < dirty_sync_state->thread_count; i++) {
+        qemu_sem_wait(&dirty_sync_state->sem_done);
+    }
+    for (i = 0; i < dirty_sync_state->thread_count; i++) {
+        new_dirty_pages += dirty_sync_state->threads[i].num_dirty;
+    }
+
+    rs->migration_dirty_pages += new_dirty_pages;
+    rs->num_dirty_pages_period += new_dirty_pages;
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -966,8 +1150,12 @@ static void migration_bitmap_sync(RAMState *rs)
 
     qemu_mutex_lock(&rs->bitmap_mutex);
     WITH_RCU_READ_LOCK_GUARD() {
-        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-            ramblock_sync_dirty_bitmap(rs, block);
+        if (dirty_sync_state) {
+            ramblock_sync_dirty_bitmap_parallel(rs);
+        } else {
+            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+                ramblock_sync_dirty_bitmap(rs, block);
+            }
         }
         ram_counters.remaining = ram_bytes_remaining();
     }
@@ -1951,6 +2139,14 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
 {
     RAMBlock *block = pss->block;
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
+    /*
+     * Do not use multifd for:
+     * 1. Compression as the first page in the new block should be posted out
+     *    before sending the compressed page
+     * 2. In postcopy as one whole host page should be placed
+     */
+    bool use_multifd = !save_page_use_compression(rs) &&
+                       migrate_use_multifd() && !migration_in_postcopy();
     int res;
 
     if (control_save_page(rs, block, offset, &res)) {
@@ -1961,6 +2157,16 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
         return 1;
     }
 
+    /*
+     * With multifd-zero-page the multifd channels look for zero pages.
+     * Multifd xbzrle does the same, as it must keep its cache up to date.
+     */
+    if (use_multifd &&
+        (migrate_multifd_zero_page() ||
+         migrate_multifd_compression() == MULTIFD_COMPRESSION_XBZRLE)) {
+        return ram_save_multifd_page(rs, block, offset);
+    }
+
     res = save_zero_page(rs, block, offset);
     if (res > 0) {
         /* Must let xbzrle know, otherwise a previous (now 0'd) cached
@@ -1975,14 +2181,7 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
         return res;
     }
 
-    /*
-     * Do not use multifd for:
-     * 1. Compression as the first page in the new block should be posted out
-     *    before sending the compressed page
-     * 2. In postcopy as one whole host page should be placed
-     */
-    if (!save_page_use_compression(rs) && migrate_use_multifd()
-        && !migration_in_postcopy()) {
+    if (use_multifd) {
         return ram_save_multifd_page(rs, block, offset);
     }
 
@@ -2202,6 +2401,7 @@ static void ram_save_cleanup(void *opaque)
 
     xbzrle_cleanup();
     compress_threads_save_cleanup();
+    dirty_sync_threads_cleanup();
     ram_state_cleanup(rsp);
 }
 
@@ -2773,11 +2973,13 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     if (compress_threads_save_setup()) {
         return -1;
     }
+    dirty_sync_threads_setup();
 
     /* migration has already setup the bitmap, reuse it. */
     if (!migration_in_colo_state()) {
         if (ram_init_all(rsp) != 0) {
             compress_threads_save_cleanup();
+            dirty_sync_threads_cleanup();
             return -1;
         }
     }
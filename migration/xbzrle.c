@@ -12,6 +12,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/host-utils.h"
 #include "xbzrle.h"
 
 /*
@@ -24,8 +25,8 @@
 
   length = uleb128 encoded integer
  */
-int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
-                         uint8_t *dst, int dlen)
+int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
+                             int slen, uint8_t *dst, int dlen)
 {
     uint32_t zrun_len = 0, nzrun_len = 0;
     int d = 0, i = 0;
@@ -126,6 +127,260 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
     return d;
 }
 
+/*
+ * The vectorized encoders below produce exactly the same output as
+ * xbzrle_encode_buffer_int.  They compare a whole vector of old and new
+ * bytes at a time and use the resulting byte mask to find where the
+ * current run ends; the tail of the page that does not fill a vector is
+ * finished a byte at a time.
+ */
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static int xbzrle_encode_buffer_avx2(uint8_t *old_buf, uint8_t *new_buf,
+                                     int slen, uint8_t *dst, int dlen)
+{
+    uint32_t zrun_len, nzrun_len;
+    int d = 0, i = 0, start;
+
+    while (i < slen) {
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        /* find the first byte that differs */
+        start = i;
+        while (i + 32 <= slen) {
+            __m256i o = _mm256_loadu_si256((__m256i *)(old_buf + i));
+            __m256i n = _mm256_loadu_si256((__m256i *)(new_buf + i));
+            uint32_t neq = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(o, n));
+
+            if (neq) {
+                i += ctz32(neq);
+                break;
+            }
+            i += 32;
+        }
+        while (i < slen && old_buf[i] == new_buf[i]) {
+            i++;
+        }
+        zrun_len = i - start;
+
+        /* buffer unchanged */
+        if (zrun_len == slen) {
+            return 0;
+        }
+
+        /* skip last zero run */
+        if (i == slen) {
+            return d;
+        }
+
+        d += uleb128_encode_small(dst + d, zrun_len);
+
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        /* find the first byte that is the same again */
+        start = i;
+        while (i + 32 <= slen) {
+            __m256i o = _mm256_loadu_si256((__m256i *)(old_buf + i));
+            __m256i n = _mm256_loadu_si256((__m256i *)(new_buf + i));
+            uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(o, n));
+
+            if (eq) {
+                i += ctz32(eq);
+                break;
+            }
+            i += 32;
+        }
+        while (i < slen && old_buf[i] != new_buf[i]) {
+            i++;
+        }
+        nzrun_len = i - start;
+
+        d += uleb128_encode_small(dst + d, nzrun_len);
+        /* overflow */
+        if (d + nzrun_len > dlen) {
+            return -1;
+        }
+        memcpy(dst + d, new_buf + start, nzrun_len);
+        d += nzrun_len;
+    }
+
+    return d;
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+#ifdef CONFIG_AVX512BW_OPT
+#pragma GCC push_options
+#pragma GCC target("avx512bw")
+#include <immintrin.h>
+
+static int xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf,
+                                       int slen, uint8_t *dst, int dlen)
+{
+    uint32_t zrun_len, nzrun_len;
+    int d = 0, i = 0, start;
+
+    while (i < slen) {
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        /* find the first byte that differs */
+        start = i;
+        while (i + 64 <= slen) {
+            __m512i o = _mm512_loadu_si512(old_buf + i);
+            __m512i n = _mm512_loadu_si512(new_buf + i);
+            uint64_t neq = _mm512_cmpneq_epi8_mask(o, n);
+
+            if (neq) {
+                i += ctz64(neq);
+                break;
+            }
+            i += 64;
+        }
+        while (i < slen && old_buf[i] == new_buf[i]) {
+            i++;
+        }
+        zrun_len = i - start;
+
+        /* buffer unchanged */
+        if (zrun_len == slen) {
+            return 0;
+        }
+
+        /* skip last zero run */
+        if (i == slen) {
+            return d;
+        }
+
+        d += uleb128_encode_small(dst + d, zrun_len);
+
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        /* find the first byte that is the same again */
+        start = i;
+        while (i + 64 <= slen) {
+            __m512i o = _mm512_loadu_si512(old_buf + i);
+            __m512i n = _mm512_loadu_si512(new_buf + i);
+            uint64_t eq = _mm512_cmpeq_epi8_mask(o, n);
+
+            if (eq) {
+                i += ctz64(eq);
+                break;
+            }
+            i += 64;
+        }
+        while (i < slen && old_buf[i] != new_buf[i]) {
+            i++;
+        }
+        nzrun_len = i - start;
+
+        d += uleb128_encode_small(dst + d, nzrun_len);
+        /* overflow */
+        if (d + nzrun_len > dlen) {
+            return -1;
+        }
+        memcpy(dst + d, new_buf + start, nzrun_len);
+        d += nzrun_len;
+    }
+
+    return d;
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX512BW_OPT */
+
+#define CACHE_AVX512BW 1
+#define CACHE_AVX2     2
+
+static unsigned cpuid_cache, cpuid_cache_host;
+static int (*encode_accel)(uint8_t *, uint8_t *, int, uint8_t *, int) =
+    xbzrle_encode_buffer_int;
+
+static void init_accel(unsigned cache)
+{
+    int (*fn)(uint8_t *, uint8_t *, int, uint8_t *, int) =
+        xbzrle_encode_buffer_int;
+
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        fn = xbzrle_encode_buffer_avx2;
+    }
+#endif
+#ifdef CONFIG_AVX512BW_OPT
+    if (cache & CACHE_AVX512BW) {
+        fn = xbzrle_encode_buffer_avx512;
+    }
+#endif
+    encode_accel = fn;
+}
+
+#if defined(CONFIG_AVX512BW_OPT) || defined(CONFIG_AVX2_OPT)
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 7) {
+        __cpuid(1, a, b, c, d);
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX)) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 0x6) == 0x6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+            /* See util/bufferiszero.c for the meaning of 0xe6 */
+            if ((bv & 0xe6) == 0xe6 && (b & bit_AVX512BW)) {
+                cache |= CACHE_AVX512BW;
+            }
+        }
+    }
+    cpuid_cache = cpuid_cache_host = cache;
+    init_accel(cache);
+}
+#endif
+
+bool test_xbzrle_encode_next_accel(void)
+{
+    /*
+     * If no bits set, we just tested xbzrle_encode_buffer_int; go back
+     * to the best accelerator for the next test.
+     */
+    if (cpuid_cache == 0) {
+        cpuid_cache = cpuid_cache_host;
+        init_accel(cpuid_cache);
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+
+int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                         uint8_t *dst, int dlen)
+{
+    return encode_accel(old_buf, new_buf, slen, dst, dlen);
+}
+
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
 {
     int i = 0, d = 0;
@@ -0,0 +1,470 @@
+/*
+ * AF_XDP network backend.
+ *
+ * Packets are exchanged with the kernel through the rings of an XSK
+ * socket bound to one queue of a host interface.  The packet buffers
+ * (UMEM) live in QEMU's address space and are shared with the kernel,
+ * so neither direction goes through the host network stack.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <bpf/libbpf.h>
+#include <bpf/xsk.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+
+#include "net/eth.h"
+#include "net/net.h"
+#include "clients.h"
+#include "qapi/error.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+
+#define AF_XDP_FRAME_SIZE   XSK_UMEM__DEFAULT_FRAME_SIZE
+#define AF_XDP_RX_DESCS     XSK_RING_CONS__DEFAULT_NUM_DESCS
+#define AF_XDP_TX_DESCS     XSK_RING_PROD__DEFAULT_NUM_DESCS
+#define AF_XDP_N_FRAMES     (AF_XDP_RX_DESCS + AF_XDP_TX_DESCS)
+
+/* Maximum number of packets handed to the peer per af_xdp_send() call. */
+#define AF_XDP_BATCH_SIZE   64
+
+typedef struct AFXDPState {
+    NetClientState       nc;
+    struct xsk_socket    *xsk;
+    struct xsk_umem      *umem;
+    struct xsk_ring_cons rx;
+    struct xsk_ring_prod tx;
+    struct xsk_ring_prod fq;
+    struct xsk_ring_cons cq;
+    char                 *buffer;      /* UMEM area, AF_XDP_N_FRAMES frames */
+    uint64_t             *pool;        /* UMEM addresses of free frames */
+    uint32_t             n_pool;
+    uint32_t             outstanding_tx;
+    char                 ifname[IFNAMSIZ];
+    int                  ifindex;
+    uint32_t             xdp_flags;    /* XDP attach mode */
+    bool                 prog_loaded;  /* we attached the XDP program */
+    bool                 read_poll;
+    bool                 write_poll;
+} AFXDPState;
+
+static void af_xdp_send(void *opaque);
+static void af_xdp_writable(void *opaque);
+
+/* Set the event-loop handlers for the af-xdp backend. */
+static void af_xdp_update_fd_handler(AFXDPState *s)
+{
+    qemu_set_fd_handler(xsk_socket__fd(s->xsk),
+                        s->read_poll ? af_xdp_send : NULL,
+                        s->write_poll ? af_xdp_writable : NULL,
+                        s);
+}
+
+/* Update the read handler. */
+static void af_xdp_read_poll(AFXDPState *s, bool enable)
+{
+    if (s->read_poll != enable) {
+        s->read_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+/* Update the write handler. */
+static void af_xdp_write_poll(AFXDPState *s, bool enable)
+{
+    if (s->write_poll != enable) {
+        s->write_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+static void af_xdp_poll(NetClientState *nc, bool enable)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    if (s->read_poll != enable || s->write_poll != enable) {
+        s->write_poll = enable;
+        s->read_poll  = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+/* Return frames that the kernel has finished transmitting to the pool. */
+static void af_xdp_complete_tx(AFXDPState *s)
+{
+    uint32_t idx = 0;
+    uint32_t done, i;
+
+    done = xsk_ring_cons__peek(&s->cq, AF_XDP_TX_DESCS, &idx);
+    for (i = 0; i < done; i++) {
+        s->pool[s->n_pool++] = *xsk_ring_cons__comp_addr(&s->cq, idx++);
+    }
+
+    if (done) {
+        xsk_ring_cons__release(&s->cq, done);
+        s->outstanding_tx -= done;
+    }
+}
+
+/* Hand up to @n free frames to the kernel for receiving. */
+static void af_xdp_fq_refill(AFXDPState *s, uint32_t n)
+{
+    uint32_t idx = 0;
+    uint32_t i;
+
+    n = MIN(n, s->n_pool);
+    if (!n || !xsk_ring_prod__reserve(&s->fq, n, &idx)) {
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        *xsk_ring_prod__fill_addr(&s->fq, idx++) = s->pool[--s->n_pool];
+    }
+    xsk_ring_prod__submit(&s->fq, n);
+
+    if (xsk_ring_prod__needs_wakeup(&s->fq)) {
+        /* Errors only mean that the kernel is already busy with the ring. */
+        recvfrom(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+}
+
+/*
+ * The fd_write() callback, invoked if the fd is marked as
+ * writable after a poll.  Reclaim transmitted frames and, once
+ * some are free again, flush any buffered packets.
+ */
+static void af_xdp_writable(void *opaque)
+{
+    AFXDPState *s = opaque;
+
+    af_xdp_complete_tx(s);
+    if (!s->n_pool) {
+        return;
+    }
+
+    af_xdp_write_poll(s, false);
+    qemu_flush_queued_packets(&s->nc);
+}
+
+static ssize_t af_xdp_receive_iov(NetClientState *nc,
+                                  const struct iovec *iov, int iovcnt)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    size_t size = iov_size(iov, iovcnt);
+    struct xdp_desc *desc;
+    uint32_t idx = 0;
+
+    /* Packets larger than a UMEM frame cannot be sent; drop them. */
+    if (size > AF_XDP_FRAME_SIZE) {
+        return size;
+    }
+
+    af_xdp_complete_tx(s);
+
+    if (!s->n_pool || !xsk_ring_prod__reserve(&s->tx, 1, &idx)) {
+        /* No free frame or TX slot: wait for completions. */
+        af_xdp_write_poll(s, true);
+        return 0;
+    }
+
+    desc = xsk_ring_prod__tx_desc(&s->tx, idx);
+    desc->addr = s->pool[--s->n_pool];
+    desc->len = size;
+    iov_to_buf(iov, iovcnt, 0, xsk_umem__get_data(s->buffer, desc->addr),
+               size);
+
+    xsk_ring_prod__submit(&s->tx, 1);
+    s->outstanding_tx++;
+
+    if (xsk_ring_prod__needs_wakeup(&s->tx)) {
+        sendto(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT, NULL, 0);
+    }
+
+    return size;
+}
+
+static ssize_t af_xdp_receive(NetClientState *nc,
+                              const uint8_t *buf, size_t size)
+{
+    struct iovec iov;
+
+    iov.iov_base = (void *)buf;
+    iov.iov_len = size;
+
+    return af_xdp_receive_iov(nc, &iov, 1);
+}
+
+/* Complete a previous send (backend --> guest) and enable the
+   fd_read callback. */
+static void af_xdp_send_completed(NetClientState *nc, ssize_t len)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    af_xdp_read_poll(s, true);
+}
+
+static void af_xdp_send(void *opaque)
+{
+    AFXDPState *s = opaque;
+    uint32_t idx = 0;
+    uint32_t n, done;
+
+    n = xsk_ring_cons__peek(&s->rx, AF_XDP_BATCH_SIZE, &idx);
+    if (!n) {
+        return;
+    }
+
+    qemu_send_batch_begin(&s->nc);
+
+    for (done = 0; done < n; done++) {
+        const struct xdp_desc *desc = xsk_ring_cons__rx_desc(&s->rx, idx++);
+        uint8_t *buf = xsk_umem__get_data(s->buffer, desc->addr);
+        size_t size = desc->len;
+        uint8_t min_pkt[ETH_ZLEN];
+        size_t min_pktsz = sizeof(min_pkt);
+        ssize_t ret;
+
+        if (net_peer_needs_padding(&s->nc)) {
+            if (eth_pad_short_frame(min_pkt, &min_pktsz, buf, size)) {
+                buf = min_pkt;
+                size = min_pktsz;
+            }
+        }
+
+        ret = qemu_send_packet_async(&s->nc, buf, size, af_xdp_send_completed);
+
+        /*
+         * The packet has been copied to the peer or into its queue, so the
+         * frame can be reused.  The kernel may have placed the packet at an
+         * offset inside the frame; recycle the frame from its start.
+         */
+        s->pool[s->n_pool++] = desc->addr & ~(uint64_t)(AF_XDP_FRAME_SIZE - 1);
+
+        if (ret == 0) {
+            /* The peer does not receive anymore.  Packet is queued, stop
+             * reading from the backend until af_xdp_send_completed(). */
+            af_xdp_read_poll(s, false);
+            done++;
+            break;
+        }
+    }
+
+    /*
+     * Descriptors after a queued packet stay in the ring for the next
+     * call; peek already moved past them, so give them back.
+     */
+    if (done < n) {
+        xsk_ring_cons__cancel(&s->rx, n - done);
+    }
+    xsk_ring_cons__release(&s->rx, done);
+    qemu_send_batch_end(&s->nc);
+
+    af_xdp_fq_refill(s, done);
+}
+
+/* Flush and close. */
+static void af_xdp_cleanup(NetClientState *nc)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    qemu_purge_queued_packets(nc);
+
+    if (s->xsk) {
+        af_xdp_poll(nc, false);
+        xsk_socket__delete(s->xsk);
+        s->xsk = NULL;
+    }
+
+    xsk_umem__delete(s->umem);
+    s->umem = NULL;
+    qemu_vfree(s->buffer);
+    s->buffer = NULL;
+    g_free(s->pool);
+    s->pool = NULL;
+
+    /* Detach the XDP program that libbpf attached for the first queue. */
+    if (s->prog_loaded &&
+        bpf_set_link_xdp_fd(s->ifindex, -1, s->xdp_flags)) {
+        error_report("af-xdp: failed to remove XDP program from %s",
+                     s->ifname);
+    }
+}
+
+static int af_xdp_umem_create(AFXDPState *s, Error **errp)
+{
+    struct xsk_umem_config config = {
+        .fill_size = AF_XDP_RX_DESCS,
+        .comp_size = AF_XDP_TX_DESCS,
+        .frame_size = AF_XDP_FRAME_SIZE,
+        .frame_headroom = 0,
+    };
+    uint64_t size = (uint64_t)AF_XDP_N_FRAMES * AF_XDP_FRAME_SIZE;
+    uint32_t i;
+    int ret;
+
+    s->buffer = qemu_memalign(qemu_real_host_page_size, size);
+    memset(s->buffer, 0, size);
+
+    ret = xsk_umem__create(&s->umem, s->buffer, size, &s->fq, &s->cq,
+                           &config);
+    if (ret) {
+        error_setg_errno(errp, -ret, "failed to create AF_XDP UMEM");
+        return -1;
+    }
+
+    s->pool = g_new(uint64_t, AF_XDP_N_FRAMES);
+    for (i = 0; i < AF_XDP_N_FRAMES; i++) {
+        s->pool[i] = (uint64_t)i * AF_XDP_FRAME_SIZE;
+    }
+    s->n_pool = AF_XDP_N_FRAMES;
+
+    return 0;
+}
+
+/*
+ * Create the XSK socket for @queue_id.  @mode_flags holds the XDP attach
+ * mode; if it is zero, native mode is tried first with a fallback to
+ * generic mode, and the mode that worked is stored in s->xdp_flags.
+ */
+static int af_xdp_socket_create(AFXDPState *s, int queue_id,
+                                uint32_t mode_flags, bool force_copy,
+                                Error **errp)
+{
+    struct xsk_socket_config cfg = {
+        .rx_size = AF_XDP_RX_DESCS,
+        .tx_size = AF_XDP_TX_DESCS,
+        .libbpf_flags = 0,
+        .bind_flags = XDP_USE_NEED_WAKEUP,
+    };
+    const uint32_t modes[] = { XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE };
+    uint32_t prog_id = 0;
+    int ret = -EINVAL;
+    int i;
+
+    if (force_copy) {
+        cfg.bind_flags |= XDP_COPY;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(modes); i++) {
+        if (mode_flags && mode_flags != modes[i]) {
+            continue;
+        }
+
+        cfg.xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST | modes[i];
+
+        /* libbpf reuses a program that is already attached. */
+        if (bpf_get_link_xdp_id(s->ifindex, &prog_id, cfg.xdp_flags)) {
+            prog_id = 0;
+        }
+
+        ret = xsk_socket__create(&s->xsk, s->ifname, queue_id, s->umem,
+                                 &s->rx, &s->tx, &cfg);
+        if (!ret) {
+            s->xdp_flags = modes[i];
+            s->prog_loaded = !prog_id;
+            return 0;
+        }
+        s->xsk = NULL;
+    }
+
+    error_setg_errno(errp, -ret, "failed to create AF_XDP socket for %s "
+                     "queue %d", s->ifname, queue_id);
+    return -1;
+}
+
+static NetClientInfo net_af_xdp_info = {
+    .type = NET_CLIENT_DRIVER_AF_XDP,
+    .size = sizeof(AFXDPState),
+    .receive = af_xdp_receive,
+    .receive_iov = af_xdp_receive_iov,
+    .poll = af_xdp_poll,
+    .cleanup = af_xdp_cleanup,
+};
+
+/* The exported init function
+ *
+ * ... -netdev af-xdp,ifname="..."
+ */
+int net_init_af_xdp(const Netdev *netdev,
+                    const char *name, NetClientState *peer, Error **errp)
+{
+    const NetdevAFXDPOptions *opts = &netdev->u.af_xdp;
+    NetClientState *nc, *nc0 = NULL;
+    int64_t queues = opts->has_queues ? opts->queues : 1;
+    int64_t start_queue = opts->has_start_queue ? opts->start_queue : 0;
+    bool force_copy = opts->has_force_copy && opts->force_copy;
+    uint32_t mode_flags = 0;
+    AFXDPState *s;
+    int ifindex;
+    int64_t i;
+
+    if (queues < 1 || queues > MAX_QUEUE_NUM) {
+        error_setg(errp, "af-xdp: queues must be in the range 1 to %d",
+                   MAX_QUEUE_NUM);
+        return -1;
+    }
+
+    if (start_queue < 0 || start_queue > INT_MAX - queues) {
+        error_setg(errp, "af-xdp: invalid start-queue %" PRId64, start_queue);
+        return -1;
+    }
+
+    if (strlen(opts->ifname) >= IFNAMSIZ) {
+        error_setg(errp, "af-xdp: interface name '%s' is too long",
+                   opts->ifname);
+        return -1;
+    }
+
+    ifindex = if_nametoindex(opts->ifname);
+    if (!ifindex) {
+        error_setg_errno(errp, errno, "af-xdp: failed to get ifindex for %s",
+                         opts->ifname);
+        return -1;
+    }
+
+    if (opts->has_mode) {
+        mode_flags = opts->mode == AFXDP_MODE_NATIVE ? XDP_FLAGS_DRV_MODE
+                                                     : XDP_FLAGS_SKB_MODE;
+    }
+
+    for (i = 0; i < queues; i++) {
+        nc = qemu_new_net_client(&net_af_xdp_info, peer, "af-xdp", name);
+        nc->queue_index = i;
+        if (!nc0) {
+            nc0 = nc;
+        }
+
+        s = DO_UPCAST(AFXDPState, nc, nc);
+        pstrcpy(s->ifname, sizeof(s->ifname), opts->ifname);
+        s->ifindex = ifindex;
+
+        if (af_xdp_umem_create(s, errp) ||
+            af_xdp_socket_create(s, start_queue + i, mode_flags, force_copy,
+                                 errp)) {
+            goto err;
+        }
+
+        /* All queues must use the mode the first one attached with. */
+        mode_flags = s->xdp_flags;
+
+        snprintf(nc->info_str, sizeof(nc->info_str),
+                 "af-xdp%" PRId64 " to %s queue %" PRId64 " (%s)",
+                 i, s->ifname, start_queue + i,
+                 mode_flags == XDP_FLAGS_DRV_MODE ? "native" : "skb");
+
+        af_xdp_fq_refill(s, AF_XDP_RX_DESCS);
+        af_xdp_read_poll(s, true); /* Initially only poll for reads. */
+    }
+
+    return 0;
+
+err:
+    qemu_del_net_client(nc0);
+    return -1;
+}
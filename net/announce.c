@@ -151,7 +151,9 @@ static void qemu_announce_self_iter(NICState *nic, void *opaque)
     if (!skip) {
         len = announce_self_create(buf, nic->conf->macaddr.a);
 
+        qemu_net_client_lock(qemu_get_queue(nic));
         qemu_send_packet_raw(qemu_get_queue(nic), buf, len);
+        qemu_net_client_unlock(qemu_get_queue(nic));
 
         /* if the NIC provides it's own announcement support, use it as well */
         if (nic->ncs->info->announce) {
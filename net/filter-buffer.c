@@ -8,6 +8,7 @@
 
 #include "qemu/osdep.h"
 #include "net/filter.h"
+#include "net/net.h"
 #include "net/queue.h"
 #include "qapi/error.h"
 #include "qemu/timer.h"
@@ -32,10 +33,13 @@ static void filter_buffer_flush(NetFilterState *nf)
 {
     FilterBufferState *s = FILTER_BUFFER(nf);
 
+    /* Runs in the main loop, the netdev may be in an iothread */
+    qemu_net_client_lock(nf->netdev);
     if (!qemu_net_queue_flush(s->incoming_queue)) {
         /* Unable to empty the queue, purge remaining packets */
         qemu_net_queue_purge(s->incoming_queue, nf->netdev);
     }
+    qemu_net_client_unlock(nf->netdev);
 }
 
 static void filter_buffer_release_timer(void *opaque)
@@ -125,7 +125,11 @@ static void redirector_chr_read(void *opaque, const uint8_t *buf, int size)
     MirrorState *s = FILTER_REDIRECTOR(nf);
     int ret;
 
+    /* Packets are injected from the main loop into a netdev that may be
+     * running in an iothread */
+    qemu_net_client_lock(nf->netdev);
     ret = net_fill_rstate(&s->rs, buf, size);
+    qemu_net_client_unlock(nf->netdev);
 
     if (ret == -1) {
         qemu_chr_fe_set_handlers(&s->chr_in, NULL, NULL, NULL,
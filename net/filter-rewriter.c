@@ -47,10 +47,12 @@ static void filter_rewriter_flush(NetFilterState *nf)
 {
     RewriterState *s = FILTER_REWRITER(nf);
 
+    qemu_net_client_lock(nf->netdev);
     if (!qemu_net_queue_flush(s->incoming_queue)) {
         /* Unable to empty the queue, purge remaining packets */
         qemu_net_queue_purge(s->incoming_queue, nf->netdev);
     }
+    qemu_net_client_unlock(nf->netdev);
 }
 
 /*
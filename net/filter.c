@@ -290,6 +290,8 @@ static void netfilter_complete(UserCreatable *uc, Error **errp)
         }
     }
 
+    /* The netdev may be receiving packets in an iothread */
+    qemu_net_client_lock(nf->netdev);
     if (position) {
         if (nf->insert_before_flag) {
             QTAILQ_INSERT_BEFORE(position, nf, next);
@@ -301,6 +303,7 @@ static void netfilter_complete(UserCreatable *uc, Error **errp)
     } else if (!strcmp(nf->position, "tail")) {
         QTAILQ_INSERT_TAIL(&nf->netdev->filters, nf, next);
     }
+    qemu_net_client_unlock(nf->netdev);
 }
 
 static void netfilter_finalize(Object *obj)
@@ -314,7 +317,9 @@ static void netfilter_finalize(Object *obj)
 
     if (nf->netdev && !QTAILQ_EMPTY(&nf->netdev->filters) &&
         QTAILQ_IN_USE(nf, next)) {
+        qemu_net_client_lock(nf->netdev);
         QTAILQ_REMOVE(&nf->netdev->filters, nf, next);
+        qemu_net_client_unlock(nf->netdev);
     }
     g_free(nf->netdev_id);
     g_free(nf->position);
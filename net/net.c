@@ -338,7 +338,9 @@ static void qemu_cleanup_net_client(NetClientState *nc)
     QTAILQ_REMOVE(&net_clients, nc, next);
 
     if (nc->info->cleanup) {
+        qemu_net_client_lock(nc);
         nc->info->cleanup(nc);
+        qemu_net_client_unlock(nc);
     }
 }
 
@@ -636,6 +638,70 @@ void qemu_flush_queued_packets(NetClientState *nc)
     qemu_flush_or_purge_queued_packets(nc, false);
 }
 
+/*
+ * Move the datapath of @nc and its peer to @ctx, or back to the main loop
+ * if @ctx is NULL.  Fails if the peer cannot run outside the main loop.
+ *
+ * Once moved, the peer's handlers run in @ctx with it acquired; code in
+ * other threads must use qemu_net_client_lock() before touching either
+ * client.
+ */
+bool qemu_net_client_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    NetClientState *peer = nc->peer;
+
+    if (ctx && peer && !peer->info->set_aio_context) {
+        return false;
+    }
+
+    if (peer) {
+        if (peer->info->set_aio_context) {
+            peer->info->set_aio_context(peer, ctx);
+        }
+        peer->ctx = ctx;
+    }
+    nc->ctx = ctx;
+    return true;
+}
+
+void qemu_net_client_lock(NetClientState *nc)
+{
+    if (nc->ctx) {
+        aio_context_acquire(nc->ctx);
+    }
+}
+
+void qemu_net_client_unlock(NetClientState *nc)
+{
+    if (nc->ctx) {
+        aio_context_release(nc->ctx);
+    }
+}
+
+/*
+ * Bracket a burst of qemu_send_packet*() calls from @nc so that the peer
+ * can defer per-packet work (such as guest notifications) until the end
+ * of the burst.  Packets that end up queued or held by a filter are
+ * delivered later, outside the batch, and are not affected.
+ */
+void qemu_send_batch_begin(NetClientState *nc)
+{
+    NetClientState *peer = nc->peer;
+
+    if (peer && peer->info->receive_batch_begin) {
+        peer->info->receive_batch_begin(peer);
+    }
+}
+
+void qemu_send_batch_end(NetClientState *nc)
+{
+    NetClientState *peer = nc->peer;
+
+    if (peer && peer->info->receive_batch_end) {
+        peer->info->receive_batch_end(peer);
+    }
+}
+
 static ssize_t qemu_send_packet_async_with_flags(NetClientState *sender,
                                                  unsigned flags,
                                                  const uint8_t *buf, int size,
@@ -988,6 +1054,9 @@ static int (* const net_client_init_fun[NET_CLIENT_DRIVER__MAX])(
 #ifdef CONFIG_NETMAP
         [NET_CLIENT_DRIVER_NETMAP]    = net_init_netmap,
 #endif
+#ifdef CONFIG_AF_XDP
+        [NET_CLIENT_DRIVER_AF_XDP]    = net_init_af_xdp,
+#endif
 #ifdef CONFIG_NET_BRIDGE
         [NET_CLIENT_DRIVER_BRIDGE]    = net_init_bridge,
 #endif
@@ -1081,6 +1150,9 @@ void show_netdevs(void)
 #ifdef CONFIG_NETMAP
         "netmap",
 #endif
+#ifdef CONFIG_AF_XDP
+        "af-xdp",
+#endif
 #ifdef CONFIG_POSIX
         "vhost-user",
 #endif
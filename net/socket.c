@@ -49,12 +49,17 @@ typedef struct NetSocketState {
 static void net_socket_accept(void *opaque);
 static void net_socket_writable(void *opaque);
 
+static void net_socket_set_fd_handler(NetSocketState *s, AioContext *ctx)
+{
+    aio_set_fd_handler(ctx ? ctx : iohandler_get_aio_context(), s->fd, false,
+                       s->read_poll ? s->send_fn : NULL,
+                       s->write_poll ? net_socket_writable : NULL,
+                       NULL, s);
+}
+
 static void net_socket_update_fd_handler(NetSocketState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll ? s->send_fn : NULL,
-                        s->write_poll ? net_socket_writable : NULL,
-                        s);
+    net_socket_set_fd_handler(s, s->nc.ctx);
 }
 
 static void net_socket_read_poll(NetSocketState *s, bool enable)
@@ -73,9 +78,11 @@ static void net_socket_writable(void *opaque)
 {
     NetSocketState *s = opaque;
 
+    qemu_net_client_lock(&s->nc);
     net_socket_write_poll(s, false);
 
     qemu_flush_queued_packets(&s->nc);
+    qemu_net_client_unlock(&s->nc);
 }
 
 static ssize_t net_socket_receive(NetClientState *nc, const uint8_t *buf, size_t size)
@@ -163,6 +170,7 @@ static void net_socket_send(void *opaque)
     uint8_t buf1[NET_BUFSIZE];
     const uint8_t *buf;
 
+    qemu_net_client_lock(&s->nc);
     size = qemu_recv(s->fd, buf1, sizeof(buf1), 0);
     if (size < 0) {
         if (errno != EWOULDBLOCK)
@@ -181,8 +189,7 @@ static void net_socket_send(void *opaque)
         net_socket_rs_init(&s->rs, net_socket_rs_finalize, false);
         s->nc.link_down = true;
         memset(s->nc.info_str, 0, sizeof(s->nc.info_str));
-
-        return;
+        goto out;
     }
     buf = buf1;
 
@@ -191,6 +198,8 @@ static void net_socket_send(void *opaque)
     if (ret == -1) {
         goto eoc;
     }
+out:
+    qemu_net_client_unlock(&s->nc);
 }
 
 static void net_socket_send_dgram(void *opaque)
@@ -198,19 +207,23 @@ static void net_socket_send_dgram(void *opaque)
     NetSocketState *s = opaque;
     int size;
 
+    qemu_net_client_lock(&s->nc);
     size = qemu_recv(s->fd, s->rs.buf, sizeof(s->rs.buf), 0);
-    if (size < 0)
-        return;
+    if (size < 0) {
+        goto out;
+    }
     if (size == 0) {
         /* end of connection */
         net_socket_read_poll(s, false);
         net_socket_write_poll(s, false);
-        return;
+        goto out;
     }
     if (qemu_send_packet_async(&s->nc, s->rs.buf, size,
                                net_socket_send_completed) == 0) {
         net_socket_read_poll(s, false);
     }
+out:
+    qemu_net_client_unlock(&s->nc);
 }
 
 static int net_socket_mcast_create(struct sockaddr_in *mcastaddr,
@@ -322,11 +335,30 @@ static void net_socket_cleanup(NetClientState *nc)
     }
 }
 
+/* Move the fd handlers to @ctx; nc->ctx still holds the old context. */
+static void net_socket_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    NetSocketState *s = DO_UPCAST(NetSocketState, nc, nc);
+
+    /*
+     * Without a connection the fd is either closed or waiting in the main
+     * loop for connect() to finish; net_socket_connect() picks up nc->ctx.
+     */
+    if (s->fd < 0 || !s->send_fn) {
+        return;
+    }
+
+    aio_set_fd_handler(nc->ctx ? nc->ctx : iohandler_get_aio_context(),
+                       s->fd, false, NULL, NULL, NULL, NULL);
+    net_socket_set_fd_handler(s, ctx);
+}
+
 static NetClientInfo net_dgram_socket_info = {
     .type = NET_CLIENT_DRIVER_SOCKET,
     .size = sizeof(NetSocketState),
     .receive = net_socket_receive_dgram,
     .cleanup = net_socket_cleanup,
+    .set_aio_context = net_socket_set_aio_context,
 };
 
 static NetSocketState *net_socket_fd_init_dgram(NetClientState *peer,
@@ -410,8 +442,15 @@ err:
 static void net_socket_connect(void *opaque)
 {
     NetSocketState *s = opaque;
+
+    qemu_net_client_lock(&s->nc);
+    if (s->nc.ctx) {
+        /* Drop the main loop handler that waited for the connection */
+        qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+    }
     s->send_fn = net_socket_send;
     net_socket_read_poll(s, true);
+    qemu_net_client_unlock(&s->nc);
 }
 
 static NetClientInfo net_socket_info = {
@@ -419,6 +458,7 @@ static NetClientInfo net_socket_info = {
     .size = sizeof(NetSocketState),
     .receive = net_socket_receive,
     .cleanup = net_socket_cleanup,
+    .set_aio_context = net_socket_set_aio_context,
 };
 
 static NetSocketState *net_socket_fd_init_stream(NetClientState *peer,
@@ -495,12 +535,14 @@ static void net_socket_accept(void *opaque)
         }
     }
 
+    qemu_net_client_lock(&s->nc);
     s->fd = fd;
     s->nc.link_down = false;
     net_socket_connect(s);
     snprintf(s->nc.info_str, sizeof(s->nc.info_str),
              "socket: connection from %s:%d",
              inet_ntoa(saddr.sin_addr), ntohs(saddr.sin_port));
+    qemu_net_client_unlock(&s->nc);
 }
 
 static int net_socket_listen_init(NetClientState *peer,
@@ -70,12 +70,17 @@ static void launch_script(const char *setup_script, const char *ifname,
 static void tap_send(void *opaque);
 static void tap_writable(void *opaque);
 
+static void tap_set_fd_handler(TAPState *s, AioContext *ctx)
+{
+    aio_set_fd_handler(ctx ? ctx : iohandler_get_aio_context(), s->fd, false,
+                       s->read_poll && s->enabled ? tap_send : NULL,
+                       s->write_poll && s->enabled ? tap_writable : NULL,
+                       NULL, s);
+}
+
 static void tap_update_fd_handler(TAPState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll && s->enabled ? tap_send : NULL,
-                        s->write_poll && s->enabled ? tap_writable : NULL,
-                        s);
+    tap_set_fd_handler(s, s->nc.ctx);
 }
 
 static void tap_read_poll(TAPState *s, bool enable)
@@ -94,9 +99,11 @@ static void tap_writable(void *opaque)
 {
     TAPState *s = opaque;
 
+    qemu_net_client_lock(&s->nc);
     tap_write_poll(s, false);
 
     qemu_flush_queued_packets(&s->nc);
+    qemu_net_client_unlock(&s->nc);
 }
 
 static ssize_t tap_write_packet(TAPState *s, const struct iovec *iov, int iovcnt)
@@ -188,6 +195,9 @@ static void tap_send(void *opaque)
     int size;
     int packets = 0;
 
+    qemu_net_client_lock(&s->nc);
+    qemu_send_batch_begin(&s->nc);
+
     while (true) {
         uint8_t *buf = s->buf;
         uint8_t min_pkt[ETH_ZLEN];
@@ -229,6 +239,23 @@ static void tap_send(void *opaque)
             break;
         }
     }
+
+    qemu_send_batch_end(&s->nc);
+    qemu_net_client_unlock(&s->nc);
+}
+
+/* Move the fd handlers to @ctx; nc->ctx still holds the old context. */
+static void tap_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    if (s->fd < 0) {
+        return;
+    }
+
+    aio_set_fd_handler(nc->ctx ? nc->ctx : iohandler_get_aio_context(),
+                       s->fd, false, NULL, NULL, NULL, NULL);
+    tap_set_fd_handler(s, ctx);
 }
 
 static bool tap_has_ufo(NetClientState *nc)
@@ -381,6 +408,7 @@ static NetClientInfo net_tap_info = {
     .set_vnet_le = tap_set_vnet_le,
     .set_vnet_be = tap_set_vnet_be,
     .set_steering_ebpf = tap_set_steering_ebpf,
+    .set_aio_context = tap_set_aio_context,
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
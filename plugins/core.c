@@ -211,10 +211,115 @@ plugin_register_cb_udata(qemu_plugin_id_t id, enum qemu_plugin_event ev,
     do_plugin_register_cb(id, ev, func, udata);
 }
 
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size)
+{
+    struct qemu_plugin_scoreboard *score;
+
+    score = g_new0(struct qemu_plugin_scoreboard, 1);
+    score->element_size = element_size;
+    score->stride = ROUND_UP(MAX(element_size, 1), qemu_dcache_linesize);
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    if (plugin.scoreboard_alloc_size) {
+        size_t size = score->stride * plugin.scoreboard_alloc_size;
+
+        score->data = qemu_memalign(qemu_dcache_linesize, size);
+        memset(score->data, 0, size);
+    }
+    QLIST_INSERT_HEAD(&plugin.scoreboards, score, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    return score;
+}
+
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_REMOVE(score, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    qemu_vfree(score->data);
+    g_free(score);
+}
+
+void *plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                             unsigned int vcpu_index)
+{
+    g_assert(vcpu_index < plugin.scoreboard_alloc_size);
+    return score->data + vcpu_index * score->stride;
+}
+
+int plugin_num_vcpus(void)
+{
+    return qatomic_read(&plugin.num_vcpus);
+}
+
+static void plugin_grow_scoreboards__locked(size_t alloc_size)
+{
+    struct qemu_plugin_scoreboard *score;
+    size_t old_alloc_size = plugin.scoreboard_alloc_size;
+
+    QLIST_FOREACH(score, &plugin.scoreboards, entry) {
+        size_t old_size = score->stride * old_alloc_size;
+        size_t size = score->stride * alloc_size;
+        void *data = qemu_memalign(qemu_dcache_linesize, size);
+
+        if (old_size) {
+            memcpy(data, score->data, old_size);
+        }
+        memset(data + old_size, 0, size - old_size);
+        qemu_vfree(score->data);
+        score->data = data;
+    }
+    plugin.scoreboard_alloc_size = alloc_size;
+}
+
+/*
+ * Make room for @cpu in the scoreboards. In system mode they are sized
+ * once for all the vCPUs the machine can have, before any of them runs.
+ * In user mode, threads are created while other vCPUs execute code that
+ * may be updating the scoreboards, so those are stopped for the copy.
+ */
+static void plugin_grow_scoreboards(CPUState *cpu)
+{
+    size_t needed = cpu->cpu_index + 1;
+    size_t alloc_size;
+    bool exclusive = false;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    qatomic_set(&plugin.num_vcpus, MAX(plugin.num_vcpus, cpu->cpu_index + 1));
+    alloc_size = plugin.scoreboard_alloc_size;
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    if (needed <= alloc_size) {
+        return;
+    }
+#ifdef CONFIG_USER_ONLY
+    alloc_size = MAX(alloc_size * 2, needed);
+    exclusive = current_cpu != NULL;
+#else
+    alloc_size = MAX((size_t)qemu_plugin_n_max_vcpus(), needed);
+#endif
+
+    if (exclusive) {
+        start_exclusive();
+    }
+    qemu_rec_mutex_lock(&plugin.lock);
+    if (needed > plugin.scoreboard_alloc_size) {
+        plugin_grow_scoreboards__locked(alloc_size);
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+    if (exclusive) {
+        end_exclusive();
+    }
+}
+
 void qemu_plugin_vcpu_init_hook(CPUState *cpu)
 {
     bool success;
 
+    plugin_grow_scoreboards(cpu);
+
     qemu_rec_mutex_lock(&plugin.lock);
     plugin_cpu_update__locked(&cpu->cpu_index, NULL, NULL);
     success = g_hash_table_insert(plugin.cpu_ht, &cpu->cpu_index,
@@ -293,6 +398,24 @@ void plugin_register_inline_op(GArray **arr,
     dyn_cb->rw = rw;
     dyn_cb->inline_insn.op = op;
     dyn_cb->inline_insn.imm = imm;
+    dyn_cb->inline_insn.entry.score = NULL;
+}
+
+void plugin_register_inline_op_per_vcpu(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        qemu_plugin_u64 entry,
+                                        uint64_t imm)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->userp = NULL;
+    dyn_cb->type = PLUGIN_CB_INLINE;
+    dyn_cb->rw = rw;
+    dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.imm = imm;
+    dyn_cb->inline_insn.entry = entry;
 }
 
 void plugin_register_dyn_cb__udata(GArray **arr,
@@ -433,14 +556,29 @@ void qemu_plugin_flush_cb(void)
     plugin_cb__simple(QEMU_PLUGIN_EV_FLUSH);
 }
 
-void exec_inline_op(struct qemu_plugin_dyn_cb *cb)
+void exec_inline_op(struct qemu_plugin_dyn_cb *cb, int cpu_index,
+                    uint64_t vaddr, uint32_t info)
 {
+    qemu_plugin_u64 entry = cb->inline_insn.entry;
     uint64_t *val = cb->userp;
 
+    if (entry.score) {
+        val = plugin_scoreboard_find(entry.score, cpu_index) + entry.offset;
+    }
+
     switch (cb->inline_insn.op) {
     case QEMU_PLUGIN_INLINE_ADD_U64:
         *val += cb->inline_insn.imm;
         break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        *val = cb->inline_insn.imm;
+        break;
+    case QEMU_PLUGIN_INLINE_STORE_VADDR:
+        *val = vaddr;
+        break;
+    case QEMU_PLUGIN_INLINE_STORE_MEMINFO:
+        *val = info;
+        break;
     default:
         g_assert_not_reached();
     }
@@ -467,7 +605,7 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t info)
             cb->f.vcpu_mem(cpu->cpu_index, info, vaddr, cb->userp);
             break;
         case PLUGIN_CB_INLINE:
-            exec_inline_op(cb);
+            exec_inline_op(cb, cpu->cpu_index, vaddr, info);
             break;
         default:
             g_assert_not_reached();
@@ -513,6 +651,7 @@ static void __attribute__((__constructor__)) plugin_init(void)
     plugin.id_ht = g_hash_table_new(g_int64_hash, g_int64_equal);
     plugin.cpu_ht = g_hash_table_new(g_int_hash, g_int_equal);
     QTAILQ_INIT(&plugin.ctxs);
+    QLIST_INIT(&plugin.scoreboards);
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
              QHT_MODE_AUTO_RESIZE);
     atexit(qemu_plugin_atexit_cb);
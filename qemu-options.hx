@@ -141,6 +141,11 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                tb-evict=on|off (evict old translations instead of flushing, default=off)\n"
+    "                tb-trace=n (retranslate blocks as traces after n executions, default=0)\n"
+    "                tb-bg-threads=n (threads translating code ahead of the vCPUs, default=0)\n"
+    "                perfmap=on|off (write perf map of translated code, default=off)\n"
+    "                jitdump=on|off (write perf jitdump of translated code, default=off)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
@@ -175,6 +180,48 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``tb-evict=on|off``
+        When the TCG translation block cache is full, only throw away the
+        oldest translations instead of flushing the whole cache. The cache
+        is split into regions and the regions that were filled first are
+        reclaimed, so that code that is still in use does not need to be
+        translated again all at once. (default=off)
+
+    ``tb-trace=n``
+        Once a translation block has run ``n`` times, translate it again
+        together with the blocks it most often jumps to, following the
+        direct jumps that have been chained from it. The resulting trace
+        avoids the jumps between the blocks; where a block falls through
+        into the next one, the TCG optimizer and register allocator also
+        work across the two. Traces only contain blocks that come after the
+        first one in the same guest page, and are not built with icount,
+        plugins, breakpoints or single-stepping.
+        0 disables traces. (default=0)
+
+    ``tb-bg-threads=n``
+        Start ``n`` threads that translate guest code before the vCPUs
+        need it. When a vCPU translates a block, the blocks that follow
+        it in the same guest page are translated in the background, which
+        hides part of the translation cost of freshly loaded code. Only
+        available in system emulation with ``thread=multi``, not for
+        aarch64 targets, and not used with plugins, breakpoints or
+        single-stepping. 0 disables it. (default=0)
+
+    ``perfmap=on|off``
+        Write ``/tmp/perf-<pid>.map`` with one entry for every translation
+        block, naming it after the guest address and, if the guest symbols
+        are known, the guest function. This lets ``perf report`` attribute
+        samples in translated code without any post-processing. Only
+        supported on Linux hosts. (default=off)
+
+    ``jitdump=on|off``
+        Write ``jit-<pid>.dump`` to the temporary directory, with the host
+        code and the guest address of every guest instruction in each
+        translation block. Record with ``perf record -k 1`` and merge the
+        file into the profile with ``perf inject -j``, after which ``perf
+        annotate`` can show the translated code. Only supported on Linux
+        hosts. (default=off)
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
@@ -2576,6 +2623,13 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                VALE port (created on the fly) called 'name' ('nmname' is name of the \n"
     "                netmap device, defaults to '/dev/netmap')\n"
 #endif
+#ifdef CONFIG_AF_XDP
+    "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
+    "         [,queues=n][,start-queue=m]\n"
+    "                attach to the existing network interface 'name' with AF_XDP\n"
+    "                sockets bound to host queues 'm' to 'm+n-1'; 'mode' selects how\n"
+    "                the XDP program is attached (default: native, then skb)\n"
+#endif
 #ifdef CONFIG_POSIX
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
     "                configure a vhost-user network, backed by a chardev 'dev'\n"
@@ -2600,6 +2654,9 @@ DEF("nic", HAS_ARG, QEMU_OPTION_nic,
 #ifdef CONFIG_NETMAP
     "netmap|"
 #endif
+#ifdef CONFIG_AF_XDP
+    "af-xdp|"
+#endif
 #ifdef CONFIG_POSIX
     "vhost-user|"
 #endif
@@ -2629,7 +2686,7 @@ DEF("net", HAS_ARG, QEMU_OPTION_net,
     "                old way to initialize a host network interface\n"
     "                (use the -netdev option if possible instead)\n", QEMU_ARCH_ALL)
 SRST
-``-nic [tap|bridge|user|l2tpv3|vde|netmap|vhost-user|socket][,...][,mac=macaddr][,model=mn]``
+``-nic [tap|bridge|user|l2tpv3|vde|netmap|af-xdp|vhost-user|socket][,...][,mac=macaddr][,model=mn]``
     This option is a shortcut for configuring both the on-board
     (default) guest NIC hardware and the host network backend in one go.
     The host backend options are the same as with the corresponding
@@ -3043,7 +3100,31 @@ SRST
         # launch QEMU instance
         |qemu_system| linux.img -nic vde,sock=/tmp/myswitch
 
-``-netdev vhost-user,chardev=id[,vhostforce=on|off][,queues=n]``
+``-netdev af-xdp,id=id,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m]``
+    Attach to the host network interface ifname using AF_XDP sockets.
+    Packets are exchanged through rings and a packet buffer area
+    (UMEM) shared between the kernel and QEMU, bypassing most of the
+    host network stack. Each of the n queue pairs binds to one host
+    interface queue, starting at queue m. ``mode`` selects whether the
+    XDP program that steers packets to QEMU runs in the driver
+    (native) or in the generic stack (skb); by default native mode is
+    tried first. ``force-copy=on`` disables zero copy even on drivers
+    that support it. The interface must not be in use by another XDP
+    program, and QEMU needs CAP_NET_ADMIN and CAP_SYS_ADMIN (or
+    CAP_BPF) to set it up. This option is only available if QEMU has
+    been compiled with AF_XDP support.
+
+    Example:
+
+    .. parsed-literal::
+
+        # create a veth pair and attach QEMU to one end
+        ip link add veth0 type veth peer name veth1
+        ip link set veth0 up
+        ip link set veth1 up
+        |qemu_system| linux.img -device virtio-net-pci,netdev=n1 \\
+            -netdev af-xdp,id=n1,ifname=veth0,mode=skb
+
     Establish a vhost-user netdev, backed by a chardev id. The chardev
     should be a unix domain socket backed one. The vhost-user uses a
     specifically defined protocol to pass vhost ioctl replacement
@@ -4114,13 +4195,14 @@ SRST
 ERST
 
 DEF("icount", HAS_ARG, QEMU_OPTION_icount, \
-    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>]]\n" \
+    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,quantum=N][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>]]\n" \
     "                enable virtual instruction counter with 2^N clock ticks per\n" \
     "                instruction, enable aligning the host and virtual clocks\n" \
-    "                or disable real time cpu sleeping, and optionally enable\n" \
-    "                record-and-replay mode\n", QEMU_ARCH_ALL)
+    "                or disable real time cpu sleeping, set the number of\n" \
+    "                instructions that each vCPU thread runs before synchronizing\n" \
+    "                with the others, and optionally enable record-and-replay mode\n", QEMU_ARCH_ALL)
 SRST
-``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot]]``
+``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,quantum=N][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot]]``
     Enable virtual instruction counter. The virtual cpu will execute one
     instruction every 2^N ns of virtual time. If ``auto`` is specified
     then the virtual cpu speed will be automatically adjusted to keep
@@ -4154,6 +4236,16 @@ SRST
     depends on the host machine). The default if icount is enabled
     is ``align=off``.
 
+    By default all vCPUs run in a single thread when icount is enabled.
+    With ``-accel tcg,thread=multi`` each vCPU gets its own thread and
+    counts its own instructions; virtual time then advances in quanta of
+    at most ``quantum`` instructions (default 10000), and a vCPU that is
+    done with a quantum waits for the others before starting the next
+    one. Timers are accurate to the instruction for the vCPU that reads
+    them, but the interleaving of the vCPUs within a quantum is not
+    deterministic. This mode cannot be used together with ``rr``, and
+    ``quantum`` is rejected without it.
+
     When the ``rr`` option is specified deterministic record/replay is
     enabled. The ``rrfile=`` option must also be provided to
     specify the path to the replay log. In record mode data is written
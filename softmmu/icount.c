@@ -58,6 +58,15 @@ static bool icount_sleep = true;
  */
 int use_icount;
 
+/*
+ * Parallel icount: each vCPU thread counts its own instructions in
+ * cpu->icount_local, and timers_state.qemu_icount only advances when
+ * all of them are done with the current quantum.
+ */
+static bool icount_parallel;
+static int64_t icount_quantum_max = ICOUNT_QUANTUM_DEFAULT;
+static bool icount_quantum_set;
+
 static void icount_enable_precise(void)
 {
     use_icount = 1;
@@ -89,6 +98,10 @@ static void icount_update_locked(CPUState *cpu)
     int64_t executed = icount_get_executed(cpu);
     cpu->icount_budget -= executed;
 
+    if (icount_parallel) {
+        cpu->icount_local += executed;
+        return;
+    }
     qatomic_set_i64(&timers_state.qemu_icount,
                     timers_state.qemu_icount + executed);
 }
@@ -110,6 +123,7 @@ void icount_update(CPUState *cpu)
 static int64_t icount_get_raw_locked(void)
 {
     CPUState *cpu = current_cpu;
+    int64_t local = 0;
 
     if (cpu && cpu->running) {
         if (!cpu->can_do_io) {
@@ -119,8 +133,12 @@ static int64_t icount_get_raw_locked(void)
         /* Take into account what has run */
         icount_update_locked(cpu);
     }
+    /* A vCPU sees its own progress in the current quantum */
+    if (icount_parallel && cpu) {
+        local = cpu->icount_local;
+    }
     /* The read is protected by the seqlock, but needs atomic64 to avoid UB */
-    return qatomic_read_i64(&timers_state.qemu_icount);
+    return qatomic_read_i64(&timers_state.qemu_icount) + local;
 }
 
 static int64_t icount_get_locked(void)
@@ -157,6 +175,37 @@ int64_t icount_get(void)
     return icount;
 }
 
+void icount_enable_parallel(void)
+{
+    assert(icount_enabled());
+    icount_parallel = true;
+}
+
+bool icount_parallel_enabled(void)
+{
+    return icount_parallel;
+}
+
+int64_t icount_quantum(void)
+{
+    return icount_quantum_max;
+}
+
+bool icount_quantum_configured(void)
+{
+    return icount_quantum_set;
+}
+
+void icount_account_quantum(int64_t insns)
+{
+    seqlock_write_lock(&timers_state.vm_clock_seqlock,
+                       &timers_state.vm_clock_lock);
+    qatomic_set_i64(&timers_state.qemu_icount,
+                    timers_state.qemu_icount + insns);
+    seqlock_write_unlock(&timers_state.vm_clock_seqlock,
+                         &timers_state.vm_clock_lock);
+}
+
 int64_t icount_to_ns(int64_t icount)
 {
     return icount << qatomic_read(&timers_state.icount_time_shift);
@@ -419,6 +468,8 @@ void icount_configure(QemuOpts *opts, Error **errp)
     const char *option = qemu_opt_get(opts, "shift");
     bool sleep = qemu_opt_get_bool(opts, "sleep", true);
     bool align = qemu_opt_get_bool(opts, "align", false);
+    uint64_t quantum = qemu_opt_get_number(opts, "quantum",
+                                           ICOUNT_QUANTUM_DEFAULT);
     long time_shift = -1;
 
     if (!option) {
@@ -433,6 +484,11 @@ void icount_configure(QemuOpts *opts, Error **errp)
         return;
     }
 
+    if (quantum == 0 || quantum > INT32_MAX) {
+        error_setg(errp, "icount: Invalid quantum value");
+        return;
+    }
+
     if (strcmp(option, "auto") != 0) {
         if (qemu_strtol(option, NULL, 0, &time_shift) < 0
             || time_shift < 0 || time_shift > MAX_ICOUNT_SHIFT) {
@@ -454,6 +510,8 @@ void icount_configure(QemuOpts *opts, Error **errp)
     }
 
     icount_align_option = align;
+    icount_quantum_max = quantum;
+    icount_quantum_set = qemu_opt_get(opts, "quantum") != NULL;
 
     if (time_shift >= 0) {
         timers_state.icount_time_shift = time_shift;
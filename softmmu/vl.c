@@ -434,6 +434,9 @@ static QemuOptsList qemu_icount_opts = {
         }, {
             .name = "sleep",
             .type = QEMU_OPT_BOOL,
+        }, {
+            .name = "quantum",
+            .type = QEMU_OPT_NUMBER,
         }, {
             .name = "rr",
             .type = QEMU_OPT_STRING,
@@ -2365,6 +2368,11 @@ static void configure_accelerators(const char *progname)
         error_report("-icount is not allowed with hardware virtualization");
         exit(1);
     }
+
+    if (icount_quantum_configured() && !icount_parallel_enabled()) {
+        error_report("-icount quantum requires -accel tcg,thread=multi");
+        exit(1);
+    }
 }
 
 static void create_default_memdev(MachineState *ms, const char *path)
@@ -0,0 +1,331 @@
+/*
+ * Linux perf perf-<pid>.map and jit-<pid>.dump integration.
+ *
+ * The perf map format is described in tools/perf/Documentation/jit-interface.txt
+ * and the jitdump format in tools/perf/Documentation/jitdump-specification.txt
+ * of the Linux kernel sources.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "elf.h"
+#include "exec/exec-all.h"
+#include "disas/disas.h"
+#include "qemu/error-report.h"
+#include "qemu/timer.h"
+#include "tcg/tcg.h"
+#include "tcg/perf.h"
+
+static bool perf_atexit_registered;
+
+static void perf_register_atexit(void)
+{
+    if (!perf_atexit_registered) {
+        atexit(perf_exit);
+        perf_atexit_registered = true;
+    }
+}
+
+static FILE *safe_fopen_w(const char *path)
+{
+    int saved_errno;
+    FILE *f;
+    int fd;
+
+    /* Delete the old file, if any. */
+    unlink(path);
+
+    /* Avoid symlink attacks by using O_CREAT | O_EXCL. */
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    f = fdopen(fd, "w");
+    if (f == NULL) {
+        saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    return f;
+}
+
+/* Describe the guest code of @tb, e.g. "guest-0x401000 main". */
+static char *perf_tb_name(TranslationBlock *tb)
+{
+    const char *symbol = lookup_symbol(tb->pc);
+
+    return g_strdup_printf("guest-0x" TARGET_FMT_lx "%s%s", tb->pc,
+                           symbol[0] ? " " : "", symbol);
+}
+
+static FILE *perfmap;
+
+void perf_enable_perfmap(void)
+{
+    g_autofree char *map_file = g_strdup_printf("/tmp/perf-%d.map",
+                                                getpid());
+
+    perfmap = safe_fopen_w(map_file);
+    if (perfmap == NULL) {
+        warn_report("Could not open %s: %s, proceeding without perfmap",
+                    map_file, strerror(errno));
+        return;
+    }
+    perf_register_atexit();
+}
+
+/* jitdump file header, all fields in host byte order */
+struct jitheader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+#define JITHEADER_MAGIC 0x4A695444 /* "JiTD" */
+#define JITHEADER_VERSION 1
+
+enum jit_record_type {
+    JIT_CODE_LOAD = 0,
+    JIT_CODE_DEBUG_INFO = 2,
+};
+
+struct jr_prefix {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+
+struct jr_code_load {
+    struct jr_prefix p;
+
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+    /* followed by the NUL-terminated name and the code */
+};
+
+struct debug_entry {
+    uint64_t addr;
+    uint32_t lineno;
+    uint32_t discrim;
+    /* followed by the NUL-terminated file name */
+};
+
+struct jr_code_debug_info {
+    struct jr_prefix p;
+
+    uint64_t code_addr;
+    uint64_t nr_entry;
+    /* followed by nr_entry debug entries */
+};
+
+static FILE *jitdump;
+static void *perf_marker = MAP_FAILED;
+static size_t perf_marker_size;
+static uint64_t jitdump_code_index;
+
+static uint32_t get_e_machine(void)
+{
+    Elf64_Ehdr elf_header;
+    FILE *exe;
+    size_t n;
+
+    QEMU_BUILD_BUG_ON(offsetof(Elf32_Ehdr, e_machine) !=
+                      offsetof(Elf64_Ehdr, e_machine));
+
+    exe = fopen("/proc/self/exe", "r");
+    if (exe == NULL) {
+        return EM_NONE;
+    }
+
+    n = fread(&elf_header, sizeof(elf_header), 1, exe);
+    fclose(exe);
+    if (n != 1) {
+        return EM_NONE;
+    }
+
+    return elf_header.e_machine;
+}
+
+/* perf record -k 1 timestamps samples with CLOCK_MONOTONIC */
+static uint64_t get_timestamp(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NANOSECONDS_PER_SECOND + ts.tv_nsec;
+}
+
+void perf_enable_jitdump(void)
+{
+    g_autofree char *jitdump_file = g_strdup_printf("%s/jit-%d.dump",
+                                                    g_get_tmp_dir(),
+                                                    getpid());
+    struct jitheader header;
+
+    jitdump = safe_fopen_w(jitdump_file);
+    if (jitdump == NULL) {
+        warn_report("Could not open %s: %s, proceeding without jitdump",
+                    jitdump_file, strerror(errno));
+        return;
+    }
+
+    /*
+     * perf inject finds the jitdump file through an executable mapping
+     * of it in the perf.data file, so it does not matter what is mapped.
+     */
+    perf_marker_size = qemu_real_host_page_size;
+    perf_marker = mmap(NULL, perf_marker_size, PROT_READ | PROT_EXEC,
+                       MAP_PRIVATE, fileno(jitdump), 0);
+    if (perf_marker == MAP_FAILED) {
+        warn_report("Could not map %s: %s, proceeding without jitdump",
+                    jitdump_file, strerror(errno));
+        fclose(jitdump);
+        jitdump = NULL;
+        return;
+    }
+
+    header = (struct jitheader) {
+        .magic = JITHEADER_MAGIC,
+        .version = JITHEADER_VERSION,
+        .total_size = sizeof(header),
+        .elf_mach = get_e_machine(),
+        .pid = getpid(),
+        .timestamp = get_timestamp(),
+    };
+    fwrite(&header, sizeof(header), 1, jitdump);
+    perf_register_atexit();
+}
+
+/* Call with jitdump locked */
+static void write_jr_code_load(const void *start, size_t size,
+                               const char *name)
+{
+    size_t name_size = strlen(name) + 1;
+    struct jr_code_load rec = {
+        .p.id = JIT_CODE_LOAD,
+        .p.total_size = sizeof(rec) + name_size + size,
+        .p.timestamp = get_timestamp(),
+        .pid = getpid(),
+        .tid = qemu_get_thread_id(),
+        .vma = (uintptr_t)start,
+        .code_addr = (uintptr_t)start,
+        .code_size = size,
+        .code_index = jitdump_code_index++,
+    };
+
+    fwrite(&rec, sizeof(rec), 1, jitdump);
+    fwrite(name, name_size, 1, jitdump);
+    fwrite(start, size, 1, jitdump);
+}
+
+/*
+ * Map the host code of every guest instruction in @tb to a "file" named
+ * after the guest address of the instruction, so that perf annotate and
+ * perf report -F srcline show where the samples come from in the guest.
+ * Call with jitdump locked.
+ */
+static void write_jr_code_debug_info(TranslationBlock *tb)
+{
+    g_autofree char **names = g_new(char *, tb->icount);
+    struct jr_code_debug_info rec = {
+        .p.id = JIT_CODE_DEBUG_INFO,
+        .p.total_size = sizeof(rec),
+        .p.timestamp = get_timestamp(),
+        .code_addr = (uintptr_t)tb->tc.ptr,
+        .nr_entry = tb->icount,
+    };
+    size_t insn_start = 0;
+    int i;
+
+    for (i = 0; i < tb->icount; i++) {
+        names[i] = g_strdup_printf("guest-0x" TARGET_FMT_lx,
+                                   tcg_ctx->gen_insn_data[i][0]);
+        rec.p.total_size += sizeof(struct debug_entry) + strlen(names[i]) + 1;
+    }
+
+    fwrite(&rec, sizeof(rec), 1, jitdump);
+    for (i = 0; i < tb->icount; i++) {
+        struct debug_entry ent = {
+            .addr = (uintptr_t)tb->tc.ptr + insn_start,
+            .lineno = 1,
+        };
+
+        fwrite(&ent, sizeof(ent), 1, jitdump);
+        fwrite(names[i], strlen(names[i]) + 1, 1, jitdump);
+        g_free(names[i]);
+        insn_start = tcg_ctx->gen_insn_end_off[i];
+    }
+}
+
+void perf_report_prologue(const void *start, size_t size)
+{
+    if (perfmap) {
+        fprintf(perfmap, "%" PRIxPTR " %zx tcg-prologue-buffer\n",
+                (uintptr_t)start, size);
+    }
+    if (jitdump) {
+        flockfile(jitdump);
+        write_jr_code_load(start, size, "tcg-prologue-buffer");
+        funlockfile(jitdump);
+    }
+}
+
+/*
+ * With @debug_info, called right after @tb was generated, while tcg_ctx
+ * still describes its guest instructions.  TBs that were not just
+ * generated, such as those restored from the persistent TB cache, only
+ * get a code load record.
+ */
+void perf_report_code(TranslationBlock *tb, bool debug_info)
+{
+    g_autofree char *name = NULL;
+
+    if (!perfmap && !jitdump) {
+        return;
+    }
+
+    name = perf_tb_name(tb);
+    if (perfmap) {
+        fprintf(perfmap, "%" PRIxPTR " %zx %s\n",
+                (uintptr_t)tb->tc.ptr, tb->tc.size, name);
+    }
+    if (jitdump) {
+        flockfile(jitdump);
+        if (debug_info) {
+            write_jr_code_debug_info(tb);
+        }
+        write_jr_code_load(tb->tc.ptr, tb->tc.size, name);
+        funlockfile(jitdump);
+    }
+}
+
+void perf_exit(void)
+{
+    if (perfmap) {
+        fclose(perfmap);
+        perfmap = NULL;
+    }
+
+    if (perf_marker != MAP_FAILED) {
+        munmap(perf_marker, perf_marker_size);
+        perf_marker = MAP_FAILED;
+    }
+
+    if (jitdump) {
+        fclose(jitdump);
+        jitdump = NULL;
+    }
+}
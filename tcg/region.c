@@ -27,6 +27,7 @@
 #include "qapi/error.h"
 #include "exec/exec-all.h"
 #include "tcg/tcg.h"
+#include "tcg/perf.h"
 #include "tcg-internal.h"
 
 
@@ -52,12 +53,32 @@ struct tcg_region_state {
     size_t size; /* size of one region */
     size_t stride; /* .size + guard size */
     size_t total_size; /* size of entire buffer, >= n * stride */
+    void *buffer_hint; /* preferred address of the buffer, or NULL */
 
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+
+    /*
+     * Partial eviction: regions that have been filled are reclaimed
+     * oldest first by tcg_region_evict() and go to the free list.
+     */
+    bool evict;
+    struct tcg_region_info *info; /* one per region */
+    size_t *free_list;
+    size_t n_free;
+    uint64_t seq; /* orders full regions by age */
 };
 
+struct tcg_region_info {
+    bool full; /* filled and not in use by any context */
+    uint64_t seq;
+    size_t size_full; /* accounted in agg_size_full */
+};
+
+/* Fraction of the regions that tcg_region_evict() reclaims at once */
+#define TCG_REGION_EVICT_RATIO 4
+
 static struct tcg_region_state region;
 
 /*
@@ -68,6 +89,16 @@ static struct tcg_region_state region;
 static void *region_trees;
 static size_t tree_size;
 
+/*
+ * Ask for the code_gen_buffer to be mapped at @hint, if that range is
+ * available.  This is only a hint: callers must check where the buffer
+ * ended up.  Must be called before tcg_region_init().
+ */
+void tcg_region_set_buffer_hint(void *hint)
+{
+    region.buffer_hint = hint;
+}
+
 bool in_code_gen_buffer(const void *p)
 {
     /*
@@ -157,10 +188,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+/* Returns the index of the region containing @p, a pointer in the rw buffer */
+static size_t tcg_region_index(const void *p)
 {
-    size_t region_idx;
+    if (p < region.start_aligned) {
+        return 0;
+    } else {
+        ptrdiff_t offset = p - region.start_aligned;
+
+        if (offset > region.stride * (region.n - 1)) {
+            return region.n - 1;
+        }
+        return offset / region.stride;
+    }
+}
 
+static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+{
     /*
      * Like tcg_splitwx_to_rw, with no assert.  The pc may come from
      * a signal handler over which the caller has no control.
@@ -172,18 +216,7 @@ static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
         }
     }
 
-    if (p < region.start_aligned) {
-        region_idx = 0;
-    } else {
-        ptrdiff_t offset = p - region.start_aligned;
-
-        if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
-        }
-    }
-    return region_trees + region_idx * tree_size;
+    return region_trees + tcg_region_index(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -285,6 +318,15 @@ static gboolean tcg_region_tree_traverse(gpointer k, gpointer v, gpointer data)
     return FALSE;
 }
 
+/* Call with rt->lock held */
+static void tcg_region_tree_reset(struct tcg_region_tree *rt)
+{
+    g_tree_foreach(rt->tree, tcg_region_tree_traverse, NULL);
+    /* Increment the refcount first so that destroy acts as a reset */
+    g_tree_ref(rt->tree);
+    g_tree_destroy(rt->tree);
+}
+
 static void tcg_region_tree_reset_all(void)
 {
     size_t i;
@@ -293,10 +335,7 @@ static void tcg_region_tree_reset_all(void)
     for (i = 0; i < region.n; i++) {
         struct tcg_region_tree *rt = region_trees + i * tree_size;
 
-        g_tree_foreach(rt->tree, tcg_region_tree_traverse, NULL);
-        /* Increment the refcount first so that destroy acts as a reset */
-        g_tree_ref(rt->tree);
-        g_tree_destroy(rt->tree);
+        tcg_region_tree_reset(rt);
     }
     tcg_region_tree_unlock_all();
 }
@@ -335,7 +374,12 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
     if (region.current == region.n) {
-        return true;
+        /* Only partial eviction puts regions back on the free list */
+        if (region.n_free == 0) {
+            return true;
+        }
+        tcg_region_assign(s, region.free_list[--region.n_free]);
+        return false;
     }
     tcg_region_assign(s, region.current);
     region.current++;
@@ -351,11 +395,19 @@ bool tcg_region_alloc(TCGContext *s)
     bool err;
     /* read the region size now; alloc__locked will overwrite it on success */
     size_t size_full = s->code_gen_buffer_size;
+    size_t full_idx = tcg_region_index(s->code_gen_buffer);
 
     qemu_mutex_lock(&region.lock);
     err = tcg_region_alloc__locked(s);
     if (!err) {
         region.agg_size_full += size_full - TCG_HIGHWATER;
+        if (region.evict) {
+            struct tcg_region_info *info = &region.info[full_idx];
+
+            info->full = true;
+            info->seq = region.seq++;
+            info->size_full = size_full - TCG_HIGHWATER;
+        }
     }
     qemu_mutex_unlock(&region.lock);
     return err;
@@ -387,6 +439,10 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.n_free = 0;
+    if (region.evict) {
+        memset(region.info, 0, region.n * sizeof(*region.info));
+    }
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -397,13 +453,97 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
-static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
+bool tcg_region_evict_enabled(void)
+{
+    return region.evict;
+}
+
+/* Returns true if a context that runs out of space can get a new region */
+bool tcg_region_has_free(void)
 {
+    bool ret;
+
+    qemu_mutex_lock(&region.lock);
+    ret = region.current < region.n || region.n_free > 0;
+    qemu_mutex_unlock(&region.lock);
+    return ret;
+}
+
+/*
+ * Reclaim the regions that were filled first, i.e. those holding the
+ * oldest translations, and make them available to tcg_region_alloc().
+ * @evict_tb is called for every TB in those regions before the regions
+ * are reused; it must unlink the TB from everything that may still
+ * refer to it.  Regions that a context is filling are never reclaimed.
+ *
+ * Call from a safe-work context.
+ * Returns the number of regions reclaimed.
+ */
+size_t tcg_region_evict(GTraverseFunc evict_tb)
+{
+    size_t n_evict = MAX(region.n / TCG_REGION_EVICT_RATIO, 1);
+    size_t *victims = g_new(size_t, n_evict);
+    size_t n_victims = 0;
+    size_t i;
+
+    g_assert(region.evict);
+
+    qemu_mutex_lock(&region.lock);
+    while (n_victims < n_evict) {
+        size_t oldest = region.n;
+
+        for (i = 0; i < region.n; i++) {
+            if (region.info[i].full &&
+                (oldest == region.n ||
+                 region.info[i].seq < region.info[oldest].seq)) {
+                oldest = i;
+            }
+        }
+        if (oldest == region.n) {
+            break;
+        }
+        region.info[oldest].full = false;
+        region.agg_size_full -= region.info[oldest].size_full;
+        victims[n_victims++] = oldest;
+    }
+    qemu_mutex_unlock(&region.lock);
+
+    for (i = 0; i < n_victims; i++) {
+        struct tcg_region_tree *rt = region_trees + victims[i] * tree_size;
+
+        qemu_mutex_lock(&rt->lock);
+        g_tree_foreach(rt->tree, evict_tb, NULL);
+        tcg_region_tree_reset(rt);
+        qemu_mutex_unlock(&rt->lock);
+    }
+
+    qemu_mutex_lock(&region.lock);
+    for (i = 0; i < n_victims; i++) {
+        region.free_list[region.n_free++] = victims[i];
+    }
+    qemu_mutex_unlock(&region.lock);
+
+    g_free(victims);
+    return n_victims;
+}
+
+static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus, bool evict)
+{
+    size_t n_regions;
+
+    /*
+     * Partial eviction needs full regions to reclaim while every context
+     * keeps filling its own, so always use several regions, even in
+     * user-mode and with a single vCPU thread.
+     */
+    if (evict) {
+        n_regions = MIN(tb_size / (2 * MiB), MAX(max_cpus, 1) * 8);
+        return MAX(n_regions, MAX(max_cpus, 1));
+    }
+
 #ifdef CONFIG_USER_ONLY
     return 1;
 #else
-    size_t n_regions;
-
     /*
      * It is likely that some vCPUs will translate more code than others,
      * so we first try to set more regions than max_cpus, with those regions
@@ -569,7 +709,7 @@ static int alloc_code_gen_buffer_anon(size_t size, int prot,
 {
     void *buf;
 
-    buf = mmap(NULL, size, prot, flags, -1, 0);
+    buf = mmap(region.buffer_hint, size, prot, flags, -1, 0);
     if (buf == MAP_FAILED) {
         error_setg_errno(errp, errno,
                          "allocate %zu bytes for jit buffer", size);
@@ -817,7 +957,8 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
  * in practice. Multi-threaded guests share most if not all of their translated
  * code, which makes parallel code generation less appealing than in softmmu.
  */
-void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
+void tcg_region_init(size_t tb_size, int splitwx, bool evict,
+                     unsigned max_cpus)
 {
     const size_t page_size = qemu_real_host_page_size;
     size_t region_size;
@@ -855,7 +996,7 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
      * As a result of this we might end up with a few extra pages at the end of
      * the buffer; we will assign those to the last region.
      */
-    region.n = tcg_n_regions(tb_size, max_cpus);
+    region.n = tcg_n_regions(tb_size, max_cpus, evict);
     region_size = tb_size / region.n;
     region_size = QEMU_ALIGN_DOWN(region_size, page_size);
 
@@ -876,6 +1017,11 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
 
     /* init the region struct */
     qemu_mutex_init(&region.lock);
+    region.evict = evict;
+    if (evict) {
+        region.info = g_new0(struct tcg_region_info, region.n);
+        region.free_list = g_new(size_t, region.n);
+    }
 
     /*
      * Set guard pages in the rw buffer, as that's the one into which
@@ -937,6 +1083,9 @@ void tcg_region_prologue_set(TCGContext *s)
     tcg_register_jit(tcg_splitwx_to_rx(region.after_prologue),
                      region.start_aligned + region.total_size -
                      region.after_prologue);
+
+    perf_report_prologue(tcg_splitwx_to_rx(region.start_aligned),
+                         region.after_prologue - region.start_aligned);
 }
 
 /*
@@ -0,0 +1,52 @@
+# Check that -icount quantum is only accepted with multi-threaded TCG
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or
+# later.  See the COPYING file in the top-level directory.
+from avocado_qemu import Test
+
+class IcountQuantum(Test):
+    def launch(self, *args):
+        self.vm.add_args('-S', '-display', 'none', '-machine', 'none', *args)
+        self.vm.set_qmp_monitor(enabled=False)
+        self.vm.launch()
+        self.vm.wait()
+
+    def test_single_thread(self):
+        """
+        :avocado: tags=accel:tcg
+        """
+        self.launch('-accel', 'tcg,thread=single',
+                    '-icount', 'shift=0,quantum=1000')
+        self.assertEqual(self.vm.exitcode(), 1, "QEMU exit code should be 1")
+        self.assertRegex(self.vm.get_log(),
+                         r'-icount quantum requires -accel tcg,thread=multi')
+
+    def test_default_thread(self):
+        """
+        :avocado: tags=accel:tcg
+        """
+        self.launch('-accel', 'tcg', '-icount', 'shift=0,quantum=1000')
+        self.assertEqual(self.vm.exitcode(), 1, "QEMU exit code should be 1")
+        self.assertRegex(self.vm.get_log(),
+                         r'-icount quantum requires -accel tcg,thread=multi')
+
+    def test_invalid(self):
+        """
+        :avocado: tags=accel:tcg
+        """
+        self.launch('-accel', 'tcg,thread=multi',
+                    '-icount', 'shift=0,quantum=0')
+        self.assertEqual(self.vm.exitcode(), 1, "QEMU exit code should be 1")
+        self.assertRegex(self.vm.get_log(), r'Invalid quantum value')
+
+    def test_multi_thread(self):
+        """
+        :avocado: tags=accel:tcg
+        """
+        self.vm.add_args('-S', '-display', 'none', '-machine', 'none',
+                         '-accel', 'tcg,thread=multi',
+                         '-icount', 'shift=0,quantum=1000')
+        self.vm.launch()
+        res = self.vm.command('query-status')
+        self.assertEqual(res['status'], 'prelaunch')
+        self.vm.shutdown()
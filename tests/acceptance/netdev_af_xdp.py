@@ -0,0 +1,141 @@
+# Pass packets through an af-xdp netdev bound to one end of a veth pair
+#
+# The af-xdp netdev is connected through a hub to a UDP socket netdev, so
+# no guest is needed: frames injected on the other end of the veth pair
+# come out of the UDP socket, and datagrams sent to the UDP socket are
+# transmitted on the veth pair.
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or
+# later.  See the COPYING file in the top-level directory.
+
+import os
+import shutil
+import socket
+import subprocess
+import time
+
+from avocado import skipUnless
+from avocado_qemu import Test
+
+CAP_NET_ADMIN = 12
+CAP_NET_RAW = 13
+
+ETH_P_ALL = 0x0003
+ETH_P_EXPERIMENTAL = 0x88b5
+
+
+def has_caps(*caps):
+    try:
+        with open('/proc/self/status') as status:
+            for line in status:
+                if line.startswith('CapEff:'):
+                    eff = int(line.split()[1], 16)
+                    return all(eff & (1 << cap) for cap in caps)
+    except OSError:
+        pass
+    return False
+
+
+def free_udp_port():
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as s:
+        s.bind(('127.0.0.1', 0))
+        return s.getsockname()[1]
+
+
+def frame(payload):
+    dst = b'\xff' * 6
+    src = b'\x02\x00\x00\x00\x00\x01'
+    ethertype = ETH_P_EXPERIMENTAL.to_bytes(2, 'big')
+    return dst + src + ethertype + payload
+
+
+class AFXDPVeth(Test):
+    """
+    :avocado: tags=net
+    """
+
+    VETH_QEMU = 'qxdp%d' % (os.getpid() % 10000)
+    VETH_HOST = VETH_QEMU + 'h'
+
+    def ip(self, *args):
+        subprocess.run(['ip'] + list(args), check=True,
+                       stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+    def setUp(self):
+        super().setUp()
+        if not shutil.which('ip'):
+            self.cancel('ip(8) not found')
+        try:
+            self.ip('link', 'add', self.VETH_QEMU, 'type', 'veth',
+                    'peer', 'name', self.VETH_HOST)
+        except subprocess.CalledProcessError:
+            self.cancel('cannot create a veth pair')
+        self.ip('link', 'set', self.VETH_QEMU, 'up')
+        self.ip('link', 'set', self.VETH_HOST, 'up')
+
+    def tearDown(self):
+        subprocess.run(['ip', 'link', 'del', self.VETH_QEMU],
+                       stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        super().tearDown()
+
+    def recv_until(self, sock, marker, timeout=10):
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            sock.settimeout(max(deadline - time.monotonic(), 0.01))
+            try:
+                data = sock.recv(2048)
+            except socket.timeout:
+                break
+            if marker in data:
+                return data
+        self.fail('packet with %r not received' % marker)
+
+    @skipUnless(has_caps(CAP_NET_ADMIN, CAP_NET_RAW),
+                'needs CAP_NET_ADMIN and CAP_NET_RAW')
+    def test_veth(self):
+        qemu_port = free_udp_port()
+        udp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        udp.bind(('127.0.0.1', 0))
+        self.addCleanup(udp.close)
+        host_port = udp.getsockname()[1]
+
+        raw = socket.socket(socket.AF_PACKET, socket.SOCK_RAW,
+                            socket.htons(ETH_P_ALL))
+        raw.bind((self.VETH_HOST, 0))
+        self.addCleanup(raw.close)
+
+        self.vm.add_args('-machine', 'none', '-display', 'none',
+                         '-netdev', 'af-xdp,id=xdp0,ifname=%s,mode=skb,'
+                                    'force-copy=on' % self.VETH_QEMU,
+                         '-netdev', 'hubport,id=hp0,hubid=0,netdev=xdp0',
+                         '-netdev', 'socket,id=udp0,udp=127.0.0.1:%d,'
+                                    'localaddr=127.0.0.1:%d'
+                                    % (host_port, qemu_port),
+                         '-netdev', 'hubport,id=hp1,hubid=0,netdev=udp0')
+        try:
+            self.vm.launch()
+        except Exception:
+            if 'XDP' in self.vm.get_log() or 'xsk' in self.vm.get_log():
+                self.cancel('cannot attach an XDP program: %s'
+                            % self.vm.get_log())
+            raise
+
+        # veth --> af-xdp --> hub --> UDP
+        rx = frame(b'qemu-af-xdp-rx' + bytes(64))
+        deadline = time.monotonic() + 10
+        udp.settimeout(0.2)
+        while True:
+            raw.send(rx)
+            try:
+                if b'qemu-af-xdp-rx' in udp.recv(2048):
+                    break
+            except socket.timeout:
+                pass
+            if time.monotonic() > deadline:
+                self.fail('frame sent on the veth pair did not reach QEMU')
+
+        # UDP --> hub --> af-xdp --> veth
+        tx = frame(b'qemu-af-xdp-tx' + bytes(64))
+        udp.sendto(tx, ('127.0.0.1', qemu_port))
+        data = self.recv_until(raw, b'qemu-af-xdp-tx')
+        self.assertEqual(data[:len(tx)], tx)
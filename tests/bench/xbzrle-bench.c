@@ -0,0 +1,87 @@
+/*
+ * Xor Based Zero Run Length Encoding speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "../migration/xbzrle.h"
+
+#define XBZRLE_PAGE_SIZE 4096
+#define XBZRLE_BENCH_PAGES 1024
+
+typedef struct XbzrleBenchOpts {
+    /* number of modified runs per page */
+    int runs;
+    /* length of each modified run */
+    int run_len;
+} XbzrleBenchOpts;
+
+static void test_encode_speed(const void *opaque)
+{
+    const XbzrleBenchOpts *opts = opaque;
+    const size_t total = 2 * GiB;
+    size_t buf_size = XBZRLE_BENCH_PAGES * XBZRLE_PAGE_SIZE;
+    uint8_t *old_buf = g_malloc(buf_size);
+    uint8_t *new_buf = g_malloc(buf_size);
+    uint8_t *dst = g_malloc(XBZRLE_PAGE_SIZE);
+    size_t done, i;
+    int r, j, off;
+
+    for (i = 0; i < buf_size; i++) {
+        old_buf[i] = g_test_rand_int();
+    }
+    memcpy(new_buf, old_buf, buf_size);
+
+    for (i = 0; i < XBZRLE_BENCH_PAGES; i++) {
+        uint8_t *page = new_buf + i * XBZRLE_PAGE_SIZE;
+
+        for (r = 0; r < opts->runs; r++) {
+            off = g_test_rand_int_range(0, XBZRLE_PAGE_SIZE - opts->run_len);
+            for (j = 0; j < opts->run_len; j++) {
+                page[off + j]++;
+            }
+        }
+    }
+
+    g_test_timer_start();
+    for (done = 0; done < total; done += buf_size) {
+        for (i = 0; i < buf_size; i += XBZRLE_PAGE_SIZE) {
+            xbzrle_encode_buffer(old_buf + i, new_buf + i, XBZRLE_PAGE_SIZE,
+                                 dst, XBZRLE_PAGE_SIZE);
+        }
+    }
+    g_test_timer_elapsed();
+
+    g_test_message("xbzrle encode: %d runs of %d bytes per page %.2f MB/sec",
+                   opts->runs, opts->run_len, total / MiB / g_test_timer_last());
+
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(dst);
+}
+
+int main(int argc, char **argv)
+{
+    static const XbzrleBenchOpts opts[] = {
+        { .runs = 0, .run_len = 0 },
+        { .runs = 1, .run_len = 8 },
+        { .runs = 4, .run_len = 64 },
+        { .runs = 16, .run_len = 16 },
+        { .runs = 64, .run_len = 4 },
+    };
+    char name[64];
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(opts); i++) {
+        snprintf(name, sizeof(name),
+                 "/xbzrle/benchmark/encode/runs-%d/len-%d",
+                 opts[i].runs, opts[i].run_len);
+        g_test_add_data_func(name, &opts[i], test_encode_speed);
+    }
+
+    return g_test_run();
+}
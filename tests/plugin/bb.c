@@ -27,6 +27,12 @@ typedef struct {
 static bool do_inline;
 static CPUCount inline_count;
 
+/* Per-vCPU inline counts */
+static bool do_per_vcpu;
+static struct qemu_plugin_scoreboard *scores;
+static qemu_plugin_u64 bb_count;
+static qemu_plugin_u64 insn_count;
+
 /* Dump running CPU total on idle? */
 static bool idle_report;
 static GPtrArray *counts;
@@ -46,7 +52,12 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
     g_autoptr(GString) report = g_string_new("");
 
-    if (do_inline || !max_cpus) {
+    if (do_per_vcpu) {
+        g_string_printf(report, "bb's: %" PRIu64", insns: %" PRIu64 "\n",
+                        qemu_plugin_u64_sum(bb_count),
+                        qemu_plugin_u64_sum(insn_count));
+        qemu_plugin_scoreboard_free(scores);
+    } else if (do_inline || !max_cpus) {
         g_string_printf(report, "bb's: %" PRIu64", insns: %" PRIu64 "\n",
                         inline_count.bb_count, inline_count.insn_count);
     } else {
@@ -83,7 +94,12 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
 {
     size_t n_insns = qemu_plugin_tb_n_insns(tb);
 
-    if (do_inline) {
+    if (do_per_vcpu) {
+        qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+            tb, QEMU_PLUGIN_INLINE_ADD_U64, bb_count, 1);
+        qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+            tb, QEMU_PLUGIN_INLINE_ADD_U64, insn_count, n_insns);
+    } else if (do_inline) {
         qemu_plugin_register_vcpu_tb_exec_inline(tb, QEMU_PLUGIN_INLINE_ADD_U64,
                                                  &inline_count.bb_count, 1);
         qemu_plugin_register_vcpu_tb_exec_inline(tb, QEMU_PLUGIN_INLINE_ADD_U64,
@@ -106,6 +122,9 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
         char *opt = argv[i];
         if (g_strcmp0(opt, "inline") == 0) {
             do_inline = true;
+        } else if (g_strcmp0(opt, "per-vcpu") == 0) {
+            do_inline = true;
+            do_per_vcpu = true;
         } else if (g_strcmp0(opt, "idle") == 0) {
             idle_report = true;
         } else {
@@ -114,7 +133,13 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
         }
     }
 
-    if (info->system_emulation && !do_inline) {
+    if (do_per_vcpu) {
+        scores = qemu_plugin_scoreboard_new(sizeof(CPUCount));
+        bb_count = qemu_plugin_scoreboard_u64_in_struct(scores, CPUCount,
+                                                        bb_count);
+        insn_count = qemu_plugin_scoreboard_u64_in_struct(scores, CPUCount,
+                                                          insn_count);
+    } else if (info->system_emulation && !do_inline) {
         max_cpus = info->system.max_vcpus;
         counts = g_ptr_array_new();
         for (i = 0; i < max_cpus; i++) {
@@ -23,6 +23,28 @@ static bool do_inline, do_callback;
 static bool do_haddr;
 static enum qemu_plugin_mem_rw rw = QEMU_PLUGIN_MEM_RW;
 
+/*
+ * "store" mode: inline ops record the pc of each instruction and the
+ * address and meminfo of each access, and the memory callback checks
+ * them.  Inline memory ops run after the callback, so the callback sees
+ * the values of the previous access of the vCPU.
+ */
+typedef struct {
+    uint64_t pc;
+    uint64_t vaddr;
+    uint64_t meminfo;
+    /* what the inline ops should have stored, updated by the callback */
+    uint64_t last_vaddr;
+    uint64_t last_meminfo;
+} CPUStore;
+
+static bool do_store;
+static struct qemu_plugin_scoreboard *stores;
+static qemu_plugin_u64 store_pc;
+static qemu_plugin_u64 store_vaddr;
+static qemu_plugin_u64 store_meminfo;
+static uint64_t store_mismatch;
+
 static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
     g_autoptr(GString) out = g_string_new("");
@@ -36,7 +58,29 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
     if (do_haddr) {
         g_string_append_printf(out, "io accesses: %" PRIu64 "\n", io_count);
     }
+    if (do_store) {
+        g_string_append_printf(out, "inline store mismatches: %" PRIu64 "\n",
+                               store_mismatch);
+        qemu_plugin_scoreboard_free(stores);
+    }
     qemu_plugin_outs(out->str);
+    g_assert(store_mismatch == 0);
+}
+
+static void vcpu_mem_store(unsigned int cpu_index,
+                           qemu_plugin_meminfo_t meminfo,
+                           uint64_t vaddr, void *udata)
+{
+    CPUStore *store = qemu_plugin_scoreboard_find(stores, cpu_index);
+
+    if ((uintptr_t)store->pc != (uintptr_t)udata ||
+        store->vaddr != store->last_vaddr ||
+        store->meminfo != store->last_meminfo) {
+        __atomic_fetch_add(&store_mismatch, 1, __ATOMIC_RELAXED);
+    }
+    store->last_vaddr = vaddr;
+    store->last_meminfo = meminfo;
+    cb_mem_count++;
 }
 
 static void vcpu_mem(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
@@ -68,7 +112,19 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
                                                  QEMU_PLUGIN_INLINE_ADD_U64,
                                                  &inline_mem_count, 1);
         }
-        if (do_callback) {
+        if (do_store) {
+            uint64_t pc = qemu_plugin_insn_vaddr(insn);
+
+            qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+                insn, QEMU_PLUGIN_INLINE_STORE_U64, store_pc, pc);
+            qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_store,
+                                             QEMU_PLUGIN_CB_NO_REGS,
+                                             rw, (void *)(uintptr_t)pc);
+            qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+                insn, rw, QEMU_PLUGIN_INLINE_STORE_VADDR, store_vaddr, 0);
+            qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+                insn, rw, QEMU_PLUGIN_INLINE_STORE_MEMINFO, store_meminfo, 0);
+        } else if (do_callback) {
             qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem,
                                              QEMU_PLUGIN_CB_NO_REGS,
                                              rw, NULL);
@@ -101,11 +157,23 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
         } else if (!strcmp(argv[0], "both")) {
             do_inline = true;
             do_callback = true;
+        } else if (!strcmp(argv[0], "store")) {
+            do_store = true;
+            do_callback = true;
         } else {
             do_callback = true;
         }
     }
 
+    if (do_store) {
+        stores = qemu_plugin_scoreboard_new(sizeof(CPUStore));
+        store_pc = qemu_plugin_scoreboard_u64_in_struct(stores, CPUStore, pc);
+        store_vaddr = qemu_plugin_scoreboard_u64_in_struct(stores, CPUStore,
+                                                           vaddr);
+        store_meminfo = qemu_plugin_scoreboard_u64_in_struct(stores, CPUStore,
+                                                             meminfo);
+    }
+
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
     return 0;
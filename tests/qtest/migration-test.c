@@ -785,7 +785,7 @@ static void test_baddest(void)
     test_migrate_end(from, to, false);
 }
 
-static void test_precopy_unix(void)
+static void test_precopy_unix_common(int dirty_sync_threads)
 {
     g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
     MigrateStart *args = migrate_start_new();
@@ -795,6 +795,8 @@ static void test_precopy_unix(void)
         return;
     }
 
+    migrate_set_parameter_int(from, "dirty-sync-threads", dirty_sync_threads);
+
     /* We want to pick a speed slow enough that the test completes
      * quickly, but that it doesn't complete precopy even on a slow
      * machine, so also set the downtime.
@@ -825,6 +827,16 @@ static void test_precopy_unix(void)
     test_migrate_end(from, to, true);
 }
 
+static void test_precopy_unix(void)
+{
+    test_precopy_unix_common(0);
+}
+
+static void test_precopy_unix_dirty_sync_threads(void)
+{
+    test_precopy_unix_common(4);
+}
+
 #if 0
 /* Currently upset on aarch64 TCG */
 static void test_ignore_shared(void)
@@ -1200,7 +1212,8 @@ static void test_migrate_auto_converge(void)
     test_migrate_end(from, to, true);
 }
 
-static void test_multifd_tcp(const char *method)
+static void test_multifd_tcp_common(const char *method, bool zero_page,
+                                    bool zero_copy)
 {
     MigrateStart *args = migrate_start_new();
     QTestState *from, *to;
@@ -1230,6 +1243,16 @@ static void test_multifd_tcp(const char *method)
     migrate_set_capability(from, "multifd", true);
     migrate_set_capability(to, "multifd", true);
 
+    if (zero_page) {
+        migrate_set_capability(from, "multifd-zero-page", true);
+        migrate_set_capability(to, "multifd-zero-page", true);
+    }
+
+    if (zero_copy) {
+        /* Only the sending side uses MSG_ZEROCOPY */
+        migrate_set_capability(from, "zero-copy-send", true);
+    }
+
     /* Start incoming migration from the 1st socket */
     rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
                            "  'arguments': { 'uri': 'tcp:127.0.0.1:0' }}");
@@ -1253,19 +1276,56 @@ static void test_multifd_tcp(const char *method)
 
     wait_for_serial("dest_serial");
     wait_for_migration_complete(from);
+
+    if (zero_page) {
+        int64_t page_size = read_ram_property_int(from, "page-size");
+        int64_t normal = read_ram_property_int(from, "normal");
+        int64_t duplicate = read_ram_property_int(from, "duplicate");
+
+        /*
+         * Zero pages only cost their offset in the packets, allow for
+         * those, the packet headers and the sync packets.
+         */
+        g_assert_cmpint(duplicate, >, 0);
+        g_assert_cmpint(read_ram_property_int(from, "multifd-bytes"), <,
+                        normal * page_size + (normal + duplicate) * 64 +
+                        1024 * 1024);
+    }
     test_migrate_end(from, to, true);
 }
 
+static void test_multifd_tcp(const char *method)
+{
+    test_multifd_tcp_common(method, false, false);
+}
+
 static void test_multifd_tcp_none(void)
 {
     test_multifd_tcp("none");
 }
 
+static void test_multifd_tcp_zero_page(void)
+{
+    test_multifd_tcp_common("none", true, false);
+}
+
+#ifdef CONFIG_LINUX
+static void test_multifd_tcp_zero_copy(void)
+{
+    test_multifd_tcp_common("none", false, true);
+}
+#endif
+
 static void test_multifd_tcp_zlib(void)
 {
     test_multifd_tcp("zlib");
 }
 
+static void test_multifd_tcp_xbzrle(void)
+{
+    test_multifd_tcp("xbzrle");
+}
+
 #ifdef CONFIG_ZSTD
 static void test_multifd_tcp_zstd(void)
 {
@@ -1273,6 +1333,13 @@ static void test_multifd_tcp_zstd(void)
 }
 #endif
 
+#ifdef CONFIG_LZ4
+static void test_multifd_tcp_lz4(void)
+{
+    test_multifd_tcp("lz4");
+}
+#endif
+
 /*
  * This test does:
  *  source               target
@@ -1420,6 +1487,8 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/postcopy/recovery", test_postcopy_recovery);
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix", test_precopy_unix);
+    qtest_add_func("/migration/precopy/unix/dirty-sync-threads",
+                   test_precopy_unix_dirty_sync_threads);
     qtest_add_func("/migration/precopy/tcp", test_precopy_tcp);
     /* qtest_add_func("/migration/ignore_shared", test_ignore_shared); */
     qtest_add_func("/migration/xbzrle/unix", test_xbzrle_unix);
@@ -1435,9 +1504,19 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/multifd/tcp/none", test_multifd_tcp_none);
     qtest_add_func("/migration/multifd/tcp/cancel", test_multifd_tcp_cancel);
     qtest_add_func("/migration/multifd/tcp/zlib", test_multifd_tcp_zlib);
+    qtest_add_func("/migration/multifd/tcp/xbzrle", test_multifd_tcp_xbzrle);
+    qtest_add_func("/migration/multifd/tcp/zero-page",
+                   test_multifd_tcp_zero_page);
+#ifdef CONFIG_LINUX
+    qtest_add_func("/migration/multifd/tcp/zero-copy",
+                   test_multifd_tcp_zero_copy);
+#endif
 #ifdef CONFIG_ZSTD
     qtest_add_func("/migration/multifd/tcp/zstd", test_multifd_tcp_zstd);
 #endif
+#ifdef CONFIG_LZ4
+    qtest_add_func("/migration/multifd/tcp/lz4", test_multifd_tcp_lz4);
+#endif
 
     ret = g_test_run();
 
@@ -0,0 +1,62 @@
+/*
+ * QTest testcase for the af-xdp netdev option parsing
+ *
+ * These checks fail before any XDP socket is created, so they do not
+ * need privileges or a dedicated host interface.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqos/libqtest.h"
+#include "qapi/qmp/qdict.h"
+
+static void check_netdev_add_error(QTestState *qts, const char *opts,
+                                   const char *expected)
+{
+    g_autofree char *cmd = NULL;
+    QDict *response, *error;
+
+    cmd = g_strdup_printf("{'execute': 'netdev_add',"
+                          " 'arguments': { 'type': 'af-xdp', 'id': 'xdp0',"
+                          " %s }}", opts);
+    response = qtest_qmp(qts, cmd);
+    g_assert(response);
+    error = qdict_get_qdict(response, "error");
+    g_assert(error);
+    g_assert_nonnull(strstr(qdict_get_str(error, "desc"), expected));
+    qobject_unref(response);
+}
+
+static void test_af_xdp_options(void)
+{
+    QTestState *qts = qtest_init("-machine none");
+
+    check_netdev_add_error(qts, "'ifname': 'lo', 'queues': 0",
+                           "queues must be in the range");
+    check_netdev_add_error(qts, "'ifname': 'lo', 'queues': 1025",
+                           "queues must be in the range");
+    check_netdev_add_error(qts, "'ifname': 'lo', 'start-queue': -1",
+                           "invalid start-queue");
+    check_netdev_add_error(qts, "'ifname': 'qtest-name-too-long0'",
+                           "is too long");
+    check_netdev_add_error(qts, "'ifname': 'qtestnoif0'",
+                           "failed to get ifindex for qtestnoif0");
+    check_netdev_add_error(qts, "'ifname': 'lo', 'mode': 'foo'",
+                           "mode");
+
+    /* Failed attempts must not leave the id in use */
+    check_netdev_add_error(qts, "'ifname': 'qtestnoif0'",
+                           "failed to get ifindex");
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    qtest_add_func("/netdev/af-xdp/options", test_af_xdp_options);
+
+    return g_test_run();
+}
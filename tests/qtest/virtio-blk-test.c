@@ -16,6 +16,10 @@
 #include "standard-headers/linux/virtio_pci.h"
 #include "libqos/qgraph.h"
 #include "libqos/virtio-blk.h"
+#ifdef CONFIG_LINUX_IO_URING
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
 
 /* TODO actually test the results and get rid of this */
 #define qmp_discard_response(...) qobject_unref(qmp(__VA_ARGS__))
@@ -766,6 +770,141 @@ static void resize(void *obj, void *data, QGuestAllocator *t_alloc)
 
 }
 
+static uint64_t iothreads_submit(QVirtioDevice *dev, QGuestAllocator *alloc,
+                                 QVirtQueue *vq, uint32_t type,
+                                 uint64_t sector, const char *data,
+                                 uint32_t *free_head)
+{
+    QVirtioBlkReq req;
+    uint64_t req_addr;
+    QTestState *qts = global_qtest;
+
+    req.type = type;
+    req.ioprio = 1;
+    req.sector = sector;
+    req.data = g_malloc0(512);
+    if (type == VIRTIO_BLK_T_OUT) {
+        strcpy(req.data, data);
+    }
+
+    req_addr = virtio_blk_request(alloc, dev, &req, 512);
+
+    g_free(req.data);
+
+    *free_head = qvirtqueue_add(qts, vq, req_addr, 16, false, true);
+    qvirtqueue_add(qts, vq, req_addr + 16, 512,
+                   type == VIRTIO_BLK_T_IN, true);
+    qvirtqueue_add(qts, vq, req_addr + 528, 1, true, false);
+
+    qvirtqueue_kick(qts, dev, vq, *free_head);
+    return req_addr;
+}
+
+static void iothreads_complete(QVirtioDevice *dev, QGuestAllocator *alloc,
+                               QVirtQueue *vq, uint64_t req_addr,
+                               uint32_t free_head, char *data)
+{
+    QTestState *qts = global_qtest;
+    uint8_t status;
+
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_BLK_TIMEOUT_US);
+    status = readb(req_addr + 528);
+    g_assert_cmpint(status, ==, 0);
+
+    if (data) {
+        memread(req_addr + 16, data, 512);
+    }
+
+    guest_free(alloc, req_addr);
+}
+
+static void iothreads_rw(QVirtioDevice *dev, QGuestAllocator *alloc,
+                         QVirtQueue *vq, uint32_t type, uint64_t sector,
+                         char *data)
+{
+    uint32_t free_head;
+    uint64_t req_addr;
+
+    req_addr = iothreads_submit(dev, alloc, vq, type, sector, data,
+                                &free_head);
+    iothreads_complete(dev, alloc, vq, req_addr, free_head,
+                       type == VIRTIO_BLK_T_IN ? data : NULL);
+}
+
+/*
+ * Two virtqueues mapped to two IOThreads: data written through one queue
+ * must be visible through the other, also when both queues have requests
+ * in flight at the same time.
+ */
+static void iothreads(void *obj, void *u_data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlkPCI *blk = obj;
+    QVirtioDevice *dev = &blk->pci_vdev.vdev;
+    QVirtQueue *vq[2];
+    uint64_t req_addr[2];
+    uint32_t free_head[2];
+    uint64_t features;
+    char *data;
+    char *expected;
+    int i, round;
+
+    features = qvirtio_get_features(dev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                            (1u << VIRTIO_RING_F_EVENT_IDX) |
+                            (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(dev, features);
+
+    for (i = 0; i < 2; i++) {
+        vq[i] = qvirtqueue_setup(dev, t_alloc, i);
+    }
+
+    qvirtio_set_driver_ok(dev);
+
+    iothreads_rw(dev, t_alloc, vq[0], VIRTIO_BLK_T_OUT, 0, (char *)"TEST0");
+    iothreads_rw(dev, t_alloc, vq[1], VIRTIO_BLK_T_OUT, 1, (char *)"TEST1");
+
+    data = g_malloc0(512);
+    iothreads_rw(dev, t_alloc, vq[1], VIRTIO_BLK_T_IN, 0, data);
+    g_assert_cmpstr(data, ==, "TEST0");
+    iothreads_rw(dev, t_alloc, vq[0], VIRTIO_BLK_T_IN, 1, data);
+    g_assert_cmpstr(data, ==, "TEST1");
+
+    /* Kick both queues before waiting, so that both IOThreads are busy */
+    for (round = 0; round < 16; round++) {
+        for (i = 0; i < 2; i++) {
+            expected = g_strdup_printf("ROUND%d-VQ%d", round, i);
+            req_addr[i] = iothreads_submit(dev, t_alloc, vq[i],
+                                           VIRTIO_BLK_T_OUT, 2 + i, expected,
+                                           &free_head[i]);
+            g_free(expected);
+        }
+        for (i = 0; i < 2; i++) {
+            iothreads_complete(dev, t_alloc, vq[i], req_addr[i],
+                               free_head[i], NULL);
+        }
+
+        for (i = 0; i < 2; i++) {
+            req_addr[i] = iothreads_submit(dev, t_alloc, vq[i],
+                                           VIRTIO_BLK_T_IN, 3 - i, NULL,
+                                           &free_head[i]);
+        }
+        for (i = 0; i < 2; i++) {
+            iothreads_complete(dev, t_alloc, vq[i], req_addr[i],
+                               free_head[i], data);
+            expected = g_strdup_printf("ROUND%d-VQ%d", round, 1 - i);
+            g_assert_cmpstr(data, ==, expected);
+            g_free(expected);
+        }
+    }
+    g_free(data);
+
+    for (i = 0; i < 2; i++) {
+        qvirtqueue_cleanup(dev->bus, vq[i], t_alloc);
+    }
+}
+
 static void *virtio_blk_test_setup(GString *cmd_line, void *arg)
 {
     char *tmp_path = drive_create();
@@ -780,6 +919,45 @@ static void *virtio_blk_test_setup(GString *cmd_line, void *arg)
     return arg;
 }
 
+static void *virtio_blk_test_setup_iothreads(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line, " -object iothread,id=thread0 "
+                              "-object iothread,id=thread1 ");
+    return virtio_blk_test_setup(cmd_line, arg);
+}
+
+#ifdef CONFIG_LINUX_IO_URING
+static bool have_io_uring(void)
+{
+    struct io_uring_params params = { 0 };
+    int fd = syscall(__NR_io_uring_setup, 1, &params);
+
+    if (fd < 0) {
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+/*
+ * Requests whose data is a single descriptor point straight into guest RAM,
+ * so they go through READ_FIXED/WRITE_FIXED.  If guest RAM cannot be pinned,
+ * for example because of RLIMIT_MEMLOCK, they fall back to readv/writev.
+ */
+static void *virtio_blk_test_setup_io_uring(GString *cmd_line, void *arg)
+{
+    char *tmp_path = drive_create();
+
+    g_string_append_printf(cmd_line,
+                           " -drive if=none,id=drive0,file=%s,"
+                           "format=raw,auto-read-only=off,aio=io_uring,"
+                           "file.x-io-uring-fixed=on ",
+                           tmp_path);
+
+    return arg;
+}
+#endif
+
 static void register_virtio_blk_test(void)
 {
     QOSGraphTestOptions opts = {
@@ -797,6 +975,19 @@ static void register_virtio_blk_test(void)
     qos_add_test("nxvirtq", "virtio-blk-pci",
                       test_nonexistent_virtqueue, &opts);
     qos_add_test("hotplug", "virtio-blk-pci", pci_hotplug, &opts);
+
+    opts.before = virtio_blk_test_setup_iothreads;
+    opts.edge.extra_device_opts = "num-queues=2,len-iothreads=2,"
+                                  "iothreads[0]=thread0,iothreads[1]=thread1";
+    qos_add_test("iothreads", "virtio-blk-pci", iothreads, &opts);
+
+#ifdef CONFIG_LINUX_IO_URING
+    if (have_io_uring()) {
+        opts.before = virtio_blk_test_setup_io_uring;
+        opts.edge.extra_device_opts = NULL;
+        qos_add_test("io-uring-fixed", "virtio-blk", basic, &opts);
+    }
+#endif
 }
 
 libqos_init(register_virtio_blk_test);
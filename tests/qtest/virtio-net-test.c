@@ -156,6 +156,15 @@ static void send_recv_test(void *obj, void *data, QGuestAllocator *t_alloc)
     tx_test(dev, t_alloc, tx, sv[0]);
 }
 
+/* Same as send_recv_test, with the queue pair running in an IOThread */
+static void send_recv_iothread_test(void *obj, void *data,
+                                    QGuestAllocator *t_alloc)
+{
+    QVirtioNetPCI *net_pci = obj;
+
+    send_recv_test(&net_pci->net, data, t_alloc);
+}
+
 static void stop_cont_test(void *obj, void *data, QGuestAllocator *t_alloc)
 {
     QVirtioNet *net_if = obj;
@@ -282,6 +291,14 @@ static void *virtio_net_test_setup(GString *cmd_line, void *arg)
     return sv;
 }
 
+#ifndef _WIN32
+static void *virtio_net_test_setup_iothread(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line, " -object iothread,id=thread0 ");
+    return virtio_net_test_setup(cmd_line, arg);
+}
+#endif
+
 static void large_tx(void *obj, void *data, QGuestAllocator *t_alloc)
 {
     QVirtioNet *dev = obj;
@@ -326,6 +343,14 @@ static void register_virtio_net_test(void)
 #endif
     qos_add_test("announce-self", "virtio-net", announce_self, &opts);
 
+#ifndef _WIN32
+    opts.before = virtio_net_test_setup_iothread;
+    opts.edge.extra_device_opts = "len-iothreads=1,iothreads[0]=thread0";
+    qos_add_test("basic/iothread", "virtio-net-pci", send_recv_iothread_test,
+                 &opts);
+    opts.edge.extra_device_opts = NULL;
+#endif
+
     /* These tests do not need a loopback backend.  */
     opts.before = virtio_net_test_setup_nosocket;
     opts.arg = (gpointer)UINT_MAX;
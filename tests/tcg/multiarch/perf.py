@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+#
+# Run a guest binary with -perfmap and -jitdump, and check that the perf
+# map has an entry for translated code and that the jitdump file parses:
+# a valid header followed by well-formed code load and debug info records.
+#
+# SPDX-License-Identifier: GPL-2.0-or-later
+
+import os
+import re
+import struct
+import subprocess
+import sys
+import tempfile
+
+JITHEADER = struct.Struct('=IIIIIIQQ')
+JITHEADER_MAGIC = 0x4A695444
+JITHEADER_VERSION = 1
+JR_PREFIX = struct.Struct('=IIQ')
+JR_CODE_LOAD = struct.Struct('=IIQQQQ')
+JR_CODE_DEBUG_INFO = struct.Struct('=QQ')
+DEBUG_ENTRY = struct.Struct('=QII')
+JIT_CODE_LOAD = 0
+JIT_CODE_DEBUG_INFO = 2
+
+MAP_LINE = re.compile(r'^([0-9a-f]+) ([0-9a-f]+) (.+)$')
+
+
+def fail(msg):
+    print('FAIL: ' + msg)
+    sys.exit(1)
+
+
+def cstring(data, pos, end):
+    nul = data.find(b'\0', pos, end)
+    if nul < 0:
+        fail('unterminated name at offset %d' % pos)
+    return data[pos:nul].decode(), nul + 1
+
+
+def check_perfmap(path):
+    entries = 0
+    with open(path) as f:
+        for line in f:
+            m = MAP_LINE.match(line.rstrip('\n'))
+            if not m:
+                fail('malformed perf map line: %r' % line)
+            if int(m.group(2), 16) == 0:
+                fail('empty code range in perf map: %r' % line)
+            if m.group(3).startswith('guest-0x'):
+                entries += 1
+    if not entries:
+        fail('no translated code in the perf map')
+    return entries
+
+
+def check_jitdump(path, pid):
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    if len(data) < JITHEADER.size:
+        fail('jitdump too short for its header')
+    (magic, version, total_size, _elf_mach, _pad, hdr_pid,
+     _timestamp, _flags) = JITHEADER.unpack_from(data)
+    if magic != JITHEADER_MAGIC:
+        fail('bad jitdump magic %#x' % magic)
+    if version != JITHEADER_VERSION or total_size != JITHEADER.size:
+        fail('bad jitdump header version %d size %d' % (version, total_size))
+    if hdr_pid != pid:
+        fail('jitdump header pid %d, expected %d' % (hdr_pid, pid))
+
+    loads = 0
+    debug_addr = None
+    pos = JITHEADER.size
+    while pos < len(data):
+        if len(data) - pos < JR_PREFIX.size:
+            fail('truncated record prefix at offset %d' % pos)
+        rec_id, size, _timestamp = JR_PREFIX.unpack_from(data, pos)
+        end = pos + size
+        if size < JR_PREFIX.size or end > len(data):
+            fail('bad record size %d at offset %d' % (size, pos))
+        body = pos + JR_PREFIX.size
+
+        if rec_id == JIT_CODE_LOAD:
+            (rec_pid, _tid, vma, code_addr, code_size,
+             code_index) = JR_CODE_LOAD.unpack_from(data, body)
+            _name, code = cstring(data, body + JR_CODE_LOAD.size, end)
+            if rec_pid != pid or vma != code_addr:
+                fail('bad code load record at offset %d' % pos)
+            if code_index != loads or code + code_size != end:
+                fail('bad code load index or size at offset %d' % pos)
+            if debug_addr is not None and debug_addr != code_addr:
+                fail('debug info for %#x precedes code at %#x' %
+                     (debug_addr, code_addr))
+            debug_addr = None
+            loads += 1
+        elif rec_id == JIT_CODE_DEBUG_INFO:
+            code_addr, nr_entry = JR_CODE_DEBUG_INFO.unpack_from(data, body)
+            entry = body + JR_CODE_DEBUG_INFO.size
+            for _ in range(nr_entry):
+                addr, _lineno, _discrim = DEBUG_ENTRY.unpack_from(data, entry)
+                name, entry = cstring(data, entry + DEBUG_ENTRY.size, end)
+                if addr < code_addr or not name.startswith('guest-0x'):
+                    fail('bad debug entry at offset %d' % entry)
+            if entry != end or nr_entry == 0:
+                fail('bad debug info record at offset %d' % pos)
+            debug_addr = code_addr
+        else:
+            fail('unexpected record type %d at offset %d' % (rec_id, pos))
+        pos = end
+
+    if loads < 2:
+        fail('no code load records besides the prologue')
+    return loads
+
+
+def main():
+    qemu, binary = sys.argv[1:3]
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        env = dict(os.environ, TMPDIR=tmpdir)
+        proc = subprocess.Popen([qemu, '-perfmap', '-jitdump', binary],
+                                env=env, stdout=subprocess.DEVNULL)
+        perfmap = '/tmp/perf-%d.map' % proc.pid
+        try:
+            if proc.wait() != 0:
+                fail('%s exited with %d' % (binary, proc.returncode))
+            entries = check_perfmap(perfmap)
+            loads = check_jitdump(os.path.join(tmpdir,
+                                               'jit-%d.dump' % proc.pid),
+                                  proc.pid)
+        except OSError as e:
+            fail(str(e))
+        finally:
+            if os.path.exists(perfmap):
+                os.unlink(perfmap)
+
+    print('PASS: %d perf map entries, %d jitdump code loads' %
+          (entries, loads))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,49 @@
+#!/bin/sh
+#
+# Run a guest binary twice with a persistent TB cache: the first run
+# saves its translations, the second one must execute TBs restored from
+# the file and still produce the same output.
+#
+# SPDX-License-Identifier: GPL-2.0-or-later
+
+QEMU=$1
+BIN=$2
+
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+run()
+{
+    # Cached code is only reused if QEMU is loaded at the same address
+    setarch "$(uname -m)" -R \
+        "$QEMU" -tb-cache "$DIR" \
+        -d trace:tb_cache_open,trace:tb_cache_page -D "$DIR/log$1" \
+        "$BIN" > "$DIR/out$1"
+}
+
+if ! setarch "$(uname -m)" -R true 2>/dev/null; then
+    echo "SKIPPED: cannot disable address space randomization"
+    exit 0
+fi
+
+run 1 || exit 1
+if ! grep -q tb_cache_open "$DIR/log1"; then
+    echo "SKIPPED: tracing needs the log backend"
+    exit 0
+fi
+if [ -z "$(ls "$DIR"/*.tbc 2>/dev/null)" ]; then
+    echo "FAIL: no cache file was written"
+    exit 1
+fi
+
+run 2 || exit 1
+if ! grep -q 'tb_cache_page .*valid=1 tbs=[1-9]' "$DIR/log2"; then
+    echo "FAIL: no translation block was restored from the cache"
+    cat "$DIR/log2"
+    exit 1
+fi
+if ! cmp -s "$DIR/out1" "$DIR/out2"; then
+    echo "FAIL: output differs when running from the cache"
+    exit 1
+fi
+echo "PASS: restored TBs from the cache"
@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# Run a guest binary with and without hot TBs being retranslated as
+# traces: at least one trace must be built and the output must not
+# change.
+#
+# SPDX-License-Identifier: GPL-2.0-or-later
+
+QEMU=$1
+BIN=$2
+
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+"$QEMU" "$BIN" > "$DIR/out1" || exit 1
+"$QEMU" -tb-trace 16 -d trace:translate_block,trace:tb_gen_trace \
+    -D "$DIR/log" "$BIN" > "$DIR/out2" || exit 1
+
+if ! grep -q translate_block "$DIR/log"; then
+    echo "SKIPPED: tracing needs the log backend"
+    exit 0
+fi
+if ! grep -q 'tb_gen_trace .*blocks=[2-9]' "$DIR/log"; then
+    echo "FAIL: no trace was built"
+    exit 1
+fi
+if ! cmp -s "$DIR/out1" "$DIR/out2"; then
+    echo "FAIL: output differs when running traces"
+    exit 1
+fi
+echo "PASS: ran $(grep -c tb_gen_trace "$DIR/log") traces"
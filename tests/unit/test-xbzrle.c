@@ -174,6 +174,104 @@ static void test_encode_decode(void)
     }
 }
 
+static void test_encode_accel(void)
+{
+    uint8_t *old_buf = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *new_buf = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *compressed = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *test = g_malloc(XBZRLE_PAGE_SIZE);
+    int i, off, rc, dlen;
+
+    for (i = 0; i < XBZRLE_PAGE_SIZE; i++) {
+        old_buf[i] = g_test_rand_int();
+    }
+
+    do {
+        memcpy(new_buf, old_buf, XBZRLE_PAGE_SIZE);
+
+        /* runs of many lengths at every alignment, up to the page end */
+        for (off = XBZRLE_PAGE_SIZE - 1; off >= 0; off -= 61) {
+            for (i = off; i <= off + off % 130 && i < XBZRLE_PAGE_SIZE; i++) {
+                new_buf[i] = old_buf[i] + 1;
+            }
+
+            dlen = xbzrle_encode_buffer(old_buf, new_buf, XBZRLE_PAGE_SIZE,
+                                        compressed, XBZRLE_PAGE_SIZE);
+            g_assert(dlen > 0);
+            memcpy(test, old_buf, XBZRLE_PAGE_SIZE);
+            rc = xbzrle_decode_buffer(compressed, dlen, test,
+                                      XBZRLE_PAGE_SIZE);
+            g_assert(rc > 0);
+            g_assert(memcmp(test, new_buf, XBZRLE_PAGE_SIZE) == 0);
+        }
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(compressed);
+    g_free(test);
+}
+
+/*
+ * Whichever encoder is selected must return the same length and produce
+ * the same bytes as the portable one, including when @dst is too small.
+ */
+static void test_encode_accel_exact(void)
+{
+    static const int sizes[] = {
+        8, 16, 24, 32, 40, 56, 64, 72, 120, 128, 136, 192, 248, 256, 264,
+        XBZRLE_PAGE_SIZE - 8, XBZRLE_PAGE_SIZE
+    };
+    uint8_t *old_buf = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *new_buf = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *ref = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *out = g_malloc(XBZRLE_PAGE_SIZE);
+    int i, j, n, off, len, slen, dlen, ref_len, ret;
+
+    do {
+        for (i = 0; i < 2000; i++) {
+            /* the portable encoder works on whole longs */
+            slen = i < ARRAY_SIZE(sizes) ? sizes[i] :
+                   g_test_rand_int_range(1, XBZRLE_PAGE_SIZE / 8 + 1) * 8;
+
+            for (j = 0; j < slen; j++) {
+                old_buf[j] = g_test_rand_int();
+            }
+            memcpy(new_buf, old_buf, slen);
+
+            /* runs around the vector sizes, anywhere, up to the end */
+            n = g_test_rand_int_range(0, 16);
+            for (j = 0; j < n; j++) {
+                off = g_test_rand_int_range(0, slen);
+                len = MIN(g_test_rand_int_range(1, 130), slen - off);
+                while (len--) {
+                    new_buf[off + len] = old_buf[off + len] ^
+                                         g_test_rand_int_range(1, 256);
+                }
+            }
+            if (i % 50 == 0) {
+                for (j = 0; j < slen; j++) {
+                    new_buf[j] = old_buf[j] ^ 0xff;
+                }
+            }
+
+            dlen = i % 3 ? slen : g_test_rand_int_range(0, slen + 1);
+            ref_len = xbzrle_encode_buffer_int(old_buf, new_buf, slen,
+                                               ref, dlen);
+            ret = xbzrle_encode_buffer(old_buf, new_buf, slen, out, dlen);
+            g_assert_cmpint(ret, ==, ref_len);
+            if (ret > 0) {
+                g_assert(memcmp(out, ref, ret) == 0);
+            }
+        }
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(ref);
+    g_free(out);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -186,6 +284,8 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
+    g_test_add_func("/xbzrle/encode_accel_exact", test_encode_accel_exact);
 
     return g_test_run();
 }
@@ -395,13 +395,14 @@ LinuxAioState *aio_get_linux_aio(AioContext *ctx)
 #endif
 
 #ifdef CONFIG_LINUX_IO_URING
-LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
+LuringState *aio_setup_linux_io_uring(AioContext *ctx, bool sqpoll,
+                                      int sqpoll_cpu, Error **errp)
 {
     if (ctx->linux_io_uring) {
         return ctx->linux_io_uring;
     }
 
-    ctx->linux_io_uring = luring_init(errp);
+    ctx->linux_io_uring = luring_init(sqpoll, sqpoll_cpu, errp);
     if (!ctx->linux_io_uring) {
         return NULL;
     }